@@ -0,0 +1,63 @@
+# Time Cube.apply() with trilinear and tetrahedral interpolation, for
+# lattices of 17, 33, and 65 vertices per axis, on a frame of rgba8 and
+# of rgba32 (float) pixels.
+#
+#	python bench/cube_interp.py [width height [repeats]]
+
+import array
+import random
+import sys
+import time
+
+import koliba
+
+SIZES = (17, 33, 65)
+MODES = ("trilinear", "tetrahedral")
+FORMATS = ("rgba8", "rgba32")
+
+
+def frame(fmt, pixels):
+	b = random.Random(0).randbytes(pixels * 4)
+	if fmt == "rgba8":
+		return b
+	return array.array("f", (x / 255.0 for x in b)).tobytes()
+
+
+def best(fn, repeats):
+	t = float("inf")
+	for _ in range(repeats):
+		s = time.perf_counter()
+		fn()
+		t = min(t, time.perf_counter() - s)
+	return t
+
+
+def main(argv):
+	width = int(argv[1]) if len(argv) > 1 else 1920
+	height = int(argv[2]) if len(argv) > 2 else 1080
+	repeats = int(argv[3]) if len(argv) > 3 else 10
+	pixels = width * height
+
+	# Something that is not an identity, so nothing takes a shortcut.
+	slut = koliba.Slut()
+	slut.red = (0.9, 0.1, 0.05)
+	slut.yellow = (1.0, 0.85, 0.1)
+	slut.blue = (0.05, 0.1, 0.8)
+
+	print("%s, %d threads, %dx%d, best of %d" % (koliba.Simd(), koliba.Threads(), width, height, repeats))
+	print("%-8s %5s %12s %12s %8s" % ("format", "size", MODES[0], MODES[1], "ratio"))
+	for fmt in FORMATS:
+		src = frame(fmt, pixels)
+		dst = bytearray(len(src))
+		for size in SIZES:
+			cube = koliba.Cube(slut, size)
+			t = []
+			for mode in MODES:
+				cube.interpolation = mode
+				cube.apply(src, dst, format=fmt)
+				t.append(best(lambda: cube.apply(src, dst, format=fmt), repeats))
+			print("%-8s %5d %10.2fms %10.2fms %8.2f" % (fmt, size, t[0] * 1e3, t[1] * 1e3, t[0] / t[1]))
+
+
+if __name__ == "__main__":
+	main(sys.argv)
@@ -46,10 +46,9 @@
 #include <Python.h>
 #include "structmember.h"
 
+#include <math.h>
 #include "koliba.h"
-
-#define DoubleConst(name,val)	PyDict_SetItemString(d, (const char *)name, o=PyFloat_FromDouble((double)val)); \
-	Py_DECREF(o);
+#include "kolibaspan.h"
 
 #define	KLBO	static PyObject *
 #define klbo(n,o)	koliba##n##Object *o
@@ -59,12 +58,174 @@
 
 #define	klbgetset(n)	static PyGetSetDef koliba##n##GetSet[]
 
+// Free-threaded builds lock each object while we look at it or change it.
+// Other builds have the GIL for that, so there these do nothing.
+#ifndef	Py_BEGIN_CRITICAL_SECTION
+#define	Py_BEGIN_CRITICAL_SECTION(op)	{ (void)(op);
+#define	Py_END_CRITICAL_SECTION()	}
+#endif
+
+// Our types are heap types now, but nobody should be changing them.
+#ifdef	Py_TPFLAGS_IMMUTABLETYPE
+#define	KLBTPFLAGS	(Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE)
+#else
+#define	KLBTPFLAGS	(Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE)
+#endif
+
 
 typedef struct {
 	PyObject_HEAD
 	KOLIBA_ANGLE a;
 } kolibaAngleObject;
 
+typedef struct {
+	PyObject_HEAD
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+} kolibaFlutObject;
+
+// A SLUT keeps its VERTICES for as long as it lives, since they only depend
+// on where the SLUT is in the memory. Its FLUT and FLAGS are only rebuilt
+// when needed after any of its vertices has changed.
+typedef struct {
+	PyObject_HEAD
+	KOLIBA_SLUT sLut;
+	KOLIBA_VERTICES v;
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+	bool dirty;
+} kolibaSlutObject;
+
+typedef struct {
+	PyObject_HEAD
+	KOLIBA_MATRIX m;
+} kolibaMatrixObject;
+
+// A cube keeps its vertices in a bytes object, which never changes once
+// made, so the frames of apply_async() can hold on to it and need not copy
+// it. Everything else about a cube is guarded by its critical section.
+typedef struct {
+	PyObject_HEAD
+	PyObject *data;		// (dim+1)^3 KOLIBA_RGBs in the order of KOLIBA_MakeCube
+	unsigned int dim;
+	KOLIBA_INTERPOLATION mode;
+} kolibaCubeObject;
+
+typedef struct {
+	PyObject_HEAD
+	double *a;
+	Py_ssize_t n;
+	KOLIBA_ANGLEUNITS units;
+	Py_ssize_t exports;	// how many buffers we have lent out
+} kolibaAngleArrayObject;
+
+typedef struct {
+	void (*fn)(void *, Py_ssize_t);	// process one band
+	void *arg;
+	Py_ssize_t bands;
+	Py_ssize_t next;				// the next band nobody works on yet
+} kolibaJob;
+
+typedef struct kolibaPool kolibaPool;
+
+typedef struct {
+	kolibaPool *pool;
+	PyThread_type_lock go;		// released when there is work
+} kolibaWorker;
+
+struct kolibaPool {
+	PyThread_type_lock submit;	// only one job at a time
+	PyThread_type_lock mutex;	// guards next and busy
+	PyThread_type_lock done;	// released by the last worker to finish
+	kolibaWorker *w;
+	unsigned int size;			// number of workers running
+	unsigned int threads;		// including the caller, 0 = not decided yet
+	unsigned int busy;
+	bool quit;
+	kolibaJob *job;
+};
+
+// Frames applied by apply_async() wait in a queue for the dispatcher, a
+// thread of our own which runs them on the pool one after another. The
+// queue has its own memory, since the dispatcher may outlive the module
+// by a little, and then it frees the queue itself.
+typedef struct kolibaFrame kolibaFrame;
+
+typedef struct {
+	PyThread_type_lock lock;	// guards all of the below
+	PyThread_type_lock wake;	// released when the sleeping dispatcher has work
+	kolibaFrame *first, *last;
+	bool running, sleeping, quit;
+	PyInterpreterState *interp;
+} kolibaQueue;
+
+// Scripts create and drop a great many angles, so we keep some of the
+// dropped ones around for reuse instead of returning them to the allocator.
+// Free-threaded builds have no GIL to guard the list, and their allocator
+// is per thread anyway, so they do without.
+#ifdef	Py_GIL_DISABLED
+#define	KOLIBA_ANGLEFREELIST	0
+#else
+#define	KOLIBA_ANGLEFREELIST	256
+#endif
+
+// Everything the module needs lives in its state, so each interpreter
+// gets its own types and its own worker pool.
+typedef struct {
+	PyTypeObject *AngleType;
+	PyTypeObject *FlutType;
+	PyTypeObject *SlutType;
+	PyTypeObject *MatrixType;
+	PyTypeObject *CubeType;
+	PyTypeObject *AngleArrayType;
+	kolibaPool pool;
+	kolibaQueue *queue;
+	PyObject *getloop;			// asyncio.get_running_loop, once we need it
+	PyObject *complete;			// our _complete(), called by the event loop
+	kolibaAngleObject *angleFree[KOLIBA_ANGLEFREELIST + 1];
+	int angleFreeCount;
+} kolibaState;
+
+static struct PyModuleDef kolibamodule;
+
+// Find the module which defined a type, or a base of a type. The reference
+// is borrowed.
+static PyObject * koliba_TypeModule(PyTypeObject *type) {
+#if PY_VERSION_HEX >= 0x030B0000
+	return PyType_GetModuleByDef(type, &kolibamodule);
+#else
+	PyObject *mro = type->tp_mro;
+	PyTypeObject *t;
+	Py_ssize_t i;
+
+	for (i = 0; (mro) && (i < PyTuple_GET_SIZE(mro)); i++) {
+		t = (PyTypeObject *)PyTuple_GET_ITEM(mro, i);
+		if ((t->tp_flags & Py_TPFLAGS_HEAPTYPE) && (((PyHeapTypeObject *)t)->ht_module)
+		&& (PyModule_GetDef(((PyHeapTypeObject *)t)->ht_module) == &kolibamodule))
+			return ((PyHeapTypeObject *)t)->ht_module;
+	}
+	PyErr_Format(PyExc_TypeError, "%s is not a koliba type", type->tp_name);
+	return NULL;
+#endif
+}
+
+// Find the state of that module.
+static kolibaState * koliba_TypeState(PyTypeObject *type) {
+	PyObject *m = koliba_TypeModule(type);
+	return (m) ? (kolibaState *)PyModule_GetState(m) : NULL;
+}
+
+static const char * const ksv[] = {
+	"black",
+	"blue",
+	"green",
+	"cyan",
+	"red",
+	"magenta",
+	"yellow",
+	"white"
+};
+
 static const char * const kau[] = {
 	"KAU_degrees",
 	"KAU_radians",
@@ -123,102 +284,245 @@ static const char * const kqc[] = {
 	"KQC_amaranth"
 };
 
+// Sort the arguments of a METH_FASTCALL | METH_KEYWORDS call, or of a
+// vectorcall, into argv, in the order of the names in kwlist. The first
+// posonly arguments can only be passed by position, the first required
+// ones must be passed. Whatever is not passed is left as NULL.
+
+static int koliba_FastArgs(const char *fname, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames, const char * const *kwlist, Py_ssize_t posonly, Py_ssize_t required, PyObject **argv) {
+	Py_ssize_t i, j, n, nkw;
+	PyObject *key;
+
+	for (n = 0; kwlist[n] != NULL; n++)
+		argv[n] = NULL;
+	if (nargs > n) {
+		PyErr_Format(PyExc_TypeError, "%s() takes at most %zd arguments (%zd given)", fname, n, nargs);
+		return -1;
+	}
+	for (i = 0; i < nargs; i++)
+		argv[i] = args[i];
+	nkw = (kwnames == NULL) ? 0 : PyTuple_GET_SIZE(kwnames);
+	for (i = 0; i < nkw; i++) {
+		key = PyTuple_GET_ITEM(kwnames, i);
+		for (j = posonly; j < n; j++)
+			if (PyUnicode_CompareWithASCIIString(key, kwlist[j]) == 0) break;
+		if (j == n) {
+			PyErr_Format(PyExc_TypeError, "%s() got an unexpected keyword argument '%U'", fname, key);
+			return -1;
+		}
+		if (argv[j] != NULL) {
+			PyErr_Format(PyExc_TypeError, "%s() got multiple values for argument '%s'", fname, kwlist[j]);
+			return -1;
+		}
+		argv[j] = args[nargs + i];
+	}
+	for (i = 0; i < required; i++)
+		if (argv[i] == NULL) {
+			PyErr_Format(PyExc_TypeError, "%s() missing required argument '%s'", fname, kwlist[i]);
+			return -1;
+		}
+	return 0;
+}
+
+// Read a number, with no detours for plain floats and ints.
+static inline int koliba_Number(PyObject *o, double *d) {
+	if (PyFloat_CheckExact(o)) *d = PyFloat_AS_DOUBLE(o);
+	else if (((*d = (PyLong_CheckExact(o)) ? PyLong_AsDouble(o) : PyFloat_AsDouble(o)) == -1.0) && PyErr_Occurred())
+		return -1;
+	return 0;
+}
+
+// Only plain Angles go to the freelist, not those of any subclass.
+// We may be deallocated while an exception is on its way up, so the
+// lookup must leave it alone.
 klbdealloc(Angle) {
-	Py_TYPE(self)->tp_free((PyObject *)self);
+	PyTypeObject *type = Py_TYPE(self);
+#if PY_VERSION_HEX >= 0x030B0000
+	kolibaState *st = koliba_TypeState(type);
+#else
+	PyObject *et, *ev, *tb;
+	kolibaState *st;
+
+	PyErr_Fetch(&et, &ev, &tb);
+	if ((st = koliba_TypeState(type)) == NULL) PyErr_Clear();
+	PyErr_Restore(et, ev, tb);
+#endif
+
+	if ((st) && (type == st->AngleType) && (st->angleFreeCount < KOLIBA_ANGLEFREELIST))
+		st->angleFree[st->angleFreeCount++] = self;
+	else type->tp_free((PyObject *)self);
+	Py_DECREF(type);
 }
 
 klbnew(Angle) {
 	kolibaAngleObject *self;
-	self = (kolibaAngleObject *) type->tp_alloc(type, 0);
+	kolibaState *st = koliba_TypeState(type);
+
+	if ((st) && (type == st->AngleType) && (st->angleFreeCount > 0)) {
+		self = st->angleFree[--st->angleFreeCount];
+		PyObject_Init((PyObject *)self, type);
+	}
+	else {
+		if (st == NULL) PyErr_Clear();	// Only what the lookup raised
+		if ((self = (kolibaAngleObject *) type->tp_alloc(type, 0)) == NULL) return NULL;
+	}
 	self->a.angle = 0.0;
 	self->a.units = KAU_degrees;
 	return (PyObject *)self;
 }
 
+// Calling koliba.Angle itself skips the argument tuple and tp_init.
+KLBO kolibaAngleVectorcall(PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+	static const char * const kwlist[] = {"angle", "units", NULL};
+	PyObject *argv[2];
+	kolibaAngleObject *self;
+	kolibaState *st;
+	double angle = 0.0;
+	unsigned long units = KAU_degrees;
+
+	// A subclass may have its own __new__ or __init__, so let the type
+	// call them the usual way.
+	if (((st = koliba_TypeState((PyTypeObject *)type)) == NULL) || ((PyTypeObject *)type != st->AngleType)) {
+		PyObject *t, *kw = NULL, *r = NULL;
+		Py_ssize_t i, n = PyVectorcall_NARGS(nargsf);
+
+		if (st == NULL) PyErr_Clear();
+		if ((t = PyTuple_New(n)) == NULL) return NULL;
+		for (i = 0; i < n; i++) {
+			Py_INCREF(args[i]);
+			PyTuple_SET_ITEM(t, i, args[i]);
+		}
+		if ((kwnames) && (PyTuple_GET_SIZE(kwnames))) {
+			if ((kw = PyDict_New()) == NULL) goto fail;
+			for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++)
+				if (PyDict_SetItem(kw, PyTuple_GET_ITEM(kwnames, i), args[n + i]) < 0) goto fail;
+		}
+		r = PyType_Type.tp_call(type, t, kw);
+fail:
+		Py_XDECREF(kw);
+		Py_DECREF(t);
+		return r;
+	}
+	if (koliba_FastArgs("Angle", args, PyVectorcall_NARGS(nargsf), kwnames, kwlist, 0, 0, argv) < 0) return NULL;
+	if ((argv[0] != NULL) && (koliba_Number(argv[0], &angle) < 0)) return NULL;
+	if ((argv[1] != NULL) && ((units = PyLong_AsUnsignedLong(argv[1])) == (unsigned long)-1) && PyErr_Occurred()) {
+		if (!PyErr_ExceptionMatches(PyExc_OverflowError)) return NULL;
+		PyErr_Clear();
+	}
+	if (units >= KAU_COUNT) {
+		PyErr_Format(PyExc_ValueError, "Units must be %s, %s, %s, or %s", kau[0], kau[1], kau[2], kau[3]);
+		return NULL;
+	}
+	if ((self = (kolibaAngleObject *)kolibaAngleNew((PyTypeObject *)type, NULL, NULL)) != NULL)
+		KOLIBA_AngleSet(&self->a, angle, (KOLIBA_ANGLEUNITS)units);
+	return (PyObject *)self;
+}
+
+// Take a consistent copy of the angle.
+static inline KOLIBA_ANGLE koliba_AngleGet(klbo(Angle,self)) {
+	KOLIBA_ANGLE a;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	a = self->a;
+	Py_END_CRITICAL_SECTION();
+	return a;
+}
+
 klbinit(Angle) {
 	static char *kwlist[] = {"angle", "units", NULL};
-	double angle = self->a.angle;
-	unsigned int units = (unsigned int)self->a.units;
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	double angle = a.angle;
+	unsigned int units = (unsigned int)a.units;
 	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|di", kwlist, &angle, &units))
 		return -1;
-	else if (KOLIBA_AngleSet(&self->a, angle, units) == NULL) {
+	else if (KOLIBA_AngleSet(&a, angle, units) == NULL) {
 		PyErr_Format(PyExc_ValueError, "Units must be %s, %s, %s, or %s", kau[0], kau[1], kau[2], kau[3]);
 		return -1;
 	}
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->a = a;
+	Py_END_CRITICAL_SECTION();
 	return 0;
 }
 
-KLBO kolibaAngleGetDegrees(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AngleDegrees(&self->a));
-}
+// Setting the angle in any units takes a float or an int.
+static int koliba_AngleSetValue(klbo(Angle,self), PyObject *value, KOLIBA_ANGLEUNITS units, const char *what) {
+	double d;
 
-static int kolibaAngleSetDegrees(klbo(Angle,self), PyObject *value, void *closure) {
-	if (PyFloat_Check(value)) self->a.angle = PyFloat_AsDouble(value);
-	else if (PyLong_Check(value)) self->a.angle = (double)PyLong_AsLong(value);
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the angle");
+		return -1;
+	}
+	if (PyFloat_CheckExact(value)) d = PyFloat_AS_DOUBLE(value);
+	else if (PyFloat_Check(value) || PyLong_Check(value)) {
+		if (((d = PyFloat_AsDouble(value)) == -1.0) && PyErr_Occurred()) return -1;
+	}
 	else {
-		PyErr_SetString(PyExc_TypeError, "The angle must be a number in degrees");
+		PyErr_SetString(PyExc_TypeError, what);
 		return -1;
 	}
-	self->a.units = KAU_degrees;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->a.angle = d;
+	self->a.units = units;
+	Py_END_CRITICAL_SECTION();
 	return 0;
 }
 
+KLBO kolibaAngleGetDegrees(klbo(Angle,self), void *closure) {
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AngleDegrees(&a));
+}
+
+static int kolibaAngleSetDegrees(klbo(Angle,self), PyObject *value, void *closure) {
+	return koliba_AngleSetValue(self, value, KAU_degrees, "The angle must be a number in degrees");
+}
+
 KLBO kolibaAngleGetRadians(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AngleRadians(&self->a));
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AngleRadians(&a));
 }
 
 static int kolibaAngleSetRadians(klbo(Angle,self), PyObject *value, void *closure) {
-	if (PyFloat_Check(value)) self->a.angle = PyFloat_AsDouble(value);
-	else if (PyLong_Check(value)) self->a.angle = (double)PyLong_AsLong(value);
-	else {
-		PyErr_SetString(PyExc_TypeError, "The angle must be a number in radians");
-		return -1;
-	}
-	self->a.units = KAU_radians;
-	return 0;
+	return koliba_AngleSetValue(self, value, KAU_radians, "The angle must be a number in radians");
 }
 
 KLBO kolibaAngleGetTurns(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AngleTurns(&self->a));
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AngleTurns(&a));
 }
 
 static int kolibaAngleSetTurns(klbo(Angle,self), PyObject *value, void *closure) {
-	if (PyFloat_Check(value)) self->a.angle = PyFloat_AsDouble(value);
-	else if (PyLong_Check(value)) self->a.angle = (double)PyLong_AsLong(value);
-	else {
-		PyErr_SetString(PyExc_TypeError, "The angle must be a number in turns");
-		return -1;
-	}
-	self->a.units = KAU_turns;
-	return 0;
+	return koliba_AngleSetValue(self, value, KAU_turns, "The angle must be a number in turns");
 }
 
 KLBO kolibaAngleGetPis(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AnglePis(&self->a));
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AnglePis(&a));
 }
 
 static int kolibaAngleSetPis(klbo(Angle,self), PyObject *value, void *closure) {
-	if (PyFloat_Check(value)) self->a.angle = PyFloat_AsDouble(value);
-	else if (PyLong_Check(value)) self->a.angle = (double)PyLong_AsLong(value);
-	else {
-		PyErr_SetString(PyExc_TypeError, "The angle must be a number in pis");
-		return -1;
-	}
-	self->a.units = KAU_pis;
-	return 0;
+	return koliba_AngleSetValue(self, value, KAU_pis, "The angle must be a number in pis");
 }
 
 KLBO kolibaAngleSine(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AngleSine(&self->a));
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AngleSine(&a));
 }
 
 KLBO kolibaAngleCosine(klbo(Angle,self), void *closure) {
-	return PyFloat_FromDouble(KOLIBA_AngleCosine(&self->a));
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return PyFloat_FromDouble(KOLIBA_AngleCosine(&a));
+}
+
+KLBO kolibaAngleReduce(klbo(Angle,self), PyObject *unused) {
+	KOLIBA_ANGLE a = koliba_AngleGet(self);
+	return Py_BuildValue("O(di)", Py_TYPE(self), a.angle, (int)a.units);
 }
 
 static PyMethodDef kolibaAngleMethods[] = {
 	{"sin", (PyCFunction)kolibaAngleSine, METH_NOARGS, "Return the sine of the angle"},
 	{"cos", (PyCFunction)kolibaAngleCosine, METH_NOARGS, "Return the cosine of the angle"},
+	{"__reduce__", (PyCFunction)kolibaAngleReduce, METH_NOARGS, "Return the state of the angle for pickling"},
 	{NULL}
 };
 
@@ -230,250 +534,3695 @@ klbgetset(Angle) = {
 	{NULL}
 };
 
-static PyTypeObject kolibaAngleType = {
-	PyVarObject_HEAD_INIT(NULL,0)
-	.tp_name = "koliba.Angle",
-	.tp_doc  = "Angle objects",
-	.tp_basicsize = sizeof(kolibaAngleObject),
-	.tp_itemsize = 0,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	.tp_new = kolibaAngleNew,
-	.tp_init = (initproc)kolibaAngleInit,
-	.tp_dealloc = (destructor)kolibaAngleDealloc,
-	.tp_methods = kolibaAngleMethods,
-	.tp_getset = kolibaAngleGetSet,
+static PyType_Slot kolibaAngleSlots[] = {
+	{Py_tp_doc, "Angle objects"},
+	{Py_tp_new, kolibaAngleNew},
+	{Py_tp_init, kolibaAngleInit},
+	{Py_tp_dealloc, kolibaAngleDealloc},
+	{Py_tp_methods, kolibaAngleMethods},
+	{Py_tp_getset, kolibaAngleGetSet},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaAngleSpec = {
+	.name = "koliba.Angle",
+	.basicsize = sizeof(kolibaAngleObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaAngleSlots,
 };
 
-KLBO koliba_Double_const_mul(PyObject *self, PyObject *args, double val) {
-	double d = 1.0;
+// Read n doubles from any Python sequence of numbers.
+
+static int koliba_DoublesFromSequence(double *d, PyObject *seq, Py_ssize_t n, const char *what) {
+	PyObject *fast;
+	Py_ssize_t i;
+
+	if ((fast = PySequence_Fast(seq, what)) == NULL) return -1;
+	if (PySequence_Fast_GET_SIZE(fast) != n) {
+		PyErr_Format(PyExc_ValueError, "%s must contain exactly %zd numbers", what, n);
+		Py_DECREF(fast);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		d[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+		if ((d[i] == -1.0) && PyErr_Occurred()) {
+			Py_DECREF(fast);
+			return -1;
+		}
+	}
+	Py_DECREF(fast);
+	return 0;
+}
+
+static PyObject * koliba_DoublesToTuple(const double *d, Py_ssize_t n) {
+	PyObject *t, *o;
+	Py_ssize_t i;
+
+	if ((t = PyTuple_New(n)) == NULL) return NULL;
+	for (i = 0; i < n; i++) {
+		if ((o = PyFloat_FromDouble(d[i])) == NULL) {
+			Py_DECREF(t);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(t, i, o);
+	}
+	return t;
+}
+
+// We pickle the LUTs the way Koliba stores them in its files: their doubles
+// MSB first, followed by their checksum, and preceded by the file header if
+// the format has one. That keeps the pickles small and portable. Cubes
+// have no header, and a great many doubles, so we swap them in place.
+
+static PyObject * koliba_PackDoubles(const unsigned char *header, const double *d, unsigned int n) {
+	PyObject *b;
+	double *t;
+	Py_ssize_t h = (header) ? SLTCFILEHEADERBYTES : 0;
+
+	if ((b = PyBytes_FromStringAndSize(NULL, h + ((Py_ssize_t)n + 1) * sizeof(double))) != NULL) {
+		if (h) memcpy(PyBytes_AS_STRING(b), header, h);
+		t = (double *)(PyBytes_AS_STRING(b) + h);
+		memcpy(t, d, n * sizeof(double));
+		t[n] = KOLIBA_CalcSum(t, n);
+		KOLIBA_NetDoubles(t, n + 1);
+	}
+	return b;
+}
+
+static int koliba_UnpackDoubles(double *d, unsigned int n, PyObject *obj, const unsigned char *header, const char *what) {
+	Py_buffer view;
+	double sum;
+	Py_ssize_t h = (header) ? SLTCFILEHEADERBYTES : 0;
+	int r = -1;
+
+	if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0) return -1;
+	if ((view.len != h + ((Py_ssize_t)n + 1) * (Py_ssize_t)sizeof(double)) || ((h) && memcmp(view.buf, header, h)))
+		PyErr_Format(PyExc_ValueError, "Not a pickled %s", what);
+	else {
+		memcpy(d, (char *)view.buf + h, n * sizeof(double));
+		memcpy(&sum, (char *)view.buf + h + n * sizeof(double), sizeof(double));
+		KOLIBA_FixDoubles(d, n);
+		KOLIBA_FixDoubles(&sum, 1);
+		if (!KOLIBA_CheckSum(d, sum, n))
+			PyErr_Format(PyExc_ValueError, "The pickled %s is corrupt", what);
+		else r = 0;
+	}
+	PyBuffer_Release(&view);
+	return r;
+}
+
+// Big buffers of doubles (AngleArrays and cubes) pickle out of band with
+// protocol 5, in our own byte order, which the state names.
+
+#if PY_BIG_ENDIAN
+#define	KOLIBA_BYTEORDER	"big"
+#else
+#define	KOLIBA_BYTEORDER	"little"
+#endif
+
+// Check a pickled byte order, and tell whether the doubles need swapping.
+static int koliba_ByteOrder(const char *order, bool *swap) {
+	if ((strcmp(order, "big")) && (strcmp(order, "little"))) {
+		PyErr_SetString(PyExc_ValueError, "The byte order must be \"big\" or \"little\"");
+		return -1;
+	}
+	*swap = (strcmp(order, KOLIBA_BYTEORDER) != 0);
+	return 0;
+}
+
+// KOLIBA_FixDoubles only knows about MSB first, the other way around
+// (LSB first on a big-endian system) we swap the bytes ourselves.
+static void koliba_SwapDoubles(double *a, Py_ssize_t n) {
+	Py_ssize_t i;
 
-	if (!PyArg_ParseTuple(args, "|d", &d)) return NULL;
-	return PyFloat_FromDouble(d*val);
+#if PY_BIG_ENDIAN
+	for (i = 0; i < n; i++) {
+		unsigned char *b = (unsigned char *)(a + i), t;
+		int j;
+		for (j = 0; j < 4; j++) {
+			t = b[j];
+			b[j] = b[7 - j];
+			b[7 - j] = t;
+		}
+	}
+#else
+	for (i = 0; i < n; i += UINT_MAX)
+		KOLIBA_FixDoubles(a + i, (unsigned int)Py_MIN(n - i, (Py_ssize_t)UINT_MAX));
+#endif
 }
 
-KLBO koliba_Pi(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_Pi);
+// Many functions accept any buffer of doubles or floats. They can be
+// strided if they are one-dimensional, otherwise they have to be
+// contiguous.
+
+typedef struct {
+	Py_buffer view;
+	char *p;			// the first number
+	Py_ssize_t n;		// how many numbers
+	Py_ssize_t step;	// bytes from one number to the next
+	bool single;		// float rather than double
+} kolibaDoubles;
+
+// Returns 1 on success, 0 if obj does not export a buffer (no exception
+// is set then), and -1 on failure. A 0-d buffer we read, such as that of a
+// NumPy scalar, counts as no buffer, so it is taken for the number it is.
+static int koliba_GetDoubles(kolibaDoubles *d, PyObject *obj, bool writable) {
+	const char *f;
+
+	if (!PyObject_CheckBuffer(obj)) return 0;
+	if (PyObject_GetBuffer(obj, &d->view, PyBUF_RECORDS_RO | ((writable) ? PyBUF_WRITABLE : 0)) < 0)
+		return -1;
+	if ((d->view.ndim == 0) && (!writable)) {
+		PyBuffer_Release(&d->view);
+		return 0;
+	}
+	f = (d->view.format) ? d->view.format : "B";
+	if ((*f == '@') || (*f == '=')) f++;
+	if (((*f != 'd') && (*f != 'f')) || (f[1] != '\0')) {
+		PyErr_Format(PyExc_TypeError, "Expected a buffer of doubles or floats, not \"%s\"", d->view.format);
+		goto bad;
+	}
+	d->single = (*f == 'f');
+	d->p = (char *)d->view.buf;
+	d->n = d->view.len / d->view.itemsize;
+	d->step = d->view.itemsize;
+	if ((d->view.ndim == 1) && (d->n > 0))
+		d->step = d->view.strides[0];
+	else if (!PyBuffer_IsContiguous(&d->view, 'C')) {
+		PyErr_SetString(PyExc_ValueError, "A multidimensional buffer must be contiguous");
+		goto bad;
+	}
+	return 1;
+
+bad:
+	PyBuffer_Release(&d->view);
+	return -1;
 }
 
-KLBO koliba_invPi(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1DivPi);
+#define	klbgetd(d,i)	((d)->single ? (double)*(float *)((d)->p + (i)*(d)->step) : *(double *)((d)->p + (i)*(d)->step))
+#define	klbsetd(d,i,v)	do { if ((d)->single) *(float *)((d)->p + (i)*(d)->step) = (float)(v); else *(double *)((d)->p + (i)*(d)->step) = (v); } while (0)
+
+// Return a bytearray of doubles as a memoryview of doubles.
+// Steals the reference to the bytearray.
+static PyObject * koliba_DoublesView(PyObject *bytes) {
+	PyObject *mv, *r;
+
+	if (bytes == NULL) return NULL;
+	mv = PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if (mv == NULL) return NULL;
+	r = PyObject_CallMethod(mv, "cast", "s", "d");
+	Py_DECREF(mv);
+	return r;
 }
 
-KLBO koliba_Tau(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_2Pi);
+// Bulk pixel processing.
+//
+// Each supported pixel format has a "run" which applies a FLUT to n pixels,
+// each a fixed number of bytes apart from the previous one in both the
+// input and the output (so the two can be the same memory, or any strided
+// view of it). The runs never touch the Python API, so they can be called
+// with the GIL released.
+//
+// What kind of LUT a run gets depends on the run, a KOLIBA_FLUT for most,
+// a KOLIBA_FLUT32 for the single-precision ones, a KOLIBA_FIXEDFLUT for the
+// fixed-point ones, KOLIBA_BYTETABLES for the table ones, a KOLIBA_LATTICE
+// for the cube ones.
+
+typedef void (*kolibaRun)(char *, Py_ssize_t, const char *, Py_ssize_t, Py_ssize_t, const void *, KOLIBA_FLAGS);
+
+// The 8-bit runs expect a FLUT already scaled by 255, so we do not have to
+// multiply each channel of each pixel by 255 again.
+//
+// Contiguous runs go to the span functions, which only look at the flags
+// once per run. Strided ones still take the pixels one at a time.
+#define	klbrun8(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_Scaled##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, KOLIBA_ByteDiv255, NULL);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_Scaled##N##Pixel((T *)o, (const T *)i, fLut, flags, KOLIBA_ByteDiv255, NULL)->a = ((const T *)i)->a;\
 }
 
-KLBO koliba_invTau(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1Div2Pi);
+#define	klbrun32(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, NULL, NULL);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##Pixel((T *)o, (const T *)i, fLut, flags, NULL, NULL)->a = ((const T *)i)->a;\
+}\
+\
+static void koliba##N##Run32(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT32 *fLut = (const KOLIBA_FLUT32 *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArray32((T *)o, (const T *)i, n, fLut, flags);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##PixelArray32((T *)o, (const T *)i, 1, fLut, flags);\
 }
 
-KLBO koliba_Pi2(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_PiDiv2);
+// The 16-bit run expects a FLUT scaled by 65535, just as the 8-bit ones do
+// by 255.
+#define	klbrun16(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_Scaled##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, NULL);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_Scaled##N##Pixel((T *)o, (const T *)i, fLut, flags, NULL)->a = ((const T *)i)->a;\
 }
 
-KLBO koliba_invPi2(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, 1.0/KOLIBA_PiDiv2);
+// The 24-bit ones, like the 8-bit ones they expand to, expect a FLUT
+// scaled by 255. Strided runs take spans of one.
+#define	klbrun24(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_Scaled##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, KOLIBA_ByteDiv255, NULL);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_Scaled##N##PixelArray((T *)o, (const T *)i, 1, fLut, flags, KOLIBA_ByteDiv255, NULL);\
 }
 
-KLBO koliba_Pi180(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_PiDiv180);
+// The packed 10-bit ones expect a FLUT scaled by 1023.
+#define	klbrun10(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_Scaled##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, NULL);\
+	else for (; n > 0; n--, o += os, i += is) {\
+		T px = *(const T *)i;\
+		*(T *)o = *KOLIBA_Scaled##N##Pixel(&px, &px, fLut, flags, NULL);\
+	}\
 }
 
-KLBO koliba_invPi180(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_180DivPi);
+// The half-float pixels have no per-pixel functions, so strided runs
+// take spans of one.
+#define	klbrun16f(N,T)	static void koliba##N##Run(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT *fLut = (const KOLIBA_FLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArray((T *)o, (const T *)i, n, fLut, flags, NULL, NULL);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##PixelArray((T *)o, (const T *)i, 1, fLut, flags, NULL, NULL);\
+}\
+\
+static void koliba##N##Run32(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FLUT32 *fLut = (const KOLIBA_FLUT32 *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArray32((T *)o, (const T *)i, n, fLut, flags);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##PixelArray32((T *)o, (const T *)i, 1, fLut, flags);\
 }
 
-KLBO koliba_PDeg(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_180);
+// The fixed-point ones (for 8-bit pixels only) do the same whether the
+// pixels are contiguous or not.
+#define	klbrunfixed(N,T)	static void koliba##N##RunFixed(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_FIXEDFLUT *ff = (const KOLIBA_FIXEDFLUT *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArrayFixed((T *)o, (const T *)i, n, ff, flags);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##PixelArrayFixed((T *)o, (const T *)i, 1, ff, flags);\
 }
 
-KLBO koliba_invPDeg(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1Div180);
+// So do the table ones, used for 1D FLUTs on 8-bit pixels.
+#define	klbruntables(N,T)	static void koliba##N##RunTables(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_BYTETABLES *t = (const KOLIBA_BYTETABLES *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		KOLIBA_##N##PixelArrayTables((T *)o, (const T *)i, n, t);\
+	else for (; n > 0; n--, o += os, i += is)\
+		KOLIBA_##N##PixelArrayTables((T *)o, (const T *)i, 1, t);\
 }
 
-KLBO koliba_invTDeg(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1Div360);
+// And the cube ones, which get a KOLIBA_LATTICE.
+#define	klbrunlattice(N,T,A)	static void koliba##N##RunLattice(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {\
+	const KOLIBA_LATTICE *lat = (const KOLIBA_LATTICE *)lut;\
+	if ((os == sizeof(T)) && (is == sizeof(T)))\
+		A(N, (T *)o, (const T *)i, n, lat);\
+	else for (; n > 0; n--, o += os, i += is)\
+		A(N, (T *)o, (const T *)i, 1, lat);\
 }
 
-KLBO koliba_TDeg(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_360);
+#define	klblattice8(N,o,i,n,lat)	KOLIBA_##N##PixelArrayLattice(o, i, n, lat, KOLIBA_ByteDiv255, NULL)
+#define	klblatticeconv(N,o,i,n,lat)	KOLIBA_##N##PixelArrayLattice(o, i, n, lat, NULL, NULL)
+#define	klblattice32(N,o,i,n,lat)	KOLIBA_##N##PixelArrayLattice(o, i, n, lat)
+
+klbrun8(Rgba8, KOLIBA_RGBA8PIXEL)
+klbrun8(Bgra8, KOLIBA_BGRA8PIXEL)
+klbrun8(Argb8, KOLIBA_ARGB8PIXEL)
+klbrun8(Abgr8, KOLIBA_ABGR8PIXEL)
+klbrun16(Rgba16, KOLIBA_RGBA16PIXEL)
+klbrun24(Rgb24, KOLIBA_RGB24PIXEL)
+klbrun24(Bgr24, KOLIBA_BGR24PIXEL)
+klbrun10(Rgb10a2, KOLIBA_RGB10A2PIXEL)
+klbrun10(Bgr10a2, KOLIBA_BGR10A2PIXEL)
+klbrun16f(Rgba16f, KOLIBA_RGBA16FPIXEL)
+klbrun16f(Bgra16f, KOLIBA_BGRA16FPIXEL)
+klbrun16f(Argb16f, KOLIBA_ARGB16FPIXEL)
+klbrun16f(Abgr16f, KOLIBA_ABGR16FPIXEL)
+klbrun32(Rgba32, KOLIBA_RGBA32PIXEL)
+klbrun32(Bgra32, KOLIBA_BGRA32PIXEL)
+klbrun32(Argb32, KOLIBA_ARGB32PIXEL)
+klbrun32(Abgr32, KOLIBA_ABGR32PIXEL)
+klbrunfixed(Rgba8, KOLIBA_RGBA8PIXEL)
+klbrunfixed(Bgra8, KOLIBA_BGRA8PIXEL)
+klbrunfixed(Argb8, KOLIBA_ARGB8PIXEL)
+klbrunfixed(Abgr8, KOLIBA_ABGR8PIXEL)
+klbrunfixed(Rgb24, KOLIBA_RGB24PIXEL)
+klbrunfixed(Bgr24, KOLIBA_BGR24PIXEL)
+klbruntables(Rgba8, KOLIBA_RGBA8PIXEL)
+klbruntables(Bgra8, KOLIBA_BGRA8PIXEL)
+klbruntables(Argb8, KOLIBA_ARGB8PIXEL)
+klbruntables(Abgr8, KOLIBA_ABGR8PIXEL)
+klbruntables(Rgb24, KOLIBA_RGB24PIXEL)
+klbruntables(Bgr24, KOLIBA_BGR24PIXEL)
+klbrunlattice(Rgba8, KOLIBA_RGBA8PIXEL, klblattice8)
+klbrunlattice(Bgra8, KOLIBA_BGRA8PIXEL, klblattice8)
+klbrunlattice(Argb8, KOLIBA_ARGB8PIXEL, klblattice8)
+klbrunlattice(Abgr8, KOLIBA_ABGR8PIXEL, klblattice8)
+klbrunlattice(Rgb24, KOLIBA_RGB24PIXEL, klblattice8)
+klbrunlattice(Bgr24, KOLIBA_BGR24PIXEL, klblattice8)
+klbrunlattice(Rgba16, KOLIBA_RGBA16PIXEL, klblatticeconv)
+klbrunlattice(Rgb10a2, KOLIBA_RGB10A2PIXEL, klblatticeconv)
+klbrunlattice(Bgr10a2, KOLIBA_BGR10A2PIXEL, klblatticeconv)
+klbrunlattice(Rgba16f, KOLIBA_RGBA16FPIXEL, klblattice32)
+klbrunlattice(Bgra16f, KOLIBA_BGRA16FPIXEL, klblattice32)
+klbrunlattice(Argb16f, KOLIBA_ARGB16FPIXEL, klblattice32)
+klbrunlattice(Abgr16f, KOLIBA_ABGR16FPIXEL, klblattice32)
+klbrunlattice(Rgba32, KOLIBA_RGBA32PIXEL, klblattice32)
+klbrunlattice(Bgra32, KOLIBA_BGRA32PIXEL, klblattice32)
+klbrunlattice(Argb32, KOLIBA_ARGB32PIXEL, klblattice32)
+klbrunlattice(Abgr32, KOLIBA_ABGR32PIXEL, klblattice32)
+
+// An identity FLUT just copies the pixels, and a constant one fills them
+// in, keeping whatever bits the runs copy from the input (the alpha). The
+// fill works on 16 pixels at a time, which is a whole number of 64-bit
+// words for any of our pixels.
+
+#define	KOLIBA_FILLPIXELS	16
+
+typedef struct {
+	Py_ssize_t size;	// bytes per pixel
+	unsigned char keep[KOLIBA_FILLPIXELS * sizeof(KOLIBA_RGBA32PIXEL)];	// bits from the input
+	unsigned char bits[KOLIBA_FILLPIXELS * sizeof(KOLIBA_RGBA32PIXEL)];	// and the rest
+} kolibaFill;
+
+// Work out a fill by running two pixels with every bit different through
+// the run that would have done the job. The bits that came out different
+// came from the input.
+static void koliba_FillInit(kolibaFill *fl, Py_ssize_t size, kolibaRun run, const void *lut, KOLIBA_FLAGS flags) {
+	unsigned char a[sizeof(KOLIBA_RGBA32PIXEL)], b[sizeof(KOLIBA_RGBA32PIXEL)];
+	unsigned char oa[sizeof(KOLIBA_RGBA32PIXEL)], ob[sizeof(KOLIBA_RGBA32PIXEL)];
+	Py_ssize_t j;
+
+	memset(a, 0x55, size);
+	memset(b, 0xAA, size);
+	run((char *)oa, size, (const char *)a, size, 1, lut, flags);
+	run((char *)ob, size, (const char *)b, size, 1, lut, flags);
+	fl->size = size;
+	for (j = 0; j < KOLIBA_FILLPIXELS * size; j++) {
+		fl->keep[j] = oa[j % size] ^ ob[j % size];
+		fl->bits[j] = oa[j % size] & ~fl->keep[j];
+	}
 }
 
-KLBO koliba_Kappa(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_Kappa);
+// Fill a row of bytes with a pattern of size bytes, doubling what is done.
+static void koliba_FillRow(char *o, const unsigned char *pattern, Py_ssize_t size, Py_ssize_t bytes) {
+	Py_ssize_t done;
+
+	if (bytes < size) return;
+	if (size == 1) {
+		memset(o, *pattern, bytes);
+		return;
+	}
+	memcpy(o, pattern, size);
+	for (done = size; done < bytes; done *= 2)
+		memcpy(o + done, o, (bytes - done < done) ? bytes - done : done);
 }
 
-KLBO koliba_invKappa(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1DivKappa);
+static void kolibaCopyRun(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {
+	const Py_ssize_t size = ((const kolibaFill *)lut)->size;
+
+	if ((os == size) && (is == size)) {
+		if (o != i) memmove(o, i, n * size);
+	}
+	else for (; n > 0; n--, o += os, i += is)
+		if (o != i) memmove(o, i, size);
 }
 
-KLBO koliba_compKappa(PyObject *self, PyObject *args) {
-		return koliba_Double_const_mul(self, args, KOLIBA_1MinKappa);
+static void kolibaFillRun(char *o, Py_ssize_t os, const char *i, Py_ssize_t is, Py_ssize_t n, const void *lut, KOLIBA_FLAGS flags) {
+	const kolibaFill *f = (const kolibaFill *)lut;
+	const Py_ssize_t size = f->size, block = KOLIBA_FILLPIXELS * size;
+	uint64_t w, k, v;
+	Py_ssize_t j;
+
+	if ((os == size) && (is == size)) {
+		for (; n >= KOLIBA_FILLPIXELS; n -= KOLIBA_FILLPIXELS, o += block, i += block)
+			for (j = 0; j < block; j += sizeof(uint64_t)) {
+				memcpy(&w, i + j, sizeof(uint64_t));
+				memcpy(&k, f->keep + j, sizeof(uint64_t));
+				memcpy(&v, f->bits + j, sizeof(uint64_t));
+				w = (w & k) | v;
+				memcpy(o + j, &w, sizeof(uint64_t));
+			}
+		for (j = 0; j < n * size; j++)
+			o[j] = (char)((i[j] & f->keep[j]) | f->bits[j]);
+	}
+	else for (; n > 0; n--, o += os, i += is)
+		for (j = 0; j < size; j++)
+			o[j] = (char)((i[j] & f->keep[j]) | f->bits[j]);
 }
 
-KLBO koliba_absKappa(PyObject *self, PyObject *args, PyObject *kwargs) {
-	double start, radius;
-	static char *kwlist[] = {"start", "radius", NULL};
+// How precisely the runs calculate, the index of the run of each format.
+typedef enum {
+	KOLIBA_DOUBLE,
+	KOLIBA_SINGLE,
+	KOLIBA_FIXED,
+	KOLIBA_PRECISIONS
+} kolibaPrecision;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dd", kwlist, &start, &radius)) return NULL;
-	return PyFloat_FromDouble(start+radius*KOLIBA_Kappa);
+static const char * const kolibaPrecisionNames[KOLIBA_PRECISIONS] = {"double", "single", "fixed"};
+
+static int koliba_Precision(kolibaPrecision *pr, const char *name) {
+	for (*pr = KOLIBA_DOUBLE; *pr < KOLIBA_PRECISIONS; (*pr)++)
+		if (strcmp(name, kolibaPrecisionNames[*pr]) == 0) return 0;
+	PyErr_Format(PyExc_ValueError, "Unknown precision \"%s\", expected \"double\", \"single\", or \"fixed\"", name);
+	return -1;
 }
 
-static PyMethodDef KolibaMethods[] = {
-	{"Pi", koliba_Pi, METH_VARARGS, "Multiplies a value by pi."},
-	{"DivPi", koliba_invPi, METH_VARARGS, "Divides a value by pi."},
-	{"Tau", koliba_Tau, METH_VARARGS, "Multiplies a value by tau (2pi)."},
-	{"DivTau", koliba_invTau, METH_VARARGS, "Divides a value by tau (2pi)."},
-	{"HalfPi", koliba_Pi2, METH_VARARGS, "Multiplies a value by pi and divides by 2."},
-	{"DivHalfPi", koliba_invPi2, METH_VARARGS, "Divides a value by pi and multiplies by 2."},
-	{"DegreesToRadians", koliba_Pi180, METH_VARARGS, "Converts degrees to radians."},
-	{"RadiansToDegrees", koliba_invPi180, METH_VARARGS, "Converts radians to degrees."},
-	{"PisToDegrees", koliba_PDeg, METH_VARARGS, "Converts pis to degrees."},
-	{"DegreesToPis", koliba_invPDeg, METH_VARARGS, "Converts degrees to pis."},
-	{"DegreesToTurns", koliba_invTDeg, METH_VARARGS, "Converts turns to degrees."},
-	{"TurnsToDegrees", koliba_TDeg, METH_VARARGS, "Converts degrees to turns."},
-	{"TangentFromRadius", koliba_Kappa, METH_VARARGS, "Multiplies by 4(sqrt(2)-1)/3."},
-	{"RadiusFromTangent", koliba_invKappa, METH_VARARGS, "Multiplies by 3/(4(sqrt(2)-1))."},
-	{"TangentToRadius", koliba_compKappa, METH_VARARGS, "Multiplies by (1 - 4(sqrt(2)-1)/3)."},
-	{"AbsoluteTangent", (PyCFunction)koliba_absKappa, METH_VARARGS | METH_KEYWORDS, "Returns start + 4 radius (sqrt(2)-1)/3."},
-	{NULL, NULL, 0, NULL}
-};
+typedef struct {
+	const char *name;
+	Py_ssize_t size;	// bytes per pixel
+	double scale;		// what to scale the FLUT by
+	kolibaRun run[KOLIBA_PRECISIONS];	// NULL if we cannot do that precision
+	kolibaRun tables;	// for 1D FLUTs, or NULL
+	kolibaRun lattice;	// for cubes
+} kolibaPixelFormat;
 
-static struct PyModuleDef kolibamodule = {
-	PyModuleDef_HEAD_INIT,
-	"koliba",
-	"Python implementation of libkoliba.",
-	-1,
-	KolibaMethods
+static const kolibaPixelFormat kpf[] = {
+	{"rgba8", sizeof(KOLIBA_RGBA8PIXEL), 255.0, {kolibaRgba8Run, NULL, kolibaRgba8RunFixed}, kolibaRgba8RunTables, kolibaRgba8RunLattice},
+	{"bgra8", sizeof(KOLIBA_BGRA8PIXEL), 255.0, {kolibaBgra8Run, NULL, kolibaBgra8RunFixed}, kolibaBgra8RunTables, kolibaBgra8RunLattice},
+	{"argb8", sizeof(KOLIBA_ARGB8PIXEL), 255.0, {kolibaArgb8Run, NULL, kolibaArgb8RunFixed}, kolibaArgb8RunTables, kolibaArgb8RunLattice},
+	{"abgr8", sizeof(KOLIBA_ABGR8PIXEL), 255.0, {kolibaAbgr8Run, NULL, kolibaAbgr8RunFixed}, kolibaAbgr8RunTables, kolibaAbgr8RunLattice},
+	{"rgb24", sizeof(KOLIBA_RGB24PIXEL), 255.0, {kolibaRgb24Run, NULL, kolibaRgb24RunFixed}, kolibaRgb24RunTables, kolibaRgb24RunLattice},
+	{"bgr24", sizeof(KOLIBA_BGR24PIXEL), 255.0, {kolibaBgr24Run, NULL, kolibaBgr24RunFixed}, kolibaBgr24RunTables, kolibaBgr24RunLattice},
+	{"rgba16", sizeof(KOLIBA_RGBA16PIXEL), 65535.0, {kolibaRgba16Run, NULL, NULL}, NULL, kolibaRgba16RunLattice},
+	{"rgb10a2", sizeof(KOLIBA_RGB10A2PIXEL), 1023.0, {kolibaRgb10a2Run, NULL, NULL}, NULL, kolibaRgb10a2RunLattice},
+	{"bgr10a2", sizeof(KOLIBA_BGR10A2PIXEL), 1023.0, {kolibaBgr10a2Run, NULL, NULL}, NULL, kolibaBgr10a2RunLattice},
+	{"rgba16f", sizeof(KOLIBA_RGBA16FPIXEL), 1.0, {kolibaRgba16fRun, kolibaRgba16fRun32, NULL}, NULL, kolibaRgba16fRunLattice},
+	{"bgra16f", sizeof(KOLIBA_BGRA16FPIXEL), 1.0, {kolibaBgra16fRun, kolibaBgra16fRun32, NULL}, NULL, kolibaBgra16fRunLattice},
+	{"argb16f", sizeof(KOLIBA_ARGB16FPIXEL), 1.0, {kolibaArgb16fRun, kolibaArgb16fRun32, NULL}, NULL, kolibaArgb16fRunLattice},
+	{"abgr16f", sizeof(KOLIBA_ABGR16FPIXEL), 1.0, {kolibaAbgr16fRun, kolibaAbgr16fRun32, NULL}, NULL, kolibaAbgr16fRunLattice},
+	{"rgba32", sizeof(KOLIBA_RGBA32PIXEL), 1.0, {kolibaRgba32Run, kolibaRgba32Run32, NULL}, NULL, kolibaRgba32RunLattice},
+	{"bgra32", sizeof(KOLIBA_BGRA32PIXEL), 1.0, {kolibaBgra32Run, kolibaBgra32Run32, NULL}, NULL, kolibaBgra32RunLattice},
+	{"argb32", sizeof(KOLIBA_ARGB32PIXEL), 1.0, {kolibaArgb32Run, kolibaArgb32Run32, NULL}, NULL, kolibaArgb32RunLattice},
+	{"abgr32", sizeof(KOLIBA_ABGR32PIXEL), 1.0, {kolibaAbgr32Run, kolibaAbgr32Run32, NULL}, NULL, kolibaAbgr32RunLattice},
+	{NULL}
 };
 
-PyMODINIT_FUNC
-PyInit_koliba(void)
-{
-	PyObject *m, *d, *o;
-
-	if (PyType_Ready(&kolibaAngleType) < 0) return NULL;
-	if ((m = PyModule_Create(&kolibamodule)) == NULL) return NULL;
-	Py_INCREF(&kolibaAngleType);
-	if (PyModule_AddObject(m, "Angle", (PyObject *)&kolibaAngleType) < 0) {
-		Py_DECREF(&kolibaAngleType);
-		Py_DECREF(m);
-		return NULL;
+static const kolibaPixelFormat * koliba_PixelFormat(const char *name) {
+	const kolibaPixelFormat *f;
+
+	for (f = kpf; f->name != NULL; f++)
+		if (strcmp(f->name, name) == 0) return f;
+	PyErr_Format(PyExc_ValueError, "Unknown pixel format \"%s\"", name);
+	return NULL;
+}
+
+// Walk any PEP 3118 buffer one row of pixels at a time. Either each item of
+// the buffer is a pixel, and the last dimension may be strided, or the items
+// are the channels (or bytes) of the pixels, and the last dimension has to be
+// contiguous and hold a whole number of pixels.
+//
+// Asked to fold, a row is as long as the pixels follow on from each other at
+// the same step, so the dimensions of a contiguous (height, width, 4) array
+// all fold into a single row, and only the dimensions in front of it are
+// walked. Planes keep their rows, as those are the rows of the frame.
+
+typedef struct {
+	Py_buffer *view;
+	Py_ssize_t size;	// bytes per pixel
+	Py_ssize_t step;	// bytes from one pixel to the next within a row
+	Py_ssize_t row;		// pixels per row
+	Py_ssize_t rows;	// number of rows
+	int dims;			// the dimensions which index the rows
+	Py_ssize_t r;		// the current row
+	char *p;			// the current pixel
+	Py_ssize_t left;	// pixels left in the current row
+} kolibaPixelWalk;
+
+static int koliba_PixelWalkInit(kolibaPixelWalk *w, Py_buffer *view, Py_ssize_t size, bool fold, const char *what) {
+	Py_ssize_t i, last;
+
+	w->view = view;
+	w->size = size;
+	w->r = 0;
+	if (view->ndim == 0) {
+		if (view->itemsize != size) goto bad;
+		w->row = 1;
+		w->step = size;
+		w->rows = 1;
+		w->dims = 0;
+	}
+	else {
+		last = view->ndim - 1;
+		if (view->itemsize == size) {
+			w->row = view->shape[last];
+			w->step = view->strides[last];
+		}
+		else if ((view->itemsize < size) && (size % view->itemsize == 0)
+			&& ((view->shape[last] == 1) || (view->strides[last] == view->itemsize))
+			&& ((view->shape[last] * view->itemsize) % size == 0)) {
+			w->row = view->shape[last] * view->itemsize / size;
+			w->step = size;
+		}
+		else goto bad;
+		for (w->dims = last; (fold) && (w->dims > 0); w->dims--) {
+			i = w->dims - 1;
+			if ((view->shape[i] != 1) && (view->strides[i] != w->row * w->step)) break;
+			w->row *= view->shape[i];
+		}
+		for (w->rows = 1, i = 0; i < w->dims; i++)
+			w->rows *= view->shape[i];
+	}
+	if (w->row == 0) w->rows = 0;
+	w->p = (char *)view->buf;
+	w->left = (w->rows) ? w->row : 0;
+	return 0;
+
+bad:
+	PyErr_Format(PyExc_ValueError, "The %s buffer does not hold whole %zd-byte pixels", what, size);
+	return -1;
+}
+
+// Move to the start of the next row.
+static void koliba_PixelWalkNextRow(kolibaPixelWalk *w) {
+	Py_ssize_t i, r;
+	char *p;
+
+	if (++w->r >= w->rows) {
+		w->left = 0;
+		return;
+	}
+	for (p = (char *)w->view->buf, r = w->r, i = w->dims - 1; i >= 0; i--) {
+		p += (r % w->view->shape[i]) * w->view->strides[i];
+		r /= w->view->shape[i];
+	}
+	w->p = p;
+	w->left = w->row;
+}
+
+// Position a walk at the k-th pixel.
+static void koliba_PixelWalkSeek(kolibaPixelWalk *w, Py_ssize_t k) {
+	Py_ssize_t c;
+
+	if (w->row == 0) return;
+	w->r = k / w->row - 1;
+	koliba_PixelWalkNextRow(w);
+	if ((w->left) && (c = k % w->row)) {
+		w->p += c * w->step;
+		w->left -= c;
 	}
-	if ((d = PyModule_GetDict(m))) {
-		DoubleConst("pi", KOLIBA_Pi);
-		DoubleConst("invpi", KOLIBA_1DivPi);
-		DoubleConst("tau", KOLIBA_2Pi);
-		DoubleConst("invtau", KOLIBA_1Div2Pi);
-		DoubleConst("rad", KOLIBA_PiDiv180);
-		DoubleConst("invrad", KOLIBA_180DivPi);
-
-		DoubleConst((char *)&kqc[KQC_red][4], (double)KQC_red*7.5);
-		DoubleConst((char *)&kqc[KQC_scarlet][4], (double)KQC_scarlet*7.5);
-		DoubleConst((char *)&kqc[KQC_vermilion][4], (double)KQC_vermilion*7.5);
-		DoubleConst((char *)&kqc[KQC_persimmon][4], (double)KQC_persimmon*7.5);
-		DoubleConst((char *)&kqc[KQC_orange][4], (double)KQC_orange*7.5);
-		DoubleConst((char *)&kqc[KQC_orangepeel][4], (double)KQC_orangepeel*7.5);
-		DoubleConst((char *)&kqc[KQC_amber][4], (double)KQC_amber*7.5);
-		DoubleConst((char *)&kqc[KQC_goldenyellow][4], (double)KQC_goldenyellow*7.5);
-		DoubleConst((char *)&kqc[KQC_yellow][4], (double)KQC_yellow*7.5);
-		DoubleConst((char *)&kqc[KQC_lemon][4], (double)KQC_lemon*7.5);
-		DoubleConst((char *)&kqc[KQC_lime][4], (double)KQC_lime*7.5);
-		DoubleConst((char *)&kqc[KQC_springbud][4], (double)KQC_springbud*7.5);
-		DoubleConst((char *)&kqc[KQC_chartreuse][4], (double)KQC_chartreuse*7.5);
-		DoubleConst((char *)&kqc[KQC_brightgreen][4], (double)KQC_brightgreen*7.5);
-		DoubleConst((char *)&kqc[KQC_harlequin][4], (double)KQC_harlequin*7.5);
-		DoubleConst((char *)&kqc[KQC_neongreen][4], (double)KQC_neongreen*7.5);
-		DoubleConst((char *)&kqc[KQC_green][4], (double)KQC_green*7.5);
-		DoubleConst((char *)&kqc[KQC_jade][4], (double)KQC_jade*7.5);
-		DoubleConst((char *)&kqc[KQC_erin][4], (double)KQC_erin*7.5);
-		DoubleConst((char *)&kqc[KQC_emerald][4], (double)KQC_emerald*7.5);
-		DoubleConst((char *)&kqc[KQC_springgreen][4], (double)KQC_springgreen*7.5);
-		DoubleConst((char *)&kqc[KQC_mint][4], (double)KQC_mint*7.5);
-		DoubleConst((char *)&kqc[KQC_aquamarine][4], (double)KQC_aquamarine*7.5);
-		DoubleConst((char *)&kqc[KQC_turquoise][4], (double)KQC_turquoise*7.5);
-		DoubleConst((char *)&kqc[KQC_cyan][4], (double)KQC_cyan*7.5);
-		DoubleConst((char *)&kqc[KQC_skyblue][4], (double)KQC_skyblue*7.5);
-		DoubleConst((char *)&kqc[KQC_capri][4], (double)KQC_capri*7.5);
-		DoubleConst((char *)&kqc[KQC_cornflower][4], (double)KQC_cornflower*7.5);
-		DoubleConst((char *)&kqc[KQC_azure][4], (double)KQC_azure*7.5);
-		DoubleConst((char *)&kqc[KQC_cobalt][4], (double)KQC_cobalt*7.5);
-		DoubleConst((char *)&kqc[KQC_cerulean][4], (double)KQC_cerulean*7.5);
-		DoubleConst((char *)&kqc[KQC_sapphire][4], (double)KQC_sapphire*7.5);
-		DoubleConst((char *)&kqc[KQC_blue][4], (double)KQC_blue*7.5);
-		DoubleConst((char *)&kqc[KQC_iris][4], (double)KQC_iris*7.5);
-		DoubleConst((char *)&kqc[KQC_indigo][4], (double)KQC_indigo*7.5);
-		DoubleConst((char *)&kqc[KQC_veronica][4], (double)KQC_veronica*7.5);
-		DoubleConst((char *)&kqc[KQC_violet][4], (double)KQC_violet*7.5);
-		DoubleConst((char *)&kqc[KQC_amethyst][4], (double)KQC_amethyst*7.5);
-		DoubleConst((char *)&kqc[KQC_purple][4], (double)KQC_purple*7.5);
-		DoubleConst((char *)&kqc[KQC_phlox][4], (double)KQC_phlox*7.5);
-		DoubleConst((char *)&kqc[KQC_magenta][4], (double)KQC_magenta*7.5);
-		DoubleConst((char *)&kqc[KQC_fuchsia][4], (double)KQC_fuchsia*7.5);
-		DoubleConst((char *)&kqc[KQC_cerise][4], (double)KQC_cerise*7.5);
-		DoubleConst((char *)&kqc[KQC_deeppink][4], (double)KQC_deeppink*7.5);
-		DoubleConst((char *)&kqc[KQC_rose][4], (double)KQC_rose*7.5);
-		DoubleConst((char *)&kqc[KQC_raspberry][4], (double)KQC_raspberry*7.5);
-		DoubleConst((char *)&kqc[KQC_crimson][4], (double)KQC_crimson*7.5);
-		DoubleConst((char *)&kqc[KQC_amaranth][4], (double)KQC_amaranth*7.5);
-
-		DoubleConst("kappa", KOLIBA_Kappa);
-		DoubleConst("invkappa", KOLIBA_1DivKappa);
-		DoubleConst("compkappa", KOLIBA_1MinKappa);
-	}
-
-	PyModule_AddIntConstant(m, (char *)kau[KAU_degrees], (long)KAU_degrees);
-	PyModule_AddIntConstant(m, (char *)kau[KAU_radians], (long)KAU_radians);
-	PyModule_AddIntConstant(m, (char *)kau[KAU_turns], (long)KAU_turns);
-	PyModule_AddIntConstant(m, (char *)kau[KAU_pis], (long)KAU_pis);
-
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_red], (long)KQC_red);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_scarlet], (long)KQC_scarlet);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_vermilion], (long)KQC_vermilion);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_persimmon], (long)KQC_persimmon);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_orange], (long)KQC_orange);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_orangepeel], (long)KQC_orangepeel);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_amber], (long)KQC_amber);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_goldenyellow], (long)KQC_goldenyellow);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_yellow], (long)KQC_yellow);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_lemon], (long)KQC_lemon);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_lime], (long)KQC_lime);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_springbud], (long)KQC_springbud);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_chartreuse], (long)KQC_chartreuse);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_brightgreen], (long)KQC_brightgreen);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_harlequin], (long)KQC_harlequin);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_neongreen], (long)KQC_neongreen);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_green], (long)KQC_green);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_jade], (long)KQC_jade);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_erin], (long)KQC_erin);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_emerald], (long)KQC_emerald);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_springgreen], (long)KQC_springgreen);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_mint], (long)KQC_mint);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_aquamarine], (long)KQC_aquamarine);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_turquoise], (long)KQC_turquoise);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_cyan], (long)KQC_cyan);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_skyblue], (long)KQC_skyblue);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_capri], (long)KQC_capri);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_cornflower], (long)KQC_cornflower);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_azure], (long)KQC_azure);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_cobalt], (long)KQC_cobalt);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_cerulean], (long)KQC_cerulean);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_sapphire], (long)KQC_sapphire);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_blue], (long)KQC_blue);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_iris], (long)KQC_iris);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_indigo], (long)KQC_indigo);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_veronica], (long)KQC_veronica);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_violet], (long)KQC_violet);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_amethyst], (long)KQC_amethyst);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_purple], (long)KQC_purple);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_phlox], (long)KQC_phlox);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_magenta], (long)KQC_magenta);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_fuchsia], (long)KQC_fuchsia);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_cerise], (long)KQC_cerise);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_deeppink], (long)KQC_deeppink);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_rose], (long)KQC_rose);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_raspberry], (long)KQC_raspberry);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_crimson], (long)KQC_crimson);
-	PyModule_AddIntConstant(m, (char *)kqc[KQC_amaranth], (long)KQC_amaranth);
-	return m;
+}
+
+// Apply a FLUT to n pixels. The two walks must contain the same number of
+// pixels, though they may be arranged differently.
+static void koliba_ApplyRuns(kolibaPixelWalk *o, kolibaPixelWalk *i, Py_ssize_t n, kolibaRun run, const void *lut, KOLIBA_FLAGS flags) {
+	Py_ssize_t c;
+
+	while ((n > 0) && (o->left > 0) && (i->left > 0)) {
+		c = (o->left < i->left) ? o->left : i->left;
+		if (c > n) c = n;
+		run(o->p, o->step, i->p, i->step, c, lut, flags);
+		n -= c;
+		if ((o->left -= c) == 0) koliba_PixelWalkNextRow(o);
+		else o->p += c * o->step;
+		if ((i->left -= c) == 0) koliba_PixelWalkNextRow(i);
+		else i->p += c * i->step;
+	}
+}
+
+// The worker pool.
+//
+// A frame is split into bands of whole rows (or of pixels if there are
+// fewer rows than threads), and the bands are handed out to the workers one
+// at a time. The thread that submitted the job works on the bands, too, and
+// only returns when every band is done. The workers stay around between
+// jobs, sleeping on their own "go" lock.
+//
+// We only use the PyThread locks here, so the pool works wherever Python
+// itself has threads. None of it touches Python objects, so it all runs
+// without the GIL.
+
+#define	KOLIBA_MINBAND	16384	// Do not bother splitting fewer pixels than this
+
+static void koliba_JobWork(kolibaPool *pool, kolibaJob *job) {
+	Py_ssize_t b;
+
+	for (;;) {
+		PyThread_acquire_lock(pool->mutex, WAIT_LOCK);
+		b = job->next++;
+		PyThread_release_lock(pool->mutex);
+		if (b >= job->bands) return;
+		job->fn(job->arg, b);
+	}
+}
+
+static void koliba_PoolWorker(void *arg) {
+	kolibaWorker *w = (kolibaWorker *)arg;
+	kolibaPool *pool = w->pool;
+	PyThread_type_lock go = w->go;
+	bool quit, last;
+
+	do {
+		PyThread_acquire_lock(go, WAIT_LOCK);
+		if (!(quit = pool->quit)) koliba_JobWork(pool, pool->job);
+		PyThread_acquire_lock(pool->mutex, WAIT_LOCK);
+		last = (--pool->busy == 0);
+		PyThread_release_lock(pool->mutex);
+		// Nothing may touch the pool after this, it may be gone.
+		if (last) PyThread_release_lock(pool->done);
+	} while (!quit);
+}
+
+// Run a job on the pool and wait for it to finish. Call without the GIL.
+static void koliba_PoolExecute(kolibaPool *pool, kolibaJob *job) {
+	unsigned int i, n;
+
+	job->next = 0;
+	if (job->bands <= 1) {
+		koliba_JobWork(pool, job);
+		return;
+	}
+	PyThread_acquire_lock(pool->submit, WAIT_LOCK);
+	n = pool->size;
+	if ((Py_ssize_t)n >= job->bands) n = (unsigned int)(job->bands - 1);
+	if (n) {
+		pool->job = job;
+		pool->busy = n;
+		for (i = 0; i < n; i++)
+			PyThread_release_lock(pool->w[i].go);
+	}
+	koliba_JobWork(pool, job);
+	if (n) PyThread_acquire_lock(pool->done, WAIT_LOCK);
+	PyThread_release_lock(pool->submit);
+}
+
+// Stop all workers. Call without the GIL while holding the submit lock.
+static void koliba_PoolStop(kolibaPool *pool) {
+	unsigned int i;
+
+	if (pool->size == 0) return;
+	pool->quit = true;
+	pool->busy = pool->size;
+	for (i = 0; i < pool->size; i++)
+		PyThread_release_lock(pool->w[i].go);
+	PyThread_acquire_lock(pool->done, WAIT_LOCK);
+	for (i = 0; i < pool->size; i++)
+		PyThread_free_lock(pool->w[i].go);
+	PyMem_RawFree(pool->w);
+	pool->w = NULL;
+	pool->size = 0;
+	pool->quit = false;
+}
+
+// Start the workers. Call while holding the submit lock.
+static int koliba_PoolStart(kolibaPool *pool, unsigned int workers) {
+	unsigned int i;
+
+	if (workers == 0) return 0;
+	if ((pool->w = PyMem_RawCalloc(workers, sizeof(kolibaWorker))) == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	for (i = 0; i < workers; i++) {
+		pool->w[i].pool = pool;
+		if ((pool->w[i].go = PyThread_allocate_lock()) == NULL) break;
+		PyThread_acquire_lock(pool->w[i].go, WAIT_LOCK);
+		if (PyThread_start_new_thread(koliba_PoolWorker, &pool->w[i]) == PYTHREAD_INVALID_THREAD_ID) {
+			PyThread_free_lock(pool->w[i].go);
+			break;
+		}
+		pool->size++;
+	}
+	if (i < workers) {
+		Py_BEGIN_ALLOW_THREADS
+		koliba_PoolStop(pool);
+		Py_END_ALLOW_THREADS
+		PyErr_SetString(PyExc_RuntimeError, "Cannot start the worker threads");
+		return -1;
+	}
+	return 0;
+}
+
+// Resize the pool to the given number of threads, including the caller.
+static int koliba_PoolResize(kolibaPool *pool, unsigned int threads) {
+	int result;
+
+	if (threads < 1) threads = 1;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(pool->submit, WAIT_LOCK);
+	koliba_PoolStop(pool);
+	Py_END_ALLOW_THREADS
+	if ((result = koliba_PoolStart(pool, threads - 1)) < 0) threads = 1;
+	PyThread_acquire_lock(pool->mutex, WAIT_LOCK);
+	pool->threads = threads;
+	PyThread_release_lock(pool->mutex);
+	PyThread_release_lock(pool->submit);
+	return result;
+}
+
+// Find out how many threads to use, starting the pool the first time.
+// Call with the GIL.
+//
+// Each interpreter has a pool of its own, and those who run one interpreter
+// per core do not want each of them to start a thread per core as well. So
+// only the main interpreter uses all the cores unless told otherwise, the
+// others use just their own thread until SetThreads() says otherwise.
+static unsigned int koliba_PoolThreads(kolibaPool *pool) {
+	PyObject *os, *n;
+	unsigned int t;
+	long c = 1;
+
+	PyThread_acquire_lock(pool->mutex, WAIT_LOCK);
+	t = pool->threads;
+	PyThread_release_lock(pool->mutex);
+	if (t) return t;
+	if ((PyInterpreterState_Get() == PyInterpreterState_Main()) && ((os = PyImport_ImportModule("os")) != NULL)) {
+		if ((n = PyObject_CallMethod(os, "cpu_count", NULL)) != NULL) {
+			if (PyLong_Check(n)) c = PyLong_AsLong(n);
+			Py_DECREF(n);
+		}
+		Py_DECREF(os);
+	}
+	PyErr_Clear();
+	if ((c < 1) || (c > 1024)) c = 1;
+	if (koliba_PoolResize(pool, (unsigned int)c) < 0) {
+		PyErr_Clear();
+		return 1;
+	}
+	return (unsigned int)c;
+}
+
+static int koliba_PoolInit(kolibaPool *pool) {
+	pool->w = NULL;
+	pool->size = 0;
+	pool->threads = 0;
+	pool->busy = 0;
+	pool->quit = false;
+	pool->job = NULL;
+	if (((pool->submit = PyThread_allocate_lock()) == NULL)
+	|| ((pool->mutex = PyThread_allocate_lock()) == NULL)
+	|| ((pool->done = PyThread_allocate_lock()) == NULL)) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	PyThread_acquire_lock(pool->done, WAIT_LOCK);
+	return 0;
+}
+
+// Stop the workers and free the locks when the module goes away.
+static void koliba_PoolFree(kolibaPool *pool) {
+	if (pool->submit == NULL) return;
+	PyThread_acquire_lock(pool->submit, WAIT_LOCK);
+	koliba_PoolStop(pool);
+	PyThread_release_lock(pool->submit);
+	PyThread_free_lock(pool->submit);
+	if (pool->mutex) PyThread_free_lock(pool->mutex);
+	if (pool->done) PyThread_free_lock(pool->done);
+	pool->submit = pool->mutex = pool->done = NULL;
+}
+
+// One band of a Flut.apply().
+typedef struct {
+	kolibaPixelWalk o, i;
+	Py_ssize_t total;	// pixels in the frame
+	Py_ssize_t band;	// pixels per band
+	kolibaRun run;
+	const void *lut;	// whatever the run expects
+	KOLIBA_FLAGS flags;
+} kolibaApplyJob;
+
+static void koliba_ApplyBand(void *arg, Py_ssize_t b) {
+	kolibaApplyJob *a = (kolibaApplyJob *)arg;
+	kolibaPixelWalk o = a->o, i = a->i;
+	Py_ssize_t start = b * a->band;
+
+	koliba_PixelWalkSeek(&o, start);
+	koliba_PixelWalkSeek(&i, start);
+	koliba_ApplyRuns(&o, &i, (a->total - start < a->band) ? a->total - start : a->band, a->run, a->lut, a->flags);
+}
+
+// Decide how to split a frame of total pixels in rows of row pixels
+// among the threads.
+static void koliba_JobBands(kolibaJob *job, Py_ssize_t *band, Py_ssize_t total, Py_ssize_t row, unsigned int threads) {
+	Py_ssize_t bands = total / KOLIBA_MINBAND;
+
+	if (bands > (Py_ssize_t)threads) bands = threads;
+	if (bands < 1) bands = 1;
+	*band = (total + bands - 1) / bands;
+	if ((row > 0) && (*band > row))
+		*band = (*band + row - 1) / row * row;
+	if (*band < 1) *band = 1;
+	job->bands = (total + *band - 1) / *band;
+}
+
+klbdealloc(Flut) {
+	PyTypeObject *type = Py_TYPE(self);
+	type->tp_free((PyObject *)self);
+	Py_DECREF(type);
+}
+
+klbnew(Flut) {
+	kolibaFlutObject *self;
+	self = (kolibaFlutObject *) type->tp_alloc(type, 0);
+	if (self != NULL) {
+		memcpy(&self->fLut, &KOLIBA_IdentityFlut, sizeof(KOLIBA_FLUT));
+		self->flags = KOLIBA_IdentityFlutFlags;
+	}
+	return (PyObject *)self;
+}
+
+// Take a consistent copy of the FLUT and its flags.
+static void koliba_FlutGet(klbo(Flut,self), KOLIBA_FLUT *fLut, KOLIBA_FLAGS *flags) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(fLut, &self->fLut, sizeof(KOLIBA_FLUT));
+	if (flags) *flags = self->flags;
+	Py_END_CRITICAL_SECTION();
+}
+
+static void koliba_FlutPut(klbo(Flut,self), const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(&self->fLut, fLut, sizeof(KOLIBA_FLUT));
+	self->flags = flags;
+	Py_END_CRITICAL_SECTION();
+}
+
+klbinit(Flut) {
+	static char *kwlist[] = {"flut", "flags", NULL};
+	PyObject *flut = NULL, *flags = Py_None;
+	KOLIBA_FLUT fLut;
+	unsigned long f;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO", kwlist, &flut, &flags))
+		return -1;
+	if (flut == NULL) koliba_FlutGet(self, &fLut, NULL);
+	else if (PyObject_TypeCheck(flut, Py_TYPE(self)))
+		koliba_FlutGet((kolibaFlutObject *)flut, &fLut, NULL);
+	else if (koliba_DoublesFromSequence((double *)&fLut, flut, 24, "The FLUT") < 0)
+		return -1;
+	if (flags == Py_None) f = KOLIBA_FlutFlags(&fLut);
+	else if (((f = PyLong_AsUnsignedLongMask(flags)) == (unsigned long)-1) && PyErr_Occurred())
+		return -1;
+	koliba_FlutPut(self, &fLut, (KOLIBA_FLAGS)f & KOLIBA_AllFlutFlags);
+	return 0;
+}
+
+KLBO kolibaFlutGetFlut(klbo(Flut,self), void *closure) {
+	KOLIBA_FLUT fLut;
+
+	koliba_FlutGet(self, &fLut, NULL);
+	return koliba_DoublesToTuple((double *)&fLut, 24);
+}
+
+static int kolibaFlutSetFlut(klbo(Flut,self), PyObject *value, void *closure) {
+	KOLIBA_FLUT fLut;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the FLUT");
+		return -1;
+	}
+	if (koliba_DoublesFromSequence((double *)&fLut, value, 24, "The FLUT") < 0)
+		return -1;
+	koliba_FlutPut(self, &fLut, KOLIBA_FlutFlags(&fLut));
+	return 0;
+}
+
+KLBO kolibaFlutGetFlags(klbo(Flut,self), void *closure) {
+	KOLIBA_FLAGS flags;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	flags = self->flags;
+	Py_END_CRITICAL_SECTION();
+	return PyLong_FromUnsignedLong((unsigned long)flags);
+}
+
+// How far apply(precision="single") may stray from apply() for pixels
+// within [0, 1].
+KLBO kolibaFlutGetSingleError(klbo(Flut,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return PyFloat_FromDouble(KOLIBA_Flut32ErrorBound(&fLut, flags));
+}
+
+// And apply(precision="fixed"), in 8-bit steps, before rounding.
+KLBO kolibaFlutGetFixedError(klbo(Flut,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	KOLIBA_ScaleFlut(&fLut, &fLut, 255.0);
+	return PyFloat_FromDouble(KOLIBA_FixedFlutErrorBound(&fLut, flags));
+}
+
+static int kolibaFlutSetFlags(klbo(Flut,self), PyObject *value, void *closure) {
+	unsigned long f;
+
+	if ((value == NULL) || !PyLong_Check(value)) {
+		PyErr_SetString(PyExc_TypeError, "The flags must be an integer");
+		return -1;
+	}
+	if (((f = PyLong_AsUnsignedLongMask(value)) == (unsigned long)-1) && PyErr_Occurred())
+		return -1;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->flags = (KOLIBA_FLAGS)f & KOLIBA_AllFlutFlags;
+	Py_END_CRITICAL_SECTION();
+	return 0;
+}
+
+// Apply a FLUT to a buffer, as requested by the Python arguments. This does
+// the work of the apply() methods of all the LUT types, which pass us their
+// own copy of the FLUT, so nobody can change it under us while we work.
+// Cubes are too big to copy, so they pass us their lattice and the bytes it
+// points into instead, which never change, and which we hold on to.
+//
+// Everything a frame needs while we work on it without the GIL is kept in
+// a kolibaFrame. Synchronous calls keep it on the stack, asynchronous ones
+// on the heap until the dispatcher is done with it.
+
+struct kolibaFrame {
+	Py_buffer iv, ov;
+	kolibaState *st;
+	PyObject *owner;	// keeps our module alive for apply_async()
+	PyObject *dst;
+	PyObject *loop, *future;
+	PyThread_type_lock handoff;	// released once the dispatcher is done with us
+	bool handed;				// we have acquired handoff
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLUT32 fLut32;
+	KOLIBA_FIXEDFLUT fixed;
+	KOLIBA_BYTETABLES tables;
+	KOLIBA_LATTICE lattice;
+	kolibaFill fill;
+	PyObject *data;		// whatever the lattice points into, or NULL
+	kolibaApplyJob aj;
+	kolibaJob job;
+	kolibaFrame *next;
+};
+
+// Either f and flags, or lat and the data it points into, say what to
+// apply.
+static int koliba_FramePrepare(kolibaFrame *fr, kolibaState *st, PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, const KOLIBA_LATTICE *lat, PyObject *data, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"src", "dst", "format", "precision", NULL};
+	PyObject *src, *dst = Py_None;
+	const char *format = "rgba8";
+	const char *precision = "double";
+	const kolibaPixelFormat *pf;
+	kolibaPixelWalk iw, ow;
+	Py_ssize_t ni, no;
+	kolibaPrecision pr;
+	KOLIBA_FLUTKIND kind;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oss", kwlist, &src, &dst, &format, &precision))
+		return -1;
+	if ((pf = koliba_PixelFormat(format)) == NULL) return -1;
+	if (koliba_Precision(&pr, precision) < 0) return -1;
+	if (pf->run[pr] == NULL) {
+		PyErr_Format(PyExc_ValueError, "The \"%s\" format has no %s precision", format, precision);
+		return -1;
+	}
+	if ((lat) && (pr != KOLIBA_DOUBLE)) {
+		PyErr_Format(PyExc_ValueError, "A cube has no %s precision", precision);
+		return -1;
+	}
+	if (PyObject_GetBuffer(src, &fr->iv, PyBUF_STRIDED_RO) < 0) return -1;
+	if (koliba_PixelWalkInit(&iw, &fr->iv, pf->size, true, "source") < 0) goto done;
+	ni = iw.row * iw.rows;
+
+	if (dst == Py_None) {
+		if ((dst = PyByteArray_FromStringAndSize(NULL, ni * pf->size)) == NULL) goto done;
+	}
+	else Py_INCREF(dst);
+	if (PyObject_GetBuffer(dst, &fr->ov, PyBUF_STRIDED) < 0) {
+		Py_DECREF(dst);
+		goto done;
+	}
+	if (koliba_PixelWalkInit(&ow, &fr->ov, pf->size, true, "destination") < 0) goto release;
+	if ((no = ow.row * ow.rows) != ni) {
+		PyErr_Format(PyExc_ValueError, "The source has %zd pixels but the destination has %zd", ni, no);
+		goto release;
+	}
+
+	fr->aj.o = ow;
+	fr->aj.i = iw;
+	fr->aj.total = ni;
+	fr->data = NULL;
+	if (lat) {
+		memcpy(&fr->lattice, lat, sizeof(KOLIBA_LATTICE));
+		Py_INCREF(data);
+		fr->data = data;
+		fr->aj.run = pf->lattice;
+		fr->aj.lut = &fr->lattice;
+		goto ready;
+	}
+
+	// Animated FLUTs often pass through an identity, and those frames
+	// should cost no more than a copy (or nothing, in place).
+	if ((kind = KOLIBA_FlutKind(f, flags)) == KOLIBA_FLUTIDENTITY) {
+		fr->fill.size = pf->size;
+		fr->aj.run = kolibaCopyRun;
+		fr->aj.lut = &fr->fill;
+		goto ready;
+	}
+
+	KOLIBA_ScaleFlut(&fr->fLut, f, pf->scale);
+	fr->aj.run = pf->run[pr];
+	fr->aj.lut = &fr->fLut;
+	if (pr == KOLIBA_SINGLE)
+		fr->aj.lut = KOLIBA_ConvertFlutToFlut32(&fr->fLut32, &fr->fLut);
+	// A FLUT too steep for fixed point to stay within 1 gets doubles.
+	else if ((pr == KOLIBA_FIXED) && ((fr->aj.lut = KOLIBA_ConvertScaledFlutToFixedFlut(&fr->fixed, &fr->fLut, flags)) == NULL)) {
+		pr = KOLIBA_DOUBLE;
+		fr->aj.run = pf->run[pr];
+		fr->aj.lut = &fr->fLut;
+	}
+	// A 1D FLUT on 8-bit pixels is faster looked up, and the lookups give
+	// exactly what the doubles would. (The fixed-point 1D kernels are faster
+	// still, though.)
+	if ((pr == KOLIBA_DOUBLE) && (pf->tables != NULL) && (KOLIBA_ConvertScaledFlutToByteTables(&fr->tables, &fr->fLut, flags, KOLIBA_ByteDiv255, NULL) != NULL)) {
+		fr->aj.run = pf->tables;
+		fr->aj.lut = &fr->tables;
+	}
+	if (kind == KOLIBA_FLUTCONSTANT) {
+		koliba_FillInit(&fr->fill, pf->size, fr->aj.run, fr->aj.lut, flags);
+		fr->aj.run = kolibaFillRun;
+		fr->aj.lut = &fr->fill;
+	}
+ready:
+	fr->aj.flags = flags;
+	fr->job.fn = koliba_ApplyBand;
+	fr->job.arg = &fr->aj;
+	koliba_JobBands(&fr->job, &fr->aj.band, ni, iw.row, koliba_PoolThreads(&st->pool));
+	Py_INCREF(self);
+	fr->st = st;
+	fr->owner = self;
+	fr->dst = dst;
+	fr->loop = fr->future = NULL;
+	fr->next = NULL;
+	return 0;
+
+release:
+	PyBuffer_Release(&fr->ov);
+	Py_DECREF(dst);
+done:
+	PyBuffer_Release(&fr->iv);
+	return -1;
+}
+
+// Let go of whatever a prepared frame holds on to. Call with the GIL.
+static void koliba_FrameRelease(kolibaFrame *fr) {
+	PyBuffer_Release(&fr->ov);
+	PyBuffer_Release(&fr->iv);
+	Py_DECREF(fr->dst);
+	Py_XDECREF(fr->data);
+	Py_XDECREF(fr->loop);
+	Py_XDECREF(fr->future);
+	Py_DECREF(fr->owner);
+}
+
+// Free an asynchronous frame once the dispatcher is done with it.
+static void koliba_FrameFree(kolibaFrame *fr) {
+	if (!fr->handed) {
+		Py_BEGIN_ALLOW_THREADS
+		PyThread_acquire_lock(fr->handoff, WAIT_LOCK);
+		Py_END_ALLOW_THREADS
+	}
+	PyThread_free_lock(fr->handoff);
+	koliba_FrameRelease(fr);
+	PyMem_Free(fr);
+}
+
+static void koliba_FrameDestroy(PyObject *cap) {
+	koliba_FrameFree((kolibaFrame *)PyCapsule_GetPointer(cap, NULL));
+}
+
+static PyObject * koliba_Apply(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, const KOLIBA_LATTICE *lat, PyObject *data, PyObject *args, PyObject *kwds) {
+	kolibaFrame fr;
+	kolibaState *st;
+	PyObject *result;
+
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	if (koliba_FramePrepare(&fr, st, self, f, flags, lat, data, args, kwds) < 0) return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	koliba_PoolExecute(&st->pool, &fr.job);
+	Py_END_ALLOW_THREADS
+
+	Py_INCREF(fr.dst);
+	result = fr.dst;
+	koliba_FrameRelease(&fr);
+	return result;
+}
+
+// Free a queue nobody uses anymore.
+static void koliba_QueueDelete(kolibaQueue *q) {
+	if (q->lock) PyThread_free_lock(q->lock);
+	if (q->wake) PyThread_free_lock(q->wake);
+	PyMem_RawFree(q);
+}
+
+// The dispatcher waits for frames, runs each on the pool without any
+// Python thread state, then borrows a thread state just long enough to
+// hand the frame over to the event loop of whoever asked for it.
+//
+// The event loop must not finish the future before we have given the
+// thread state back, or whoever awaits it might already be tearing down
+// the interpreter. So the frame only counts as handed over once we
+// release its handoff lock, and the loop waits for that.
+//
+// Each frame keeps the module alive while we work on it, but letting go
+// of one may free the module, so after that we only touch the queue.
+
+static void koliba_Dispatch(void *arg) {
+	kolibaQueue *q = (kolibaQueue *)arg;
+	kolibaFrame *fr;
+	PyThreadState *ts;
+	PyObject *cap, *r;
+
+	for (;;) {
+		PyThread_acquire_lock(q->lock, WAIT_LOCK);
+		if ((fr = q->first) != NULL) {
+			if ((q->first = fr->next) == NULL) q->last = NULL;
+		}
+		else if (q->quit) {
+			PyThread_release_lock(q->lock);
+			koliba_QueueDelete(q);
+			return;
+		}
+		else q->sleeping = true;
+		PyThread_release_lock(q->lock);
+		if (fr == NULL) {
+			PyThread_acquire_lock(q->wake, WAIT_LOCK);
+			continue;
+		}
+
+		koliba_PoolExecute(&fr->st->pool, &fr->job);
+
+		ts = PyThreadState_New(q->interp);
+		PyEval_RestoreThread(ts);
+		r = NULL;
+		if ((cap = PyCapsule_New(fr, NULL, koliba_FrameDestroy)) != NULL) {
+			r = PyObject_CallMethod(fr->loop, "call_soon_threadsafe", "OO", fr->st->complete, cap);
+			Py_XDECREF(r);
+		}
+		if (r == NULL) {
+			// The loop is closed, nobody is waiting.
+			PyErr_Clear();
+			PyThread_release_lock(fr->handoff);
+			if (cap) Py_DECREF(cap);
+			else koliba_FrameFree(fr);
+		}
+		else Py_DECREF(cap);
+		PyThreadState_Clear(ts);
+		PyThreadState_DeleteCurrent();
+		if (r) PyThread_release_lock(fr->handoff);
+	}
+}
+
+// Called by the event loop with the frame in a capsule: set the result of
+// the future, unless it was cancelled.
+KLBO koliba_Complete(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+	kolibaFrame *fr;
+	PyObject *r;
+	int done;
+
+	if ((nargs != 1) || ((fr = PyCapsule_GetPointer(args[0], NULL)) == NULL)) {
+		PyErr_SetString(PyExc_TypeError, "_complete() takes a frame");
+		return NULL;
+	}
+	// The dispatcher may still be letting go of its thread state. That
+	// takes no Python code of ours, so we wait for it without the GIL
+	// rather than coming back around the loop for it.
+	if (!fr->handed) {
+		if (!PyThread_acquire_lock(fr->handoff, NOWAIT_LOCK)) {
+			Py_BEGIN_ALLOW_THREADS
+			PyThread_acquire_lock(fr->handoff, WAIT_LOCK);
+			Py_END_ALLOW_THREADS
+		}
+		fr->handed = true;
+	}
+	if ((r = PyObject_CallMethod(fr->future, "done", NULL)) == NULL) return NULL;
+	done = PyObject_IsTrue(r);
+	Py_DECREF(r);
+	if (done < 0) return NULL;
+	if (!done) {
+		if ((r = PyObject_CallMethod(fr->future, "set_result", "O", fr->dst)) == NULL) return NULL;
+		Py_DECREF(r);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaComplete = {"_complete", (PyCFunction)(void(*)(void))koliba_Complete, METH_FASTCALL, NULL};
+
+static kolibaQueue * koliba_QueueNew(void) {
+	kolibaQueue *q;
+
+	if ((q = PyMem_RawCalloc(1, sizeof(kolibaQueue))) == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	q->interp = PyInterpreterState_Get();
+	if (((q->lock = PyThread_allocate_lock()) == NULL)
+	|| ((q->wake = PyThread_allocate_lock()) == NULL)) {
+		koliba_QueueDelete(q);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	PyThread_acquire_lock(q->wake, WAIT_LOCK);
+	return q;
+}
+
+// Tell the dispatcher to quit when the module goes away. By then no frames
+// are waiting, as each of them keeps the module alive. We do not wait for
+// it, we may be running in it, so it frees the queue when it is done.
+static void koliba_QueueFree(kolibaQueue *q) {
+	bool running;
+
+	if (q == NULL) return;
+	PyThread_acquire_lock(q->lock, WAIT_LOCK);
+	q->quit = true;
+	if ((running = q->running) && (q->sleeping)) {
+		q->sleeping = false;
+		PyThread_release_lock(q->wake);
+	}
+	PyThread_release_lock(q->lock);
+	if (!running) koliba_QueueDelete(q);
+}
+
+// Queue a frame for the dispatcher, starting it if it is not running yet.
+static int koliba_QueueFrame(kolibaQueue *q, kolibaFrame *fr) {
+	int r = 0;
+
+	PyThread_acquire_lock(q->lock, WAIT_LOCK);
+	if (!q->running) {
+		if (PyThread_start_new_thread(koliba_Dispatch, q) == PYTHREAD_INVALID_THREAD_ID) r = -1;
+		else q->running = true;
+	}
+	if (r == 0) {
+		if (q->last) q->last->next = fr;
+		else q->first = fr;
+		q->last = fr;
+		if (q->sleeping) {
+			q->sleeping = false;
+			PyThread_release_lock(q->wake);
+		}
+	}
+	PyThread_release_lock(q->lock);
+	if (r < 0) PyErr_SetString(PyExc_RuntimeError, "Cannot start the dispatcher thread");
+	return r;
+}
+
+// The workers and the dispatcher do not survive a fork, so the child
+// starts from scratch. The module is our self here.
+KLBO koliba_AfterFork(PyObject *self, PyObject *unused) {
+	kolibaState *st = (kolibaState *)PyModule_GetState(self);
+
+	if (st == NULL) Py_RETURN_NONE;
+	if (koliba_PoolInit(&st->pool) < 0) return NULL;
+	if ((st->queue = koliba_QueueNew()) == NULL) return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaAfterFork = {"_afterfork", koliba_AfterFork, METH_NOARGS, NULL};
+
+// Return a new reference to asyncio.get_running_loop, looking it up the
+// first time. Importing asyncio may run any code at all, so we do it
+// outside the critical section on the module, and keep whatever another
+// thread may have stored in the meantime. The module m has the state st.
+static PyObject * koliba_GetLoop(PyObject *m, kolibaState *st) {
+	PyObject *getloop, *asyncio, *found;
+
+	Py_BEGIN_CRITICAL_SECTION(m);
+	Py_XINCREF(getloop = st->getloop);
+	Py_END_CRITICAL_SECTION();
+	if (getloop) return getloop;
+
+	if ((asyncio = PyImport_ImportModule("asyncio")) == NULL) return NULL;
+	found = PyObject_GetAttrString(asyncio, "get_running_loop");
+	Py_DECREF(asyncio);
+	if (found == NULL) return NULL;
+
+	Py_BEGIN_CRITICAL_SECTION(m);
+	if (st->getloop == NULL) {
+		Py_INCREF(found);
+		st->getloop = found;
+	}
+	Py_INCREF(getloop = st->getloop);
+	Py_END_CRITICAL_SECTION();
+	Py_DECREF(found);
+	return getloop;
+}
+
+// The apply_async() of all the LUT types: return an asyncio future that
+// gets the destination once the frame is done. Neither buffer should be
+// touched before then.
+static PyObject * koliba_ApplyAsync(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, const KOLIBA_LATTICE *lat, PyObject *data, PyObject *args, PyObject *kwds) {
+	kolibaFrame *fr;
+	kolibaState *st;
+	PyObject *m, *future, *getloop;
+
+	if ((m = koliba_TypeModule(Py_TYPE(self))) == NULL) return NULL;
+	st = (kolibaState *)PyModule_GetState(m);
+	if ((getloop = koliba_GetLoop(m, st)) == NULL) return NULL;
+	if ((fr = PyMem_Malloc(sizeof(kolibaFrame))) == NULL) {
+		Py_DECREF(getloop);
+		return PyErr_NoMemory();
+	}
+	if ((fr->handoff = PyThread_allocate_lock()) == NULL) {
+		Py_DECREF(getloop);
+		PyMem_Free(fr);
+		return PyErr_NoMemory();
+	}
+	if (koliba_FramePrepare(fr, st, self, f, flags, lat, data, args, kwds) < 0) {
+		Py_DECREF(getloop);
+		PyThread_free_lock(fr->handoff);
+		PyMem_Free(fr);
+		return NULL;
+	}
+	// Nobody else has the frame yet, so it counts as handed over until we
+	// queue it.
+	fr->handed = true;
+	fr->loop = PyObject_CallNoArgs(getloop);
+	Py_DECREF(getloop);
+	if ((fr->loop == NULL)
+	|| ((fr->future = PyObject_CallMethod(fr->loop, "create_future", NULL)) == NULL)) {
+		koliba_FrameFree(fr);
+		return NULL;
+	}
+	// The frame may be done and gone before we return, so take our
+	// reference to the future before queueing it.
+	Py_INCREF(fr->future);
+	future = fr->future;
+	PyThread_acquire_lock(fr->handoff, WAIT_LOCK);
+	fr->handed = false;
+	if (koliba_QueueFrame(st->queue, fr) < 0) {
+		Py_DECREF(future);
+		fr->handed = true;
+		PyThread_release_lock(fr->handoff);
+		koliba_FrameFree(fr);
+		return NULL;
+	}
+	return future;
+}
+
+KLBO koliba_ApplyFlut(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, PyObject *args, PyObject *kwds) {
+	return koliba_Apply(self, f, flags, NULL, NULL, args, kwds);
+}
+
+KLBO koliba_ApplyFlutAsync(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, PyObject *args, PyObject *kwds) {
+	return koliba_ApplyAsync(self, f, flags, NULL, NULL, args, kwds);
+}
+
+// The lattice points into data, which the frame keeps alive while it works.
+KLBO koliba_ApplyLattice(PyObject *self, const KOLIBA_LATTICE *lat, PyObject *data, PyObject *args, PyObject *kwds) {
+	return koliba_Apply(self, NULL, 0, lat, data, args, kwds);
+}
+
+KLBO koliba_ApplyLatticeAsync(PyObject *self, const KOLIBA_LATTICE *lat, PyObject *data, PyObject *args, PyObject *kwds) {
+	return koliba_ApplyAsync(self, NULL, 0, lat, data, args, kwds);
+}
+
+// Planar frames, as FFmpeg keeps its GBRP formats: three planes, green,
+// blue, and red, in that order, each a buffer of one row of elements, or
+// of rows of them. Each row must be contiguous, but the rows can be any
+// number of bytes apart, each plane its own. Like the pixel runs, the
+// planar runs never touch the Python API.
+
+typedef void (*kolibaPlanarRun)(KOLIBA_PLANES *, const KOLIBA_PLANES *, size_t, size_t, const void *, KOLIBA_FLAGS);
+
+static void kolibaPlanar8Run(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_ScaledPlanar8Array(o, i, w, h, (const KOLIBA_FLUT *)lut, flags, KOLIBA_ByteDiv255, NULL);
+}
+
+static void kolibaPlanar8RunFixed(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar8ArrayFixed(o, i, w, h, (const KOLIBA_FIXEDFLUT *)lut, flags);
+}
+
+static void kolibaPlanar8RunTables(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar8ArrayTables(o, i, w, h, (const KOLIBA_BYTETABLES *)lut);
+}
+
+static void kolibaPlanar8RunLattice(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar8ArrayLattice(o, i, w, h, (const KOLIBA_LATTICE *)lut, KOLIBA_ByteDiv255, NULL);
+}
+
+static void kolibaPlanar16Run(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_ScaledPlanar16Array(o, i, w, h, (const KOLIBA_FLUT *)lut, flags, NULL);
+}
+
+static void kolibaPlanar16RunLattice(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar16ArrayLattice(o, i, w, h, (const KOLIBA_LATTICE *)lut, NULL, NULL);
+}
+
+static void kolibaPlanar32Run(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar32Array(o, i, w, h, (const KOLIBA_FLUT *)lut, flags, NULL, NULL);
+}
+
+static void kolibaPlanar32Run32(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar32Array32(o, i, w, h, (const KOLIBA_FLUT32 *)lut, flags);
+}
+
+static void kolibaPlanar32RunLattice(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	KOLIBA_Planar32ArrayLattice(o, i, w, h, (const KOLIBA_LATTICE *)lut);
+}
+
+// The copies and fills of planes only need their elements, each plane's
+// fill being the first bytes of the bits of its own 16 bytes.
+static void kolibaPlanarRunCopy(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	const Py_ssize_t size = ((const kolibaFill *)lut)->size;
+	char *p;
+	const char *q;
+	size_t y;
+	unsigned int c;
+
+	for (c = 0; c < 3; c++)
+		for (y = 0; y < h; y++) {
+			p = (char *)o->plane[c] + (ptrdiff_t)y * o->stride[c];
+			q = (const char *)i->plane[c] + (ptrdiff_t)y * i->stride[c];
+			if (p != q) memmove(p, q, w * size);
+		}
+}
+
+static void kolibaPlanarRunFill(KOLIBA_PLANES *o, const KOLIBA_PLANES *i, size_t w, size_t h, const void *lut, KOLIBA_FLAGS flags) {
+	const kolibaFill *f = (const kolibaFill *)lut;
+	size_t y;
+	unsigned int c;
+
+	for (c = 0; c < 3; c++)
+		for (y = 0; y < h; y++)
+			koliba_FillRow((char *)o->plane[c] + (ptrdiff_t)y * o->stride[c], f->bits + 16 * c, f->size, (Py_ssize_t)w * f->size);
+}
+
+// Work out the fill of each plane with the run that would have done it.
+static void koliba_PlanarFillInit(kolibaFill *fl, Py_ssize_t size, kolibaPlanarRun run, const void *lut, KOLIBA_FLAGS flags) {
+	unsigned char zero[3 * 16];
+	KOLIBA_PLANES o, i;
+	unsigned int c;
+
+	memset(zero, 0, sizeof(zero));
+	fl->size = size;
+	for (c = 0; c < 3; c++) {
+		i.plane[c] = zero + 16 * c;
+		o.plane[c] = fl->bits + 16 * c;
+		i.stride[c] = o.stride[c] = 0;
+	}
+	run(&o, &i, 1, 1, lut, flags);
+}
+
+typedef struct {
+	const char *name;
+	Py_ssize_t size;	// bytes per element
+	double scale;		// what to scale the FLUT by
+	kolibaPlanarRun run[KOLIBA_PRECISIONS];	// NULL if we cannot do that precision
+	kolibaPlanarRun tables;	// for 1D FLUTs, or NULL
+	kolibaPlanarRun lattice;	// for cubes
+} kolibaPlanarFormat;
+
+static const kolibaPlanarFormat kplf[] = {
+	{"gbrp", sizeof(uint8_t), 255.0, {kolibaPlanar8Run, NULL, kolibaPlanar8RunFixed}, kolibaPlanar8RunTables, kolibaPlanar8RunLattice},
+	{"gbrp16", sizeof(uint16_t), 65535.0, {kolibaPlanar16Run, NULL, NULL}, NULL, kolibaPlanar16RunLattice},
+	{"gbrpf32", sizeof(float), 1.0, {kolibaPlanar32Run, kolibaPlanar32Run32, NULL}, NULL, kolibaPlanar32RunLattice},
+	{NULL}
+};
+
+// Which plane of a KOLIBA_PLANES the k-th one of FFmpeg is.
+#define	klbgbrp(k)	(((k) + 1) % 3)
+
+// Find out where the rows of a plane are, and how many.
+static int koliba_PlaneInit(Py_buffer *view, Py_ssize_t size, void **p, ptrdiff_t *stride, Py_ssize_t *width, Py_ssize_t *height, const char *what) {
+	kolibaPixelWalk w;
+
+	if (koliba_PixelWalkInit(&w, view, size, false, what) < 0) return -1;
+	if ((view->ndim > 2) || ((w.row > 1) && (w.step != size))) {
+		PyErr_Format(PyExc_ValueError, "The %s planes must be rows of contiguous %zd-byte elements", what, size);
+		return -1;
+	}
+	*p = w.p;
+	*stride = (view->ndim == 2) ? view->strides[0] : 0;
+	*width = w.row;
+	*height = w.rows;
+	return 0;
+}
+
+// One band of an apply_planar(), whole rows where it can, parts of a row
+// where it cannot.
+typedef struct {
+	KOLIBA_PLANES o, i;
+	Py_ssize_t size;	// bytes per element
+	Py_ssize_t width;	// elements per row
+	Py_ssize_t total;	// elements per plane
+	Py_ssize_t band;	// elements per band
+	kolibaPlanarRun run;
+	const void *lut;
+	KOLIBA_FLAGS flags;
+} kolibaPlanarJob;
+
+static void koliba_PlanarBand(void *arg, Py_ssize_t b) {
+	kolibaPlanarJob *a = (kolibaPlanarJob *)arg;
+	KOLIBA_PLANES o, i;
+	Py_ssize_t s = b * a->band, e = s + a->band, y, x, n, h;
+	unsigned int c;
+
+	if (e > a->total) e = a->total;
+	for (; s < e; s += n * h) {
+		y = s / a->width;
+		x = s % a->width;
+		if ((x == 0) && (e - s >= a->width)) {
+			n = a->width;
+			h = (e - s) / a->width;
+		}
+		else {
+			n = (a->width - x < e - s) ? a->width - x : e - s;
+			h = 1;
+		}
+		for (c = 0; c < 3; c++) {
+			o.plane[c] = (char *)a->o.plane[c] + y * a->o.stride[c] + x * a->size;
+			o.stride[c] = a->o.stride[c];
+			i.plane[c] = (char *)a->i.plane[c] + y * a->i.stride[c] + x * a->size;
+			i.stride[c] = a->i.stride[c];
+		}
+		a->run(&o, &i, (size_t)n, (size_t)h, a->lut, a->flags);
+	}
+}
+
+// Either f and flags, or lat, say what to apply. The caller holds on to
+// whatever lat points into.
+static PyObject * koliba_ApplyPlanar(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, const KOLIBA_LATTICE *lat, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"src", "dst", "format", "precision", NULL};
+	PyObject *src, *dst = Py_None, *item, *result = NULL, *r = NULL;
+	const char *format = "gbrp";
+	const char *precision = "double";
+	const kolibaPlanarFormat *pf;
+	kolibaPrecision pr;
+	kolibaState *st;
+	Py_buffer iv[3], ov[3];
+	kolibaPlanarJob pj;
+	kolibaJob job;
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLUT32 fLut32;
+	KOLIBA_FIXEDFLUT fixed;
+	KOLIBA_BYTETABLES tables;
+	kolibaFill fill;
+	KOLIBA_FLUTKIND kind;
+	Py_ssize_t w = 0, h = 0, pw, ph;
+	int ni = 0, no = 0, k, c;
+
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oss", kwlist, &src, &dst, &format, &precision))
+		return NULL;
+	for (pf = kplf; pf->name != NULL; pf++)
+		if (strcmp(pf->name, format) == 0) break;
+	if (pf->name == NULL) {
+		PyErr_Format(PyExc_ValueError, "Unknown planar format \"%s\", expected \"gbrp\", \"gbrp16\", or \"gbrpf32\"", format);
+		return NULL;
+	}
+	if (koliba_Precision(&pr, precision) < 0) return NULL;
+	if (pf->run[pr] == NULL) {
+		PyErr_Format(PyExc_ValueError, "The \"%s\" format has no %s precision", format, precision);
+		return NULL;
+	}
+	if ((lat) && (pr != KOLIBA_DOUBLE)) {
+		PyErr_Format(PyExc_ValueError, "A cube has no %s precision", precision);
+		return NULL;
+	}
+	if (!PySequence_Check(src) || (PySequence_Size(src) != 3)) {
+		PyErr_SetString(PyExc_TypeError, "The source must be a sequence of three planes");
+		return NULL;
+	}
+	if ((dst != Py_None) && (!PySequence_Check(dst) || (PySequence_Size(dst) != 3))) {
+		PyErr_SetString(PyExc_TypeError, "The destination must be a sequence of three planes");
+		return NULL;
+	}
+
+	for (; ni < 3; ni++) {
+		if ((item = PySequence_GetItem(src, ni)) == NULL) goto done;
+		k = PyObject_GetBuffer(item, &iv[ni], PyBUF_STRIDED_RO);
+		Py_DECREF(item);
+		if (k < 0) goto done;
+		c = klbgbrp(ni);
+		if (koliba_PlaneInit(&iv[ni], pf->size, &pj.i.plane[c], &pj.i.stride[c], &pw, &ph, "source") < 0) {
+			ni++;
+			goto done;
+		}
+		if (ni == 0) {
+			w = pw;
+			h = ph;
+		}
+		else if ((pw != w) || (ph != h)) {
+			PyErr_SetString(PyExc_ValueError, "The source planes differ in size");
+			ni++;
+			goto done;
+		}
+	}
+
+	if (dst == Py_None) {
+		if ((result = PyTuple_New(3)) == NULL) goto done;
+		for (k = 0; k < 3; k++) {
+			if ((item = PyByteArray_FromStringAndSize(NULL, w * h * pf->size)) == NULL) goto done;
+			PyTuple_SET_ITEM(result, k, item);
+		}
+		dst = result;
+	}
+	else {
+		Py_INCREF(dst);
+		result = dst;
+	}
+	for (; no < 3; no++) {
+		if ((item = PySequence_GetItem(dst, no)) == NULL) goto done;
+		k = PyObject_GetBuffer(item, &ov[no], PyBUF_STRIDED);
+		Py_DECREF(item);
+		if (k < 0) goto done;
+		c = klbgbrp(no);
+		if (koliba_PlaneInit(&ov[no], pf->size, &pj.o.plane[c], &pj.o.stride[c], &pw, &ph, "destination") < 0) {
+			no++;
+			goto done;
+		}
+		// A 1-D destination for a 2-D source is fine, as long as the
+		// numbers of elements agree.
+		if ((pw == w * h) && (ph == 1) && (pw != w)) pj.o.stride[c] = w * pf->size;
+		else if ((pw != w) || (ph != h)) {
+			PyErr_Format(PyExc_ValueError, "The source planes have %zd elements but the destination planes have %zd", w * h, pw * ph);
+			no++;
+			goto done;
+		}
+	}
+
+	pj.size = pf->size;
+	pj.width = w;
+	pj.total = w * h;
+	pj.flags = flags;
+	if (lat) {
+		pj.run = pf->lattice;
+		pj.lut = lat;
+	}
+	else if ((kind = KOLIBA_FlutKind(f, flags)) == KOLIBA_FLUTIDENTITY) {
+		fill.size = pf->size;
+		pj.run = kolibaPlanarRunCopy;
+		pj.lut = &fill;
+	}
+	else {
+		KOLIBA_ScaleFlut(&fLut, f, pf->scale);
+		pj.run = pf->run[pr];
+		pj.lut = &fLut;
+		if (pr == KOLIBA_SINGLE)
+			pj.lut = KOLIBA_ConvertFlutToFlut32(&fLut32, &fLut);
+		else if ((pr == KOLIBA_FIXED) && ((pj.lut = KOLIBA_ConvertScaledFlutToFixedFlut(&fixed, &fLut, flags)) == NULL)) {
+			pr = KOLIBA_DOUBLE;
+			pj.run = pf->run[pr];
+			pj.lut = &fLut;
+		}
+		if ((pr == KOLIBA_DOUBLE) && (pf->tables != NULL) && (KOLIBA_ConvertScaledFlutToByteTables(&tables, &fLut, flags, KOLIBA_ByteDiv255, NULL) != NULL)) {
+			pj.run = pf->tables;
+			pj.lut = &tables;
+		}
+		if (kind == KOLIBA_FLUTCONSTANT) {
+			koliba_PlanarFillInit(&fill, pf->size, pj.run, pj.lut, flags);
+			pj.run = kolibaPlanarRunFill;
+			pj.lut = &fill;
+		}
+	}
+	job.fn = koliba_PlanarBand;
+	job.arg = &pj;
+	koliba_JobBands(&job, &pj.band, pj.total, w, koliba_PoolThreads(&st->pool));
+
+	Py_BEGIN_ALLOW_THREADS
+	koliba_PoolExecute(&st->pool, &job);
+	Py_END_ALLOW_THREADS
+
+	r = result;
+	result = NULL;
+done:
+	while (no > 0) PyBuffer_Release(&ov[--no]);
+	while (ni > 0) PyBuffer_Release(&iv[--ni]);
+	Py_XDECREF(result);
+	return r;
+}
+
+#undef	klbgbrp
+
+// YCbCr frames, as FFmpeg keeps them: the Y, Cb, and Cr planes, or the Y
+// plane and the Cb and Cr interleaved in another (nv12, p010), the chroma
+// planes smaller than the luma unless the format is 4:4:4.
+typedef struct {
+	const char *name;
+	int planes;		// 3, or 2 with Cb and Cr interleaved
+	unsigned char bits, size, shift, hsub, vsub;	// as in a KOLIBA_YCCFORMAT
+} kolibaYccLayout;
+
+static const kolibaYccLayout kycl[] = {
+	{"yuv420p", 3, 8, sizeof(uint8_t), 0, 1, 1},
+	{"yuv422p", 3, 8, sizeof(uint8_t), 0, 1, 0},
+	{"yuv444p", 3, 8, sizeof(uint8_t), 0, 0, 0},
+	{"nv12", 2, 8, sizeof(uint8_t), 0, 1, 1},
+	{"p010", 2, 10, sizeof(uint16_t), 6, 1, 1},
+	{NULL}
+};
+
+static const struct {
+	const char *name;
+	const KOLIBA_RGB *rec;
+} kolibaRecs[] = {
+	{"601", &KOLIBA_Rec601},
+	{"709", &KOLIBA_Rec709},
+	{"2020", &KOLIBA_Rec2020},
+	{NULL}
+};
+
+// Find a plane which must have width by height elements, or as many in
+// a flat buffer (which then has rows of width elements).
+static int koliba_YccPlaneInit(Py_buffer *view, Py_ssize_t size, void **p, ptrdiff_t *stride, Py_ssize_t width, Py_ssize_t height, const char *what) {
+	Py_ssize_t pw, ph;
+
+	if (koliba_PlaneInit(view, size, p, stride, &pw, &ph, what) < 0) return -1;
+	if ((pw == width * height) && (ph == 1) && (pw != width)) *stride = width * size;
+	else if ((pw != width) || (ph != height)) {
+		PyErr_Format(PyExc_ValueError, "A %s plane has %zd elements, but should have %zd", what, pw * ph, width * height);
+		return -1;
+	}
+	return 0;
+}
+
+// One band of an apply_ycc(), always whole groups of rows sharing their
+// chroma.
+typedef struct {
+	KOLIBA_PLANES o, i;
+	KOLIBA_YCCFORMAT fmt;
+	Py_ssize_t width;	// of the luma
+	Py_ssize_t height;
+	Py_ssize_t band;	// rows per band
+	Py_ssize_t cw;		// samples per row of chroma
+	int planes;
+	const KOLIBA_FLUT *fLut;
+	KOLIBA_FLAGS flags;
+	KOLIBA_FLUTKIND kind;
+	kolibaFill fill;	// the luma, and the chroma of each plane, 16 bytes apart
+	const KOLIBA_LATTICE *lat;
+} kolibaYccJob;
+
+// An identity copies the planes, and a constant color fills them.
+static void koliba_YccCopy(kolibaYccJob *a, Py_ssize_t s, Py_ssize_t n) {
+	Py_ssize_t y, e, bytes;
+	char *p;
+	const char *q;
+	int c;
+
+	for (c = 0; c < a->planes; c++) {
+		if (c == 0) {
+			y = s;
+			e = s + n;
+			bytes = a->width * a->fmt.size;
+		}
+		else {
+			y = s >> a->fmt.vsub;
+			e = (s + n + (1 << a->fmt.vsub) - 1) >> a->fmt.vsub;
+			bytes = a->cw * a->fmt.size;
+		}
+		for (; y < e; y++) {
+			p = (char *)a->o.plane[c] + y * a->o.stride[c];
+			q = (const char *)a->i.plane[c] + y * a->i.stride[c];
+			if (a->kind == KOLIBA_FLUTCONSTANT)
+				koliba_FillRow(p, a->fill.bits + 16 * c, (c == 0) ? a->fmt.size : a->fmt.step * a->fmt.size, bytes);
+			else if (p != q) memmove(p, q, bytes);
+		}
+	}
+}
+
+static void koliba_YccBand(void *arg, Py_ssize_t b) {
+	kolibaYccJob *a = (kolibaYccJob *)arg;
+	KOLIBA_PLANES o, i;
+	Py_ssize_t s = b * a->band, n = (a->height - s < a->band) ? a->height - s : a->band, y;
+	unsigned int c;
+
+	if (a->kind != KOLIBA_FLUTGENERAL) {
+		koliba_YccCopy(a, s, n);
+		return;
+	}
+	for (c = 0; c < 3; c++) {
+		y = (c == 0) ? s : s >> a->fmt.vsub;
+		o.plane[c] = (char *)a->o.plane[c] + y * a->o.stride[c];
+		o.stride[c] = a->o.stride[c];
+		i.plane[c] = (char *)a->i.plane[c] + y * a->i.stride[c];
+		i.stride[c] = a->i.stride[c];
+	}
+	if (a->lat) KOLIBA_YccPlanarArrayLattice(&o, &i, (size_t)a->width, (size_t)n, &a->fmt, a->lat);
+	else KOLIBA_YccPlanarArray(&o, &i, (size_t)a->width, (size_t)n, &a->fmt, a->fLut, a->flags);
+}
+
+// Work out the samples of a constant color from a frame of one pixel.
+static void koliba_YccFillInit(kolibaYccJob *a) {
+	unsigned char zero[3 * 16];
+	KOLIBA_PLANES o, i;
+	unsigned int c;
+
+	memset(zero, 0, sizeof(zero));
+	for (c = 0; c < 3; c++) {
+		i.plane[c] = zero + 16 * c;
+		o.plane[c] = a->fill.bits + 16 * c;
+		i.stride[c] = o.stride[c] = 0;
+	}
+	// Interleaved, the Cr comes right after the Cb.
+	if (a->planes == 2) o.plane[2] = a->fill.bits + 16 + a->fmt.size;
+	a->fill.size = a->fmt.size;
+	KOLIBA_YccPlanarArray(&o, &i, 1, 1, &a->fmt, a->fLut, a->flags);
+}
+
+// Either f and flags, or lat, say what to apply, as with apply_planar().
+static PyObject * koliba_ApplyYcc(PyObject *self, const KOLIBA_FLUT *f, KOLIBA_FLAGS flags, const KOLIBA_LATTICE *lat, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"src", "dst", "format", "rec", "full", NULL};
+	PyObject *src, *dst = Py_None, *item, *result = NULL, *r = NULL;
+	const char *format = "yuv420p";
+	const char *rec = "709";
+	int full = 0;
+	const kolibaYccLayout *yl;
+	kolibaState *st;
+	Py_buffer iv[3], ov[3];
+	kolibaYccJob yj;
+	kolibaJob job;
+	Py_ssize_t w = 0, h = 0, cw, ch, row;
+	int ni = 0, no = 0, k, e;
+
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Ossp", kwlist, &src, &dst, &format, &rec, &full))
+		return NULL;
+	for (yl = kycl; yl->name != NULL; yl++)
+		if (strcmp(yl->name, format) == 0) break;
+	if (yl->name == NULL) {
+		PyErr_Format(PyExc_ValueError, "Unknown YCbCr format \"%s\", expected \"yuv420p\", \"yuv422p\", \"yuv444p\", \"nv12\", or \"p010\"", format);
+		return NULL;
+	}
+	for (k = 0; kolibaRecs[k].name != NULL; k++)
+		if (strcmp(kolibaRecs[k].name, rec) == 0) break;
+	if (kolibaRecs[k].name == NULL) {
+		PyErr_Format(PyExc_ValueError, "Unknown Rec \"%s\", expected \"601\", \"709\", or \"2020\"", rec);
+		return NULL;
+	}
+	yj.fmt.bits = yl->bits;
+	yj.fmt.size = yl->size;
+	yj.fmt.shift = yl->shift;
+	yj.fmt.hsub = yl->hsub;
+	yj.fmt.vsub = yl->vsub;
+	yj.fmt.step = (yl->planes == 2) ? 2 : 1;
+	KOLIBA_YccFormat(&yj.fmt, kolibaRecs[k].rec, full);
+	if (!PySequence_Check(src) || (PySequence_Size(src) != yl->planes)) {
+		PyErr_Format(PyExc_TypeError, "The source must be a sequence of %d planes", yl->planes);
+		return NULL;
+	}
+	if ((dst != Py_None) && (!PySequence_Check(dst) || (PySequence_Size(dst) != yl->planes))) {
+		PyErr_Format(PyExc_TypeError, "The destination must be a sequence of %d planes", yl->planes);
+		return NULL;
+	}
+
+	// The luma of the source says how big the frame is.
+	if ((item = PySequence_GetItem(src, 0)) == NULL) return NULL;
+	k = PyObject_GetBuffer(item, &iv[0], PyBUF_STRIDED_RO);
+	Py_DECREF(item);
+	if (k < 0) return NULL;
+	ni = 1;
+	if (koliba_PlaneInit(&iv[0], yl->size, &yj.i.plane[0], &yj.i.stride[0], &w, &h, "source") < 0) goto done;
+	cw = ((w + (1 << yl->hsub) - 1) >> yl->hsub) * yj.fmt.step;
+	ch = (h + (1 << yl->vsub) - 1) >> yl->vsub;
+	for (; ni < yl->planes; ni++) {
+		if ((item = PySequence_GetItem(src, ni)) == NULL) goto done;
+		k = PyObject_GetBuffer(item, &iv[ni], PyBUF_STRIDED_RO);
+		Py_DECREF(item);
+		if (k < 0) goto done;
+		if (koliba_YccPlaneInit(&iv[ni], yl->size, &yj.i.plane[ni], &yj.i.stride[ni], cw, ch, "source") < 0) {
+			ni++;
+			goto done;
+		}
+	}
+
+	if (dst == Py_None) {
+		if ((result = PyTuple_New(yl->planes)) == NULL) goto done;
+		for (k = 0; k < yl->planes; k++) {
+			if ((item = PyByteArray_FromStringAndSize(NULL, ((k == 0) ? w * h : cw * ch) * yl->size)) == NULL) goto done;
+			PyTuple_SET_ITEM(result, k, item);
+		}
+		dst = result;
+	}
+	else {
+		Py_INCREF(dst);
+		result = dst;
+	}
+	for (; no < yl->planes; no++) {
+		if ((item = PySequence_GetItem(dst, no)) == NULL) goto done;
+		k = PyObject_GetBuffer(item, &ov[no], PyBUF_STRIDED);
+		Py_DECREF(item);
+		if (k < 0) goto done;
+		e = (no == 0)
+			? koliba_YccPlaneInit(&ov[no], yl->size, &yj.o.plane[no], &yj.o.stride[no], w, h, "destination")
+			: koliba_YccPlaneInit(&ov[no], yl->size, &yj.o.plane[no], &yj.o.stride[no], cw, ch, "destination");
+		if (e < 0) {
+			no++;
+			goto done;
+		}
+	}
+	// Interleaved Cb and Cr are two planes a sample apart.
+	if (yl->planes == 2) {
+		yj.i.plane[2] = (char *)yj.i.plane[1] + yl->size;
+		yj.i.stride[2] = yj.i.stride[1];
+		yj.o.plane[2] = (char *)yj.o.plane[1] + yl->size;
+		yj.o.stride[2] = yj.o.stride[1];
+	}
+
+	if ((w > 0) && (h > 0)) {
+		yj.width = w;
+		yj.height = h;
+		yj.cw = cw;
+		yj.planes = yl->planes;
+		yj.fLut = f;
+		yj.flags = flags;
+		yj.lat = lat;
+		yj.kind = (lat) ? KOLIBA_FLUTGENERAL : KOLIBA_FlutKind(f, flags);
+		if (yj.kind == KOLIBA_FLUTCONSTANT) koliba_YccFillInit(&yj);
+		job.fn = koliba_YccBand;
+		job.arg = &yj;
+		row = w << yl->vsub;
+		koliba_JobBands(&job, &yj.band, w * h, row, koliba_PoolThreads(&st->pool));
+		yj.band = (yj.band + row - 1) / row * (1 << yl->vsub);
+		job.bands = (h + yj.band - 1) / yj.band;
+
+		Py_BEGIN_ALLOW_THREADS
+		koliba_PoolExecute(&st->pool, &job);
+		Py_END_ALLOW_THREADS
+	}
+
+	r = result;
+	result = NULL;
+done:
+	while (no > 0) PyBuffer_Release(&ov[--no]);
+	while (ni > 0) PyBuffer_Release(&iv[--ni]);
+	Py_XDECREF(result);
+	return r;
+}
+
+KLBO kolibaFlutApply(klbo(Flut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return koliba_ApplyFlut((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaFlutApplyAsync(klbo(Flut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return koliba_ApplyFlutAsync((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaFlutApplyPlanar(klbo(Flut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return koliba_ApplyPlanar((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+KLBO kolibaFlutApplyYcc(klbo(Flut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return koliba_ApplyYcc((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+// There is no Koliba file for a FLUT, so we pickle it as its doubles and
+// their checksum, without a header, and keep its flags next to them.
+KLBO kolibaFlutReduce(klbo(Flut,self), PyObject *unused) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_FlutGet(self, &fLut, &flags);
+	return Py_BuildValue("O()(Nk)", Py_TYPE(self), koliba_PackDoubles(NULL, (double *)&fLut, 24), (unsigned long)flags);
+}
+
+KLBO kolibaFlutSetState(klbo(Flut,self), PyObject *state) {
+	KOLIBA_FLUT fLut;
+	PyObject *data;
+	unsigned long flags;
+
+	if (!PyArg_ParseTuple(state, "Ok", &data, &flags)) return NULL;
+	if (koliba_UnpackDoubles((double *)&fLut, 24, data, NULL, "FLUT") < 0) return NULL;
+	koliba_FlutPut(self, &fLut, (KOLIBA_FLAGS)flags & KOLIBA_AllFlutFlags);
+	Py_RETURN_NONE;
+}
+
+// The apply methods of the LUT types, which only differ in the LUT they
+// name and the precisions they offer.
+#define	klbapplydoc(lut,prec)	"Apply the " lut " to a buffer of pixels: apply(src, dst=None, format=\"rgba8\", precision=\"double\"), " prec
+#define	klbasyncdoc(lut)	"Apply the " lut " like apply(), but return an asyncio future of the result without waiting for it"
+#define	klbplanardoc(lut,prec)	"Apply the " lut " to the planes of a frame: apply_planar(src, dst=None, format=\"gbrp\", precision=\"double\"), src and dst being sequences of the green, blue, and red planes (as FFmpeg orders them), format \"gbrp\", \"gbrp16\", or \"gbrpf32\", " prec
+#define	klbyccdoc(lut)	"Apply the " lut " to a YCbCr frame: apply_ycc(src, dst=None, format=\"yuv420p\", rec=\"709\", full=False), src and dst being sequences of the Y, Cb, and Cr planes (or of the Y and the interleaved CbCr planes for nv12 and p010), format \"yuv420p\", \"yuv422p\", \"yuv444p\", \"nv12\", or \"p010\", rec \"601\", \"709\", or \"2020\", full true for full-range samples rather than video range"
+#define	KLBAPPLYPRECISION	"precision may be \"double\", \"single\" (float formats), or \"fixed\" (8-bit and 24-bit formats)"
+#define	KLBPLANARPRECISION	"precision \"double\", \"single\" (gbrpf32), or \"fixed\" (gbrp)"
+#define	KLBCUBEPRECISION	"cubes only have double precision"
+
+static PyMethodDef kolibaFlutMethods[] = {
+	{"apply", (PyCFunction)kolibaFlutApply, METH_VARARGS | METH_KEYWORDS, klbapplydoc("FLUT", KLBAPPLYPRECISION)},
+	{"apply_async", (PyCFunction)kolibaFlutApplyAsync, METH_VARARGS | METH_KEYWORDS, klbasyncdoc("FLUT")},
+	{"apply_planar", (PyCFunction)kolibaFlutApplyPlanar, METH_VARARGS | METH_KEYWORDS, klbplanardoc("FLUT", KLBPLANARPRECISION)},
+	{"apply_ycc", (PyCFunction)kolibaFlutApplyYcc, METH_VARARGS | METH_KEYWORDS, klbyccdoc("FLUT")},
+	{"__reduce__", (PyCFunction)kolibaFlutReduce, METH_NOARGS, "Return the state of the FLUT for pickling"},
+	{"__setstate__", (PyCFunction)kolibaFlutSetState, METH_O, "Restore the FLUT from its pickled state"},
+	{NULL}
+};
+
+klbgetset(Flut) = {
+	{"flut", (getter)kolibaFlutGetFlut, (setter)kolibaFlutSetFlut, "the 24 FLUT factors (setting them also resets the flags)", NULL},
+	{"flags", (getter)kolibaFlutGetFlags, (setter)kolibaFlutSetFlags, "the FLUT flags", NULL},
+	{"single_error", (getter)kolibaFlutGetSingleError, NULL, "the most apply(precision=\"single\") may differ from apply() for pixels within [0, 1]", NULL},
+	{"fixed_error", (getter)kolibaFlutGetFixedError, NULL, "the most apply(precision=\"fixed\") may differ from apply() before rounding, in 8-bit steps (fixed point is only used while it is below 1)", NULL},
+	{NULL}
+};
+
+static PyType_Slot kolibaFlutSlots[] = {
+	{Py_tp_doc, "FLUT objects"},
+	{Py_tp_new, kolibaFlutNew},
+	{Py_tp_init, kolibaFlutInit},
+	{Py_tp_dealloc, kolibaFlutDealloc},
+	{Py_tp_methods, kolibaFlutMethods},
+	{Py_tp_getset, kolibaFlutGetSet},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaFlutSpec = {
+	.name = "koliba.Flut",
+	.basicsize = sizeof(kolibaFlutObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaFlutSlots,
+};
+
+// Convert the SLUT to a FLUT if it has changed since the last time, and
+// take a copy of the FLUT (unless fLut is NULL) and of its flags.
+static void koliba_SlutFlut(klbo(Slut,self), KOLIBA_FLUT *fLut, KOLIBA_FLAGS *flags) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	if (self->dirty) {
+		KOLIBA_ConvertSlutToFlut(&self->fLut, &self->v);
+		self->flags = KOLIBA_FlutFlags(&self->fLut);
+		// Rounding may leave the FLUT of a 1D SLUT with tiny factors
+		// off the diagonal, which would cost us the 1D kernels. The
+		// same goes for the secondary farba of a matrix SLUT.
+		if (KOLIBA_VerticesIs1D(&self->v)) self->flags &= KOLIBA_1DFlutFlags;
+		else if (KOLIBA_VerticesIsMatrix(&self->v)) self->flags &= KOLIBA_MatrixFlutFlags;
+		self->dirty = false;
+	}
+	if (fLut) memcpy(fLut, &self->fLut, sizeof(KOLIBA_FLUT));
+	*flags = self->flags;
+	Py_END_CRITICAL_SECTION();
+}
+
+// Take a copy of the SLUT.
+static void koliba_SlutGet(klbo(Slut,self), KOLIBA_SLUT *sLut) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(sLut, &self->sLut, sizeof(KOLIBA_SLUT));
+	Py_END_CRITICAL_SECTION();
+}
+
+static void koliba_SlutPut(klbo(Slut,self), const KOLIBA_SLUT *sLut) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(&self->sLut, sLut, sizeof(KOLIBA_SLUT));
+	self->dirty = true;
+	Py_END_CRITICAL_SECTION();
+}
+
+klbdealloc(Slut) {
+	PyTypeObject *type = Py_TYPE(self);
+	type->tp_free((PyObject *)self);
+	Py_DECREF(type);
+}
+
+klbnew(Slut) {
+	kolibaSlutObject *self;
+	self = (kolibaSlutObject *) type->tp_alloc(type, 0);
+	if (self != NULL) {
+		memcpy(&self->sLut, &KOLIBA_IdentitySlut, sizeof(KOLIBA_SLUT));
+		KOLIBA_SlutToVertices(&self->v, &self->sLut);
+		self->dirty = true;
+	}
+	return (PyObject *)self;
+}
+
+klbinit(Slut) {
+	static char *kwlist[] = {"slut", NULL};
+	PyObject *slut = NULL;
+	KOLIBA_SLUT sLut;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &slut))
+		return -1;
+	if (slut == NULL) return 0;
+	if (PyObject_TypeCheck(slut, Py_TYPE(self)))
+		koliba_SlutGet((kolibaSlutObject *)slut, &sLut);
+	else if (koliba_DoublesFromSequence((double *)&sLut, slut, 24, "The SLUT") < 0)
+		return -1;
+	koliba_SlutPut(self, &sLut);
+	return 0;
+}
+
+KLBO kolibaSlutGetSlut(klbo(Slut,self), void *closure) {
+	KOLIBA_SLUT sLut;
+
+	koliba_SlutGet(self, &sLut);
+	return koliba_DoublesToTuple((double *)&sLut, 24);
+}
+
+static int kolibaSlutSetSlut(klbo(Slut,self), PyObject *value, void *closure) {
+	KOLIBA_SLUT sLut;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the SLUT");
+		return -1;
+	}
+	if (koliba_DoublesFromSequence((double *)&sLut, value, 24, "The SLUT") < 0)
+		return -1;
+	koliba_SlutPut(self, &sLut);
+	return 0;
+}
+
+// The closure is the index of the vertex in the VERTICES.
+KLBO kolibaSlutGetVertex(klbo(Slut,self), void *closure) {
+	KOLIBA_VERTEX vertex;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(&vertex, ((KOLIBA_VERTEX **)&self->v)[(intptr_t)closure], sizeof(KOLIBA_VERTEX));
+	Py_END_CRITICAL_SECTION();
+	return koliba_DoublesToTuple((double *)&vertex, 3);
+}
+
+static int kolibaSlutSetVertex(klbo(Slut,self), PyObject *value, void *closure) {
+	KOLIBA_VERTEX vertex;
+
+	if (value == NULL) {
+		PyErr_Format(PyExc_TypeError, "Cannot delete the %s vertex", ksv[(intptr_t)closure]);
+		return -1;
+	}
+	if (koliba_DoublesFromSequence((double *)&vertex, value, 3, "The vertex") < 0)
+		return -1;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(((KOLIBA_VERTEX **)&self->v)[(intptr_t)closure], &vertex, sizeof(KOLIBA_VERTEX));
+	self->dirty = true;
+	Py_END_CRITICAL_SECTION();
+	return 0;
+}
+
+KLBO kolibaSlutGetFlut(klbo(Slut,self), void *closure) {
+	kolibaFlutObject *f;
+	kolibaState *st;
+
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	// Nobody else has the new FLUT yet, so no need to lock it.
+	if ((f = (kolibaFlutObject *)kolibaFlutNew(st->FlutType, NULL, NULL)) != NULL)
+		koliba_SlutFlut(self, &f->fLut, &f->flags);
+	return (PyObject *)f;
+}
+
+KLBO kolibaSlutGetFlags(klbo(Slut,self), void *closure) {
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, NULL, &flags);
+	return PyLong_FromUnsignedLong((unsigned long)flags);
+}
+
+KLBO kolibaSlutGetSingleError(klbo(Slut,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	return PyFloat_FromDouble(KOLIBA_Flut32ErrorBound(&fLut, flags));
+}
+
+KLBO kolibaSlutGetFixedError(klbo(Slut,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	KOLIBA_ScaleFlut(&fLut, &fLut, 255.0);
+	return PyFloat_FromDouble(KOLIBA_FixedFlutErrorBound(&fLut, flags));
+}
+
+KLBO kolibaSlutApply(klbo(Slut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	return koliba_ApplyFlut((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaSlutApplyAsync(klbo(Slut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	return koliba_ApplyFlutAsync((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaSlutApplyPlanar(klbo(Slut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	return koliba_ApplyPlanar((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+KLBO kolibaSlutApplyYcc(klbo(Slut,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_SlutFlut(self, &fLut, &flags);
+	return koliba_ApplyYcc((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+// A pickled SLUT is the contents of a .sLut file.
+KLBO kolibaSlutReduce(klbo(Slut,self), PyObject *unused) {
+	KOLIBA_SLUT sLut;
+
+	koliba_SlutGet(self, &sLut);
+	return Py_BuildValue("O()N", Py_TYPE(self), koliba_PackDoubles(KOLIBA_sLutHeader, (double *)&sLut, 24));
+}
+
+KLBO kolibaSlutSetState(klbo(Slut,self), PyObject *state) {
+	KOLIBA_SLUT sLut;
+
+	if (koliba_UnpackDoubles((double *)&sLut, 24, state, KOLIBA_sLutHeader, "SLUT") < 0) return NULL;
+	koliba_SlutPut(self, &sLut);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaSlutMethods[] = {
+	{"apply", (PyCFunction)kolibaSlutApply, METH_VARARGS | METH_KEYWORDS, klbapplydoc("SLUT", KLBAPPLYPRECISION)},
+	{"apply_async", (PyCFunction)kolibaSlutApplyAsync, METH_VARARGS | METH_KEYWORDS, klbasyncdoc("SLUT")},
+	{"apply_planar", (PyCFunction)kolibaSlutApplyPlanar, METH_VARARGS | METH_KEYWORDS, klbplanardoc("SLUT", KLBPLANARPRECISION)},
+	{"apply_ycc", (PyCFunction)kolibaSlutApplyYcc, METH_VARARGS | METH_KEYWORDS, klbyccdoc("SLUT")},
+	{"__reduce__", (PyCFunction)kolibaSlutReduce, METH_NOARGS, "Return the state of the SLUT for pickling"},
+	{"__setstate__", (PyCFunction)kolibaSlutSetState, METH_O, "Restore the SLUT from its pickled state"},
+	{NULL}
+};
+
+#define	klbvertex(n,i)	{n, (getter)kolibaSlutGetVertex, (setter)kolibaSlutSetVertex, "the vertex as (r, g, b)", (void *)(intptr_t)i}
+
+klbgetset(Slut) = {
+	{"slut", (getter)kolibaSlutGetSlut, (setter)kolibaSlutSetSlut, "the 24 SLUT values", NULL},
+	klbvertex("black", 0),
+	klbvertex("blue", 1),
+	klbvertex("green", 2),
+	klbvertex("cyan", 3),
+	klbvertex("red", 4),
+	klbvertex("magenta", 5),
+	klbvertex("yellow", 6),
+	klbvertex("white", 7),
+	{"flut", (getter)kolibaSlutGetFlut, NULL, "the SLUT converted to a FLUT", NULL},
+	{"flags", (getter)kolibaSlutGetFlags, NULL, "the flags of the FLUT", NULL},
+	{"single_error", (getter)kolibaSlutGetSingleError, NULL, "the most apply(precision=\"single\") may differ from apply() for pixels within [0, 1]", NULL},
+	{"fixed_error", (getter)kolibaSlutGetFixedError, NULL, "the most apply(precision=\"fixed\") may differ from apply() before rounding, in 8-bit steps (fixed point is only used while it is below 1)", NULL},
+	{NULL}
+};
+
+static PyType_Slot kolibaSlutSlots[] = {
+	{Py_tp_doc, "SLUT objects"},
+	{Py_tp_new, kolibaSlutNew},
+	{Py_tp_init, kolibaSlutInit},
+	{Py_tp_dealloc, kolibaSlutDealloc},
+	{Py_tp_methods, kolibaSlutMethods},
+	{Py_tp_getset, kolibaSlutGetSet},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaSlutSpec = {
+	.name = "koliba.Slut",
+	.basicsize = sizeof(kolibaSlutObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaSlutSlots,
+};
+
+// Matrix objects are a 3x4 matrix, its rows being the red, green and blue
+// outputs as (r, g, b, o), i.e., the factors of the red, green and blue
+// inputs and the offset. They are applied as a FLUT, but only with the
+// matrix flags (or with the 3x3 ones if the offsets are zero), so they
+// always get the matrix kernels.
+
+// Take a copy of the matrix.
+static void koliba_MatrixGet(klbo(Matrix,self), KOLIBA_MATRIX *mat) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(mat, &self->m, sizeof(KOLIBA_MATRIX));
+	Py_END_CRITICAL_SECTION();
+}
+
+static void koliba_MatrixPut(klbo(Matrix,self), const KOLIBA_MATRIX *mat) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	memcpy(&self->m, mat, sizeof(KOLIBA_MATRIX));
+	Py_END_CRITICAL_SECTION();
+}
+
+// Convert a copy of the matrix to a FLUT and its flags.
+static void koliba_MatrixFlut(klbo(Matrix,self), KOLIBA_FLUT *fLut, KOLIBA_FLAGS *flags) {
+	KOLIBA_MATRIX mat;
+
+	koliba_MatrixGet(self, &mat);
+	KOLIBA_ConvertMatrixToFlut(fLut, &mat);
+	*flags = (KOLIBA_MatrixIs3x3(&mat)) ? KOLIBA_GrayFlutFlags : KOLIBA_MatrixFlutFlags;
+}
+
+klbdealloc(Matrix) {
+	PyTypeObject *type = Py_TYPE(self);
+	type->tp_free((PyObject *)self);
+	Py_DECREF(type);
+}
+
+klbnew(Matrix) {
+	kolibaMatrixObject *self;
+	self = (kolibaMatrixObject *) type->tp_alloc(type, 0);
+	if (self != NULL) KOLIBA_ResetMatrix(&self->m);
+	return (PyObject *)self;
+}
+
+klbinit(Matrix) {
+	static char *kwlist[] = {"matrix", NULL};
+	PyObject *matrix = NULL;
+	KOLIBA_MATRIX mat;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &matrix))
+		return -1;
+	if (matrix == NULL) return 0;
+	if (PyObject_TypeCheck(matrix, Py_TYPE(self)))
+		koliba_MatrixGet((kolibaMatrixObject *)matrix, &mat);
+	else if (koliba_DoublesFromSequence((double *)&mat, matrix, 12, "The matrix") < 0)
+		return -1;
+	koliba_MatrixPut(self, &mat);
+	return 0;
+}
+
+KLBO kolibaMatrixGetMatrix(klbo(Matrix,self), void *closure) {
+	KOLIBA_MATRIX mat;
+
+	koliba_MatrixGet(self, &mat);
+	return koliba_DoublesToTuple((double *)&mat, 12);
+}
+
+static int kolibaMatrixSetMatrix(klbo(Matrix,self), PyObject *value, void *closure) {
+	KOLIBA_MATRIX mat;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the matrix");
+		return -1;
+	}
+	if (koliba_DoublesFromSequence((double *)&mat, value, 12, "The matrix") < 0)
+		return -1;
+	koliba_MatrixPut(self, &mat);
+	return 0;
+}
+
+KLBO kolibaMatrixGetIs3x3(klbo(Matrix,self), void *closure) {
+	KOLIBA_MATRIX mat;
+
+	koliba_MatrixGet(self, &mat);
+	return PyBool_FromLong(KOLIBA_MatrixIs3x3(&mat));
+}
+
+KLBO kolibaMatrixGetFlut(klbo(Matrix,self), void *closure) {
+	kolibaFlutObject *f;
+	kolibaState *st;
+
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	if ((f = (kolibaFlutObject *)kolibaFlutNew(st->FlutType, NULL, NULL)) != NULL)
+		koliba_MatrixFlut(self, &f->fLut, &f->flags);
+	return (PyObject *)f;
+}
+
+KLBO kolibaMatrixGetSingleError(klbo(Matrix,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	return PyFloat_FromDouble(KOLIBA_Flut32ErrorBound(&fLut, flags));
+}
+
+KLBO kolibaMatrixGetFixedError(klbo(Matrix,self), void *closure) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	KOLIBA_ScaleFlut(&fLut, &fLut, 255.0);
+	return PyFloat_FromDouble(KOLIBA_FixedFlutErrorBound(&fLut, flags));
+}
+
+KLBO kolibaMatrixApply(klbo(Matrix,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	return koliba_ApplyFlut((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaMatrixApplyAsync(klbo(Matrix,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	return koliba_ApplyFlutAsync((PyObject *)self, &fLut, flags, args, kwds);
+}
+
+KLBO kolibaMatrixApplyPlanar(klbo(Matrix,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	return koliba_ApplyPlanar((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+KLBO kolibaMatrixApplyYcc(klbo(Matrix,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+
+	koliba_MatrixFlut(self, &fLut, &flags);
+	return koliba_ApplyYcc((PyObject *)self, &fLut, flags, NULL, args, kwds);
+}
+
+KLBO kolibaMatrixReduce(klbo(Matrix,self), PyObject *unused) {
+	KOLIBA_MATRIX mat;
+
+	koliba_MatrixGet(self, &mat);
+	return Py_BuildValue("O()N", Py_TYPE(self), koliba_PackDoubles(KOLIBA_m3x4Header, (double *)&mat, 12));
+}
+
+KLBO kolibaMatrixSetState(klbo(Matrix,self), PyObject *state) {
+	KOLIBA_MATRIX mat;
+
+	if (koliba_UnpackDoubles((double *)&mat, 12, state, KOLIBA_m3x4Header, "matrix") < 0) return NULL;
+	koliba_MatrixPut(self, &mat);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaMatrixMethods[] = {
+	{"apply", (PyCFunction)kolibaMatrixApply, METH_VARARGS | METH_KEYWORDS, klbapplydoc("matrix", KLBAPPLYPRECISION)},
+	{"apply_async", (PyCFunction)kolibaMatrixApplyAsync, METH_VARARGS | METH_KEYWORDS, klbasyncdoc("matrix")},
+	{"apply_planar", (PyCFunction)kolibaMatrixApplyPlanar, METH_VARARGS | METH_KEYWORDS, klbplanardoc("matrix", KLBPLANARPRECISION)},
+	{"apply_ycc", (PyCFunction)kolibaMatrixApplyYcc, METH_VARARGS | METH_KEYWORDS, klbyccdoc("matrix")},
+	{"__reduce__", (PyCFunction)kolibaMatrixReduce, METH_NOARGS, "Return the state of the matrix for pickling"},
+	{"__setstate__", (PyCFunction)kolibaMatrixSetState, METH_O, "Restore the matrix from its pickled state"},
+	{NULL}
+};
+
+klbgetset(Matrix) = {
+	{"matrix", (getter)kolibaMatrixGetMatrix, (setter)kolibaMatrixSetMatrix, "the 12 matrix values, row by row as (r, g, b, o)", NULL},
+	{"is3x3", (getter)kolibaMatrixGetIs3x3, NULL, "True if all offsets are zero", NULL},
+	{"flut", (getter)kolibaMatrixGetFlut, NULL, "the matrix converted to a FLUT", NULL},
+	{"single_error", (getter)kolibaMatrixGetSingleError, NULL, "the most apply(precision=\"single\") may differ from apply() for pixels within [0, 1]", NULL},
+	{"fixed_error", (getter)kolibaMatrixGetFixedError, NULL, "the most apply(precision=\"fixed\") may differ from apply() before rounding, in 8-bit steps (fixed point is only used while it is below 1)", NULL},
+	{NULL}
+};
+
+static PyType_Slot kolibaMatrixSlots[] = {
+	{Py_tp_doc, "3x4 matrix objects"},
+	{Py_tp_new, kolibaMatrixNew},
+	{Py_tp_init, kolibaMatrixInit},
+	{Py_tp_dealloc, kolibaMatrixDealloc},
+	{Py_tp_methods, kolibaMatrixMethods},
+	{Py_tp_getset, kolibaMatrixGetSet},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaMatrixSpec = {
+	.name = "koliba.Matrix",
+	.basicsize = sizeof(kolibaMatrixObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaMatrixSlots,
+};
+
+// Cube objects are large LUTs, a lattice of size^3 vertices as found in
+// .cube files, applied either tri-linearly or tetrahedrally. They can be
+// made from any of the other LUTs, by sampling it at each vertex, or from
+// a buffer of 3 * size^3 doubles or floats, red changing fastest.
+
+#define	KOLIBA_CUBESIZE	33
+
+static const char * const kolibaInterpolationNames[KLI_COUNT] = {"trilinear", "tetrahedral"};
+
+static int koliba_Interpolation(KOLIBA_INTERPOLATION *mode, const char *name) {
+	unsigned int i;
+
+	for (i = 0; i < KLI_COUNT; i++)
+		if (strcmp(name, kolibaInterpolationNames[i]) == 0) {
+			*mode = (KOLIBA_INTERPOLATION)i;
+			return 0;
+		}
+	PyErr_Format(PyExc_ValueError, "Unknown interpolation \"%s\", expected \"trilinear\" or \"tetrahedral\"", name);
+	return -1;
+}
+
+// Vertices in a cube of dim cells per axis.
+#define	klbvertices(dim)	((size_t)((dim) + 1) * ((dim) + 1) * ((dim) + 1))
+
+// Make the lattice of a cube, and take a reference to the bytes it points
+// into.
+static PyObject * koliba_CubeGet(klbo(Cube,self), KOLIBA_LATTICE *lat) {
+	PyObject *data;
+	unsigned int dim[3];
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	data = self->data;
+	Py_INCREF(data);
+	dim[0] = dim[1] = dim[2] = self->dim;
+	KOLIBA_ConvertCubeToLattice(lat, (const KOLIBA_RGB *)PyBytes_AS_STRING(data), dim, self->mode);
+	Py_END_CRITICAL_SECTION();
+	return data;
+}
+
+// Steals the reference to data.
+static void koliba_CubePut(klbo(Cube,self), PyObject *data, unsigned int dim) {
+	PyObject *old;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	old = self->data;
+	self->data = data;
+	self->dim = dim;
+	Py_END_CRITICAL_SECTION();
+	Py_XDECREF(old);
+}
+
+// Sample a LUT at each vertex of a cube of dim cells per axis.
+static PyObject * koliba_CubeSample(kolibaState *st, PyObject *lut, unsigned int dim) {
+	PyObject *data;
+	KOLIBA_RGB *cube;
+	KOLIBA_FLUT fLut;
+	KOLIBA_FLAGS flags;
+	KOLIBA_LATTICE lat;
+	PyObject *src;
+	size_t n = klbvertices(dim);
+
+	if ((data = PyBytes_FromStringAndSize(NULL, n * sizeof(KOLIBA_RGB))) == NULL) return NULL;
+	cube = (KOLIBA_RGB *)PyBytes_AS_STRING(data);
+	KOLIBA_MakeIdentityCube(cube, dim, dim, dim);
+	if (lut == Py_None) return data;
+	if (PyObject_TypeCheck(lut, st->CubeType)) {
+		src = koliba_CubeGet((kolibaCubeObject *)lut, &lat);
+		KOLIBA_ApplyLatticeArray((KOLIBA_XYZ *)cube, (const KOLIBA_XYZ *)cube, n, &lat);
+		Py_DECREF(src);
+		return data;
+	}
+	if (PyObject_TypeCheck(lut, st->FlutType))
+		koliba_FlutGet((kolibaFlutObject *)lut, &fLut, &flags);
+	else if (PyObject_TypeCheck(lut, st->SlutType))
+		koliba_SlutFlut((kolibaSlutObject *)lut, &fLut, &flags);
+	else if (PyObject_TypeCheck(lut, st->MatrixType))
+		koliba_MatrixFlut((kolibaMatrixObject *)lut, &fLut, &flags);
+	else {
+		Py_DECREF(data);
+		PyErr_Format(PyExc_TypeError, "Cannot make a cube of a %s", Py_TYPE(lut)->tp_name);
+		return NULL;
+	}
+	KOLIBA_ApplyXyzArray((KOLIBA_XYZ *)cube, (const KOLIBA_XYZ *)cube, n, &fLut, flags);
+	return data;
+}
+
+klbdealloc(Cube) {
+	PyTypeObject *type = Py_TYPE(self);
+	Py_XDECREF(self->data);
+	type->tp_free((PyObject *)self);
+	Py_DECREF(type);
+}
+
+// Until __init__ says otherwise, a cube is the identity of a single cell.
+klbnew(Cube) {
+	kolibaCubeObject *self;
+	self = (kolibaCubeObject *) type->tp_alloc(type, 0);
+	if (self != NULL) {
+		self->dim = 1;
+		self->mode = KLI_tetrahedral;
+		if ((self->data = PyBytes_FromStringAndSize(NULL, klbvertices(1) * sizeof(KOLIBA_RGB))) == NULL) {
+			Py_DECREF(self);
+			return NULL;
+		}
+		KOLIBA_MakeIdentityCube((KOLIBA_RGB *)PyBytes_AS_STRING(self->data), 1, 1, 1);
+	}
+	return (PyObject *)self;
+}
+
+klbinit(Cube) {
+	static char *kwlist[] = {"lut", "size", "interpolation", NULL};
+	PyObject *lut = Py_None, *data = NULL;
+	int size = KOLIBA_CUBESIZE;
+	const char *interpolation = kolibaInterpolationNames[KLI_tetrahedral];
+	KOLIBA_INTERPOLATION mode;
+	kolibaDoubles d;
+	kolibaState *st;
+	double *v;
+	Py_ssize_t i, n;
+	int r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Ois", kwlist, &lut, &size, &interpolation))
+		return -1;
+	if ((size < 2) || (size > 257)) {
+		PyErr_SetString(PyExc_ValueError, "The size of a cube must be within [2, 257]");
+		return -1;
+	}
+	if (koliba_Interpolation(&mode, interpolation) < 0) return -1;
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return -1;
+	n = 3 * (Py_ssize_t)klbvertices(size - 1);
+	if ((r = koliba_GetDoubles(&d, lut, false)) < 0) return -1;
+	if (r == 0) {
+		if ((data = koliba_CubeSample(st, lut, size - 1)) == NULL) return -1;
+	}
+	else {
+		if (d.n != n)
+			PyErr_Format(PyExc_ValueError, "A cube of size %d needs %zd numbers, not %zd", size, n, d.n);
+		else if ((data = PyBytes_FromStringAndSize(NULL, n * sizeof(double))) != NULL) {
+			v = (double *)PyBytes_AS_STRING(data);
+			for (i = 0; i < n; i++)
+				v[i] = klbgetd(&d, i);
+		}
+		PyBuffer_Release(&d.view);
+		if (data == NULL) return -1;
+	}
+	koliba_CubePut(self, data, size - 1);
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->mode = mode;
+	Py_END_CRITICAL_SECTION();
+	return 0;
+}
+
+KLBO kolibaCubeGetSize(klbo(Cube,self), void *closure) {
+	unsigned int dim;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	dim = self->dim;
+	Py_END_CRITICAL_SECTION();
+	return PyLong_FromUnsignedLong(dim + 1);
+}
+
+KLBO kolibaCubeGetCube(klbo(Cube,self), void *closure) {
+	KOLIBA_LATTICE lat;
+
+	return koliba_DoublesView(koliba_CubeGet(self, &lat));
+}
+
+KLBO kolibaCubeGetInterpolation(klbo(Cube,self), void *closure) {
+	KOLIBA_INTERPOLATION mode;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	mode = self->mode;
+	Py_END_CRITICAL_SECTION();
+	return PyUnicode_FromString(kolibaInterpolationNames[mode]);
+}
+
+static int kolibaCubeSetInterpolation(klbo(Cube,self), PyObject *value, void *closure) {
+	KOLIBA_INTERPOLATION mode;
+	const char *name;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the interpolation");
+		return -1;
+	}
+	if (((name = PyUnicode_AsUTF8(value)) == NULL) || (koliba_Interpolation(&mode, name) < 0))
+		return -1;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->mode = mode;
+	Py_END_CRITICAL_SECTION();
+	return 0;
+}
+
+KLBO kolibaCubeApply(klbo(Cube,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_LATTICE lat;
+	PyObject *data = koliba_CubeGet(self, &lat), *r;
+
+	r = koliba_ApplyLattice((PyObject *)self, &lat, data, args, kwds);
+	Py_DECREF(data);
+	return r;
+}
+
+KLBO kolibaCubeApplyAsync(klbo(Cube,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_LATTICE lat;
+	PyObject *data = koliba_CubeGet(self, &lat), *r;
+
+	r = koliba_ApplyLatticeAsync((PyObject *)self, &lat, data, args, kwds);
+	Py_DECREF(data);
+	return r;
+}
+
+KLBO kolibaCubeApplyPlanar(klbo(Cube,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_LATTICE lat;
+	PyObject *data = koliba_CubeGet(self, &lat), *r;
+
+	r = koliba_ApplyPlanar((PyObject *)self, NULL, 0, &lat, args, kwds);
+	Py_DECREF(data);
+	return r;
+}
+
+KLBO kolibaCubeApplyYcc(klbo(Cube,self), PyObject *args, PyObject *kwds) {
+	KOLIBA_LATTICE lat;
+	PyObject *data = koliba_CubeGet(self, &lat), *r;
+
+	r = koliba_ApplyYcc((PyObject *)self, NULL, 0, &lat, args, kwds);
+	Py_DECREF(data);
+	return r;
+}
+
+// A cube pickles as an identity of its size and interpolation, and its
+// doubles. With protocol 5 those are our own immutable bytes, handed to the
+// pickler as they are, in our byte order. Older protocols get them packed as
+// those of the other LUTs.
+KLBO kolibaCubeReduceEx(klbo(Cube,self), PyObject *protocol) {
+	KOLIBA_LATTICE lat;
+	PyObject *data, *r;
+	long p;
+
+	if (((p = PyLong_AsLong(protocol)) == -1) && PyErr_Occurred()) return NULL;
+	data = koliba_CubeGet(self, &lat);
+	if (p >= 5)
+		r = Py_BuildValue("O(OIs)(Ns)", Py_TYPE(self), Py_None, lat.dim[0] + 1, kolibaInterpolationNames[lat.mode],
+			PyPickleBuffer_FromObject(data), KOLIBA_BYTEORDER);
+	else r = Py_BuildValue("O(OIs)N", Py_TYPE(self), Py_None, lat.dim[0] + 1, kolibaInterpolationNames[lat.mode],
+		koliba_PackDoubles(NULL, (const double *)lat.cube, 3 * (unsigned int)klbvertices(lat.dim[0])));
+	Py_DECREF(data);
+	return r;
+}
+
+// The state is either the packed doubles, or a buffer of them and its byte
+// order. Bytes in our own order we can keep just as they are.
+KLBO kolibaCubeSetState(klbo(Cube,self), PyObject *state) {
+	KOLIBA_LATTICE lat;
+	PyObject *data = koliba_CubeGet(self, &lat), *buf;
+	unsigned int dim = lat.dim[0];
+	size_t n = klbvertices(dim);
+	const char *order;
+	Py_buffer view;
+	bool swap;
+
+	Py_DECREF(data);
+	if (PyTuple_Check(state)) {
+		if ((!PyArg_ParseTuple(state, "Os", &buf, &order)) || (koliba_ByteOrder(order, &swap) < 0)) return NULL;
+		if ((!swap) && (PyBytes_CheckExact(buf)) && (PyBytes_GET_SIZE(buf) == (Py_ssize_t)(n * sizeof(KOLIBA_RGB)))) {
+			Py_INCREF(buf);
+			koliba_CubePut(self, buf, dim);
+			Py_RETURN_NONE;
+		}
+		if (PyObject_GetBuffer(buf, &view, PyBUF_SIMPLE) < 0) return NULL;
+		if (view.len != (Py_ssize_t)(n * sizeof(KOLIBA_RGB))) {
+			PyBuffer_Release(&view);
+			PyErr_SetString(PyExc_ValueError, "Not a pickled cube");
+			return NULL;
+		}
+		data = PyBytes_FromStringAndSize((const char *)view.buf, view.len);
+		PyBuffer_Release(&view);
+		if (data == NULL) return NULL;
+		if (swap) koliba_SwapDoubles((double *)PyBytes_AS_STRING(data), 3 * (Py_ssize_t)n);
+	}
+	else {
+		if ((data = PyBytes_FromStringAndSize(NULL, n * sizeof(KOLIBA_RGB))) == NULL) return NULL;
+		if (koliba_UnpackDoubles((double *)PyBytes_AS_STRING(data), 3 * (unsigned int)n, state, NULL, "cube") < 0) {
+			Py_DECREF(data);
+			return NULL;
+		}
+	}
+	koliba_CubePut(self, data, dim);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaCubeMethods[] = {
+	{"apply", (PyCFunction)kolibaCubeApply, METH_VARARGS | METH_KEYWORDS, klbapplydoc("cube", KLBCUBEPRECISION)},
+	{"apply_async", (PyCFunction)kolibaCubeApplyAsync, METH_VARARGS | METH_KEYWORDS, klbasyncdoc("cube")},
+	{"apply_planar", (PyCFunction)kolibaCubeApplyPlanar, METH_VARARGS | METH_KEYWORDS, klbplanardoc("cube", KLBCUBEPRECISION)},
+	{"apply_ycc", (PyCFunction)kolibaCubeApplyYcc, METH_VARARGS | METH_KEYWORDS, klbyccdoc("cube")},
+	{"__reduce_ex__", (PyCFunction)kolibaCubeReduceEx, METH_O, "Return the state of the cube for pickling"},
+	{"__setstate__", (PyCFunction)kolibaCubeSetState, METH_O, "Restore the cube from its pickled state"},
+	{NULL}
+};
+
+klbgetset(Cube) = {
+	{"size", (getter)kolibaCubeGetSize, NULL, "the number of vertices along each axis", NULL},
+	{"cube", (getter)kolibaCubeGetCube, NULL, "a read-only memoryview of the 3 * size^3 doubles of the vertices, red changing fastest", NULL},
+	{"interpolation", (getter)kolibaCubeGetInterpolation, (setter)kolibaCubeSetInterpolation, "\"trilinear\" or \"tetrahedral\" (which reads 4 vertices per pixel instead of 8)", NULL},
+	{NULL}
+};
+
+static PyType_Slot kolibaCubeSlots[] = {
+	{Py_tp_doc, "Cube objects: Cube(lut=None, size=33, interpolation=\"tetrahedral\"), where lut may be any other LUT, a cube, or a buffer of 3 * size^3 doubles or floats"},
+	{Py_tp_new, kolibaCubeNew},
+	{Py_tp_init, kolibaCubeInit},
+	{Py_tp_dealloc, kolibaCubeDealloc},
+	{Py_tp_methods, kolibaCubeMethods},
+	{Py_tp_getset, kolibaCubeGetSet},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaCubeSpec = {
+	.name = "koliba.Cube",
+	.basicsize = sizeof(kolibaCubeObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaCubeSlots,
+};
+
+// AngleArray objects keep any number of angles in one contiguous array of
+// doubles, all in the same units.
+
+// Factors for converting among the units, [from][to].
+static double koliba_AngleFactor(KOLIBA_ANGLEUNITS from, KOLIBA_ANGLEUNITS to) {
+	switch (from) {
+		case KAU_degrees:
+			switch (to) {
+				case KAU_radians: return KOLIBA_PiDiv180;
+				case KAU_turns: return KOLIBA_1Div360;
+				case KAU_pis: return KOLIBA_1Div180;
+				default: return 1.0;
+			}
+		case KAU_radians:
+			switch (to) {
+				case KAU_degrees: return KOLIBA_180DivPi;
+				case KAU_turns: return KOLIBA_1Div2Pi;
+				case KAU_pis: return KOLIBA_1DivPi;
+				default: return 1.0;
+			}
+		case KAU_turns:
+			switch (to) {
+				case KAU_degrees: return KOLIBA_360;
+				case KAU_radians: return KOLIBA_2Pi;
+				case KAU_pis: return KOLIBA_2;
+				default: return 1.0;
+			}
+		case KAU_pis:
+			switch (to) {
+				case KAU_degrees: return KOLIBA_180;
+				case KAU_radians: return KOLIBA_Pi;
+				case KAU_turns: return KOLIBA_1Div2;
+				default: return 1.0;
+			}
+		default:
+			return 1.0;
+	}
+}
+
+// Install a new array of n angles, which we take over (and free). Anyone
+// holding our buffer keeps seeing it, so we can only copy into it then,
+// not replace it.
+static int koliba_AngleArrayInstall(klbo(AngleArray,self), double *a, Py_ssize_t n, KOLIBA_ANGLEUNITS units) {
+	int r = 0;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	if (n == self->n) {
+		if (n) memcpy(self->a, a, n * sizeof(double));
+		self->units = units;
+	}
+	else if (self->exports) r = -1;
+	else {
+		double *t = self->a;
+		self->a = a;
+		self->n = n;
+		self->units = units;
+		a = t;
+	}
+	Py_END_CRITICAL_SECTION();
+	PyMem_Free(a);
+	if (r < 0) PyErr_SetString(PyExc_BufferError, "Cannot resize an AngleArray while its buffer is in use");
+	return r;
+}
+
+// Replace the contents of an AngleArray with whatever obj holds. We read
+// it all into a new array first, since reading a sequence may run Python
+// code that does anything at all to us.
+static int koliba_AngleArrayFill(klbo(AngleArray,self), PyObject *obj, KOLIBA_ANGLEUNITS units) {
+	kolibaDoubles d;
+	PyObject *fast = NULL;
+	double *a;
+	Py_ssize_t i, n;
+	int b;
+
+	if ((b = koliba_GetDoubles(&d, obj, false)) < 0) return -1;
+	if (b) n = d.n;
+	else if ((fast = PySequence_Fast(obj, "The angles must be a buffer or a sequence of numbers")) == NULL)
+		return -1;
+	else n = PySequence_Fast_GET_SIZE(fast);
+
+	if ((a = PyMem_New(double, (n) ? n : 1)) == NULL) {
+		if (b) PyBuffer_Release(&d.view);
+		Py_XDECREF(fast);
+		PyErr_NoMemory();
+		return -1;
+	}
+	if (b) {
+		for (i = 0; i < n; i++)
+			a[i] = klbgetd(&d, i);
+		PyBuffer_Release(&d.view);
+	}
+	else {
+		for (i = 0; i < n; i++) {
+			double v = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+			if ((v == -1.0) && PyErr_Occurred()) {
+				PyMem_Free(a);
+				Py_DECREF(fast);
+				return -1;
+			}
+			a[i] = v;
+		}
+		Py_DECREF(fast);
+	}
+	return koliba_AngleArrayInstall(self, a, n, units);
+}
+
+klbdealloc(AngleArray) {
+	PyTypeObject *type = Py_TYPE(self);
+	PyMem_Free(self->a);
+	type->tp_free((PyObject *)self);
+	Py_DECREF(type);
+}
+
+klbnew(AngleArray) {
+	kolibaAngleArrayObject *self;
+	self = (kolibaAngleArrayObject *) type->tp_alloc(type, 0);
+	if (self != NULL) {
+		self->a = NULL;
+		self->n = 0;
+		self->units = KAU_degrees;
+		self->exports = 0;
+	}
+	return (PyObject *)self;
+}
+
+klbinit(AngleArray) {
+	static char *kwlist[] = {"angles", "units", NULL};
+	PyObject *angles = NULL;
+	unsigned int units = (unsigned int)self->units;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OI", kwlist, &angles, &units))
+		return -1;
+	if (units >= KAU_COUNT) {
+		PyErr_Format(PyExc_ValueError, "Units must be %s, %s, %s, or %s", kau[0], kau[1], kau[2], kau[3]);
+		return -1;
+	}
+	if (angles == NULL) {
+		Py_BEGIN_CRITICAL_SECTION(self);
+		self->units = units;
+		Py_END_CRITICAL_SECTION();
+		return 0;
+	}
+	return koliba_AngleArrayFill(self, angles, units);
+}
+
+// Return a new AngleArray with the same angles in other units.
+static PyObject * koliba_AngleArrayConvert(klbo(AngleArray,self), KOLIBA_ANGLEUNITS units) {
+	kolibaAngleArrayObject *r;
+	double f;
+	Py_ssize_t i;
+
+	if ((r = (kolibaAngleArrayObject *)kolibaAngleArrayNew(Py_TYPE(self), NULL, NULL)) == NULL)
+		return NULL;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	f = koliba_AngleFactor(self->units, units);
+	if ((r->a = PyMem_New(double, (self->n) ? self->n : 1)) != NULL) {
+		r->n = self->n;
+		r->units = units;
+		for (i = 0; i < self->n; i++)
+			r->a[i] = self->a[i] * f;
+	}
+	Py_END_CRITICAL_SECTION();
+	if (r->a == NULL) {
+		Py_DECREF(r);
+		return PyErr_NoMemory();
+	}
+	return (PyObject *)r;
+}
+
+// The closure is the units.
+KLBO kolibaAngleArrayGetUnits(klbo(AngleArray,self), void *closure) {
+	return koliba_AngleArrayConvert(self, (KOLIBA_ANGLEUNITS)(intptr_t)closure);
+}
+
+static int kolibaAngleArraySetUnits(klbo(AngleArray,self), PyObject *value, void *closure) {
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete the angles");
+		return -1;
+	}
+	return koliba_AngleArrayFill(self, value, (KOLIBA_ANGLEUNITS)(intptr_t)closure);
+}
+
+KLBO kolibaAngleArrayGetUnitsTag(klbo(AngleArray,self), void *closure) {
+	KOLIBA_ANGLEUNITS units;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	units = self->units;
+	Py_END_CRITICAL_SECTION();
+	return PyLong_FromLong((long)units);
+}
+
+// Lend out our angles the way we lend out our buffer, so nobody can resize
+// them while we are working on them without the GIL.
+static double * koliba_AngleArrayLend(klbo(AngleArray,self), Py_ssize_t *n, KOLIBA_ANGLEUNITS *units) {
+	double *a;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	a = self->a;
+	*n = self->n;
+	*units = self->units;
+	self->exports++;
+	Py_END_CRITICAL_SECTION();
+	return a;
+}
+
+static void koliba_AngleArrayReturn(klbo(AngleArray,self)) {
+	Py_BEGIN_CRITICAL_SECTION(self);
+	self->exports--;
+	Py_END_CRITICAL_SECTION();
+}
+
+// Apply a function to the angles in radians, into a new array of doubles or
+// into the buffer of doubles or floats passed as out.
+static PyObject * koliba_AngleArrayMath(klbo(AngleArray,self), PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames, const char *fname, double (*fn)(double)) {
+	static const char * const kwlist[] = {"out", NULL};
+	PyObject *out, *r = NULL;
+	kolibaDoubles d;
+	KOLIBA_ANGLEUNITS units;
+	double f, *a;
+	Py_ssize_t i, n;
+
+	if (koliba_FastArgs(fname, args, nargs, kwnames, kwlist, 0, 0, &out) < 0) return NULL;
+	a = koliba_AngleArrayLend(self, &n, &units);
+	f = koliba_AngleFactor(units, KAU_radians);
+
+	if ((out == NULL) || (out == Py_None)) {
+		if ((out = PyByteArray_FromStringAndSize(NULL, n * sizeof(double))) != NULL) {
+			double *o = (double *)PyByteArray_AS_STRING(out);
+			Py_BEGIN_ALLOW_THREADS
+			for (i = 0; i < n; i++)
+				o[i] = fn(a[i] * f);
+			Py_END_ALLOW_THREADS
+			r = koliba_DoublesView(out);
+		}
+	}
+	else if ((i = koliba_GetDoubles(&d, out, true)) <= 0) {
+		if (i == 0) PyErr_SetString(PyExc_TypeError, "The output must be a writable buffer of doubles or floats");
+	}
+	else if (d.n != n) {
+		PyErr_Format(PyExc_ValueError, "The output must hold %zd numbers, not %zd", n, d.n);
+		PyBuffer_Release(&d.view);
+	}
+	else {
+		Py_BEGIN_ALLOW_THREADS
+		if ((!d.single) && (d.step == sizeof(double)))
+			for (i = 0; i < n; i++)
+				((double *)d.p)[i] = fn(a[i] * f);
+		else
+			for (i = 0; i < n; i++)
+				klbsetd(&d, i, fn(a[i] * f));
+		Py_END_ALLOW_THREADS
+		PyBuffer_Release(&d.view);
+		Py_INCREF(out);
+		r = out;
+	}
+	koliba_AngleArrayReturn(self);
+	return r;
+}
+
+KLBO kolibaAngleArraySine(klbo(AngleArray,self), PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+	return koliba_AngleArrayMath(self, args, nargs, kwnames, "sin", sin);
+}
+
+KLBO kolibaAngleArrayCosine(klbo(AngleArray,self), PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+	return koliba_AngleArrayMath(self, args, nargs, kwnames, "cos", cos);
+}
+
+static Py_ssize_t kolibaAngleArrayLength(klbo(AngleArray,self)) {
+	Py_ssize_t n;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	n = self->n;
+	Py_END_CRITICAL_SECTION();
+	return n;
+}
+
+KLBO kolibaAngleArrayItem(klbo(AngleArray,self), Py_ssize_t i) {
+	kolibaAngleObject *a;
+	kolibaState *st;
+	KOLIBA_ANGLE angle;
+	bool ok;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	if ((ok = ((i >= 0) && (i < self->n)))) {
+		angle.angle = self->a[i];
+		angle.units = self->units;
+	}
+	Py_END_CRITICAL_SECTION();
+	if (!ok) {
+		PyErr_SetString(PyExc_IndexError, "AngleArray index out of range");
+		return NULL;
+	}
+	if ((st = koliba_TypeState(Py_TYPE(self))) == NULL) return NULL;
+	if ((a = (kolibaAngleObject *)kolibaAngleNew(st->AngleType, NULL, NULL)) != NULL)
+		a->a = angle;
+	return (PyObject *)a;
+}
+
+static int kolibaAngleArrayGetBuffer(klbo(AngleArray,self), Py_buffer *view, int flags) {
+	static char format[] = "d";
+	static double empty = 0.0;
+	int r;
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	if ((r = PyBuffer_FillInfo(view, (PyObject *)self, (self->a) ? self->a : &empty, self->n * sizeof(double), 0, flags)) == 0) {
+		view->itemsize = sizeof(double);
+		if (flags & PyBUF_FORMAT) view->format = format;
+		if (flags & PyBUF_ND) view->shape = &self->n;
+		if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) view->strides = &view->itemsize;
+		self->exports++;
+	}
+	Py_END_CRITICAL_SECTION();
+	return r;
+}
+
+static void kolibaAngleArrayReleaseBuffer(klbo(AngleArray,self), Py_buffer *view) {
+	koliba_AngleArrayReturn(self);
+}
+
+// With pickle protocol 5 we hand our own buffer to the pickler, so a large
+// array can travel out of band without being copied. Older protocols get a
+// copy of the angles MSB first, as in the Koliba files. Either way the state
+// says which byte order the angles are in.
+
+KLBO kolibaAngleArrayReduceEx(klbo(AngleArray,self), PyObject *protocol) {
+	KOLIBA_ANGLEUNITS units;
+	PyObject *data;
+	double *a;
+	Py_ssize_t i, n;
+	long p;
+
+	if (((p = PyLong_AsLong(protocol)) == -1) && PyErr_Occurred()) return NULL;
+	if (p >= 5) {
+		if ((data = PyPickleBuffer_FromObject((PyObject *)self)) == NULL) return NULL;
+		Py_BEGIN_CRITICAL_SECTION(self);
+		units = self->units;
+		Py_END_CRITICAL_SECTION();
+		return Py_BuildValue("O()(iNs)", Py_TYPE(self), (int)units, data, KOLIBA_BYTEORDER);
+	}
+	a = koliba_AngleArrayLend(self, &n, &units);
+	if ((data = PyBytes_FromStringAndSize(NULL, n * sizeof(double))) != NULL) {
+		if (n) memcpy(PyBytes_AS_STRING(data), a, n * sizeof(double));
+		for (i = 0; i < n; i += UINT_MAX)
+			KOLIBA_NetDoubles((double *)PyBytes_AS_STRING(data) + i, (unsigned int)Py_MIN(n - i, (Py_ssize_t)UINT_MAX));
+	}
+	koliba_AngleArrayReturn(self);
+	return Py_BuildValue("O()(iNs)", Py_TYPE(self), (int)units, data, "big");
+}
+
+KLBO kolibaAngleArraySetState(klbo(AngleArray,self), PyObject *state) {
+	Py_buffer view;
+	unsigned int units;
+	PyObject *data;
+	const char *order;
+	double *a;
+	Py_ssize_t n;
+	bool swap;
+
+	if (!PyArg_ParseTuple(state, "IOs", &units, &data, &order)) return NULL;
+	if (units >= KAU_COUNT) {
+		PyErr_Format(PyExc_ValueError, "Units must be %s, %s, %s, or %s", kau[0], kau[1], kau[2], kau[3]);
+		return NULL;
+	}
+	if (koliba_ByteOrder(order, &swap) < 0) return NULL;
+	if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0) return NULL;
+	if (view.len % sizeof(double)) {
+		PyBuffer_Release(&view);
+		PyErr_SetString(PyExc_ValueError, "Not a pickled AngleArray");
+		return NULL;
+	}
+	n = view.len / sizeof(double);
+	if ((a = PyMem_New(double, (n) ? n : 1)) == NULL) {
+		PyBuffer_Release(&view);
+		return PyErr_NoMemory();
+	}
+	if (n) memcpy(a, view.buf, view.len);
+	PyBuffer_Release(&view);
+	if (swap) koliba_SwapDoubles(a, n);
+	if (koliba_AngleArrayInstall(self, a, n, (KOLIBA_ANGLEUNITS)units) < 0) return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef kolibaAngleArrayMethods[] = {
+	{"sin", (PyCFunction)(void(*)(void))kolibaAngleArraySine, METH_FASTCALL | METH_KEYWORDS, "Return the sines of the angles"},
+	{"cos", (PyCFunction)(void(*)(void))kolibaAngleArrayCosine, METH_FASTCALL | METH_KEYWORDS, "Return the cosines of the angles"},
+	{"__reduce_ex__", (PyCFunction)kolibaAngleArrayReduceEx, METH_O, "Return the state of the array for pickling"},
+	{"__setstate__", (PyCFunction)kolibaAngleArraySetState, METH_O, "Restore the array from its pickled state"},
+	{NULL}
+};
+
+klbgetset(AngleArray) = {
+	{"degrees", (getter)kolibaAngleArrayGetUnits, (setter)kolibaAngleArraySetUnits, "angles in degrees", (void *)(intptr_t)KAU_degrees},
+	{"radians", (getter)kolibaAngleArrayGetUnits, (setter)kolibaAngleArraySetUnits, "angles in radians", (void *)(intptr_t)KAU_radians},
+	{"turns", (getter)kolibaAngleArrayGetUnits, (setter)kolibaAngleArraySetUnits, "angles in turns", (void *)(intptr_t)KAU_turns},
+	{"pis", (getter)kolibaAngleArrayGetUnits, (setter)kolibaAngleArraySetUnits, "angles in pis", (void *)(intptr_t)KAU_pis},
+	{"units", (getter)kolibaAngleArrayGetUnitsTag, NULL, "the units of the angles", NULL},
+	{NULL}
+};
+
+static PyType_Slot kolibaAngleArraySlots[] = {
+	{Py_tp_doc, "Arrays of angles in the same units"},
+	{Py_tp_new, kolibaAngleArrayNew},
+	{Py_tp_init, kolibaAngleArrayInit},
+	{Py_tp_dealloc, kolibaAngleArrayDealloc},
+	{Py_tp_methods, kolibaAngleArrayMethods},
+	{Py_tp_getset, kolibaAngleArrayGetSet},
+	{Py_sq_length, kolibaAngleArrayLength},
+	{Py_sq_item, kolibaAngleArrayItem},
+	{Py_bf_getbuffer, kolibaAngleArrayGetBuffer},
+	{Py_bf_releasebuffer, kolibaAngleArrayReleaseBuffer},
+	{0, NULL}
+};
+
+static PyType_Spec kolibaAngleArraySpec = {
+	.name = "koliba.AngleArray",
+	.basicsize = sizeof(kolibaAngleArrayObject),
+	.itemsize = 0,
+	.flags = KLBTPFLAGS,
+	.slots = kolibaAngleArraySlots,
+};
+
+// The constant multipliers work with a single number, returning a float,
+// or with a whole buffer of doubles or floats, returning a memoryview of
+// doubles (or filling the out buffer, which may be the input buffer).
+//
+// Either way, they calculate a + b * c, where a and b may each be a number
+// or a buffer, and c is a constant.
+
+typedef struct {
+	kolibaDoubles d;
+	double v;
+	bool buf;
+} kolibaOperand;
+
+static int koliba_GetOperand(kolibaOperand *o, PyObject *obj, double dflt) {
+	int b;
+
+	o->buf = false;
+	if (obj == NULL) {
+		o->v = dflt;
+		return 0;
+	}
+	if ((b = koliba_GetDoubles(&o->d, obj, false)) < 0) return -1;
+	if (b) o->buf = true;
+	else if (((o->v = PyFloat_AsDouble(obj)) == -1.0) && PyErr_Occurred()) return -1;
+	return 0;
+}
+
+static void koliba_ReleaseOperand(kolibaOperand *o) {
+	if (o->buf) PyBuffer_Release(&o->d.view);
+}
+
+static PyObject * koliba_MulAdd(kolibaOperand *a, kolibaOperand *b, double c, PyObject *out) {
+	kolibaDoubles d;
+	double *o;
+	Py_ssize_t i, n;
+	bool owned = (out == Py_None);
+	int r;
+
+	if ((!a->buf) && (!b->buf)) {
+		if (out != Py_None) {
+			PyErr_SetString(PyExc_TypeError, "out= can only be used with a buffer input");
+			return NULL;
+		}
+		return PyFloat_FromDouble(a->v + b->v * c);
+	}
+	if ((a->buf) && (b->buf) && (a->d.n != b->d.n)) {
+		PyErr_Format(PyExc_ValueError, "The input buffers hold %zd and %zd numbers", a->d.n, b->d.n);
+		return NULL;
+	}
+	n = (a->buf) ? a->d.n : b->d.n;
+
+	if (out == Py_None) {
+		d.single = false;
+		d.step = sizeof(double);
+		if ((out = PyByteArray_FromStringAndSize(NULL, n * sizeof(double))) == NULL) return NULL;
+		d.p = PyByteArray_AS_STRING(out);
+	}
+	else {
+		if ((r = koliba_GetDoubles(&d, out, true)) <= 0) {
+			if (r == 0) PyErr_SetString(PyExc_TypeError, "out= must be a writable buffer of doubles or floats");
+			return NULL;
+		}
+		if (d.n != n) {
+			PyErr_Format(PyExc_ValueError, "out= must hold %zd numbers, not %zd", n, d.n);
+			PyBuffer_Release(&d.view);
+			return NULL;
+		}
+		Py_INCREF(out);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if ((!a->buf) && (!b->d.single) && (b->d.step == sizeof(double)) && (!d.single) && (d.step == sizeof(double))) {
+		// The common case gets a loop the compiler can vectorize.
+		const double *x = (const double *)b->d.p;
+		double v = a->v;
+		o = (double *)d.p;
+		for (i = 0; i < n; i++)
+			o[i] = v + x[i] * c;
+	}
+	else for (i = 0; i < n; i++)
+		klbsetd(&d, i, ((a->buf) ? klbgetd(&a->d, i) : a->v) + ((b->buf) ? klbgetd(&b->d, i) : b->v) * c);
+	Py_END_ALLOW_THREADS
+
+	if (owned) return koliba_DoublesView(out);
+	PyBuffer_Release(&d.view);
+	return out;
+}
+
+KLBO koliba_Double_const_mul(PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames, const char *fname, double val) {
+	static const char * const kwlist[] = {"", "out", NULL};
+	PyObject *argv[2], *r;
+	kolibaOperand a, b;
+	double d;
+
+	// A single plain number is by far the most common call.
+	if (kwnames == NULL) {
+		if (nargs == 0) return PyFloat_FromDouble(val);
+		if ((nargs == 1) && (PyFloat_CheckExact(args[0]) || PyLong_CheckExact(args[0]))) {
+			if (koliba_Number(args[0], &d) < 0) return NULL;
+			return PyFloat_FromDouble(d*val);
+		}
+	}
+	if (koliba_FastArgs(fname, args, nargs, kwnames, kwlist, 1, 0, argv) < 0) return NULL;
+	a.buf = false;
+	a.v = 0.0;
+	if (koliba_GetOperand(&b, argv[0], 1.0) < 0) return NULL;
+	r = koliba_MulAdd(&a, &b, val, (argv[1] == NULL) ? Py_None : argv[1]);
+	koliba_ReleaseOperand(&b);
+	return r;
+}
+
+KLBO koliba_Pi(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "Pi", KOLIBA_Pi);
+}
+
+KLBO koliba_invPi(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DivPi", KOLIBA_1DivPi);
+}
+
+KLBO koliba_Tau(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "Tau", KOLIBA_2Pi);
+}
+
+KLBO koliba_invTau(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DivTau", KOLIBA_1Div2Pi);
+}
+
+KLBO koliba_Pi2(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "HalfPi", KOLIBA_PiDiv2);
+}
+
+KLBO koliba_invPi2(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DivHalfPi", 1.0/KOLIBA_PiDiv2);
+}
+
+KLBO koliba_Pi180(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DegreesToRadians", KOLIBA_PiDiv180);
+}
+
+KLBO koliba_invPi180(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "RadiansToDegrees", KOLIBA_180DivPi);
+}
+
+KLBO koliba_PDeg(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "PisToDegrees", KOLIBA_180);
+}
+
+KLBO koliba_invPDeg(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DegreesToPis", KOLIBA_1Div180);
+}
+
+KLBO koliba_invTDeg(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "DegreesToTurns", KOLIBA_1Div360);
+}
+
+KLBO koliba_TDeg(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "TurnsToDegrees", KOLIBA_360);
+}
+
+KLBO koliba_Kappa(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "TangentFromRadius", KOLIBA_Kappa);
+}
+
+KLBO koliba_invKappa(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "RadiusFromTangent", KOLIBA_1DivKappa);
+}
+
+KLBO koliba_compKappa(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+		return koliba_Double_const_mul(args, nargs, kwnames, "TangentToRadius", KOLIBA_1MinKappa);
+}
+
+KLBO koliba_absKappa(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+	static const char * const kwlist[] = {"start", "radius", "out", NULL};
+	PyObject *argv[3], *r = NULL;
+	kolibaOperand a, b;
+
+	if ((kwnames == NULL) && (nargs == 2) &&
+		(PyFloat_CheckExact(args[0]) || PyLong_CheckExact(args[0])) &&
+		(PyFloat_CheckExact(args[1]) || PyLong_CheckExact(args[1]))) {
+		if ((koliba_Number(args[0], &a.v) < 0) || (koliba_Number(args[1], &b.v) < 0)) return NULL;
+		return PyFloat_FromDouble(a.v+b.v*KOLIBA_Kappa);
+	}
+	if (koliba_FastArgs("AbsoluteTangent", args, nargs, kwnames, kwlist, 0, 2, argv) < 0) return NULL;
+	if (koliba_GetOperand(&a, argv[0], 0.0) < 0) return NULL;
+	if (koliba_GetOperand(&b, argv[1], 0.0) == 0) {
+		r = koliba_MulAdd(&a, &b, KOLIBA_Kappa, (argv[2] == NULL) ? Py_None : argv[2]);
+		koliba_ReleaseOperand(&b);
+	}
+	koliba_ReleaseOperand(&a);
+	return r;
+}
+
+KLBO koliba_Threads(PyObject *self, PyObject *unused) {
+	return PyLong_FromUnsignedLong(koliba_PoolThreads(&((kolibaState *)PyModule_GetState(self))->pool));
+}
+
+KLBO koliba_SetThreads(PyObject *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist[] = {"threads", NULL};
+	int threads;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &threads)) return NULL;
+	if ((threads < 1) || (threads > 1024)) {
+		PyErr_SetString(PyExc_ValueError, "The number of threads must be between 1 and 1024");
+		return NULL;
+	}
+	if (koliba_PoolResize(&((kolibaState *)PyModule_GetState(self))->pool, (unsigned int)threads) < 0) return NULL;
+	Py_RETURN_NONE;
+}
+
+// The instruction set the pixel kernels use is the same for the whole
+// process, since it depends on the processor.
+KLBO koliba_Simd(PyObject *self, PyObject *unused) {
+	return PyUnicode_FromString(KOLIBA_SpanIsaNames[KOLIBA_GetSpanIsa()]);
+}
+
+KLBO koliba_SetSimd(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+	static const char * const kwlist[] = {"isa", NULL};
+	PyObject *argv[1];
+	KOLIBA_SPANISA isa;
+	const char *name;
+
+	if (koliba_FastArgs("SetSimd", args, nargs, kwnames, kwlist, 0, 0, argv) < 0) return NULL;
+	if ((argv[0] == NULL) || (argv[0] == Py_None)) isa = KOLIBA_BestSpanIsa();
+	else if ((name = PyUnicode_AsUTF8(argv[0])) == NULL) return NULL;
+	else {
+		for (isa = 0; isa < KOLIBA_SPANISAS; isa++)
+			if (strcmp(name, KOLIBA_SpanIsaNames[isa]) == 0) break;
+		if (isa == KOLIBA_SPANISAS) {
+			PyErr_Format(PyExc_ValueError, "Unknown instruction set \"%s\"", name);
+			return NULL;
+		}
+	}
+	if (!KOLIBA_SetSpanIsa(isa)) {
+		PyErr_Format(PyExc_ValueError, "This processor cannot use %s", KOLIBA_SpanIsaNames[isa]);
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef KolibaMethods[] = {
+	{"Pi", (PyCFunction)(void(*)(void))koliba_Pi, METH_FASTCALL | METH_KEYWORDS, "Multiplies a value, or a buffer of values, by pi."},
+	{"DivPi", (PyCFunction)(void(*)(void))koliba_invPi, METH_FASTCALL | METH_KEYWORDS, "Divides a value by pi."},
+	{"Tau", (PyCFunction)(void(*)(void))koliba_Tau, METH_FASTCALL | METH_KEYWORDS, "Multiplies a value by tau (2pi)."},
+	{"DivTau", (PyCFunction)(void(*)(void))koliba_invTau, METH_FASTCALL | METH_KEYWORDS, "Divides a value by tau (2pi)."},
+	{"HalfPi", (PyCFunction)(void(*)(void))koliba_Pi2, METH_FASTCALL | METH_KEYWORDS, "Multiplies a value by pi and divides by 2."},
+	{"DivHalfPi", (PyCFunction)(void(*)(void))koliba_invPi2, METH_FASTCALL | METH_KEYWORDS, "Divides a value by pi and multiplies by 2."},
+	{"DegreesToRadians", (PyCFunction)(void(*)(void))koliba_Pi180, METH_FASTCALL | METH_KEYWORDS, "Converts degrees to radians."},
+	{"RadiansToDegrees", (PyCFunction)(void(*)(void))koliba_invPi180, METH_FASTCALL | METH_KEYWORDS, "Converts radians to degrees."},
+	{"PisToDegrees", (PyCFunction)(void(*)(void))koliba_PDeg, METH_FASTCALL | METH_KEYWORDS, "Converts pis to degrees."},
+	{"DegreesToPis", (PyCFunction)(void(*)(void))koliba_invPDeg, METH_FASTCALL | METH_KEYWORDS, "Converts degrees to pis."},
+	{"DegreesToTurns", (PyCFunction)(void(*)(void))koliba_invTDeg, METH_FASTCALL | METH_KEYWORDS, "Converts turns to degrees."},
+	{"TurnsToDegrees", (PyCFunction)(void(*)(void))koliba_TDeg, METH_FASTCALL | METH_KEYWORDS, "Converts degrees to turns."},
+	{"TangentFromRadius", (PyCFunction)(void(*)(void))koliba_Kappa, METH_FASTCALL | METH_KEYWORDS, "Multiplies by 4(sqrt(2)-1)/3."},
+	{"RadiusFromTangent", (PyCFunction)(void(*)(void))koliba_invKappa, METH_FASTCALL | METH_KEYWORDS, "Multiplies by 3/(4(sqrt(2)-1))."},
+	{"TangentToRadius", (PyCFunction)(void(*)(void))koliba_compKappa, METH_FASTCALL | METH_KEYWORDS, "Multiplies by (1 - 4(sqrt(2)-1)/3)."},
+	{"AbsoluteTangent", (PyCFunction)(void(*)(void))koliba_absKappa, METH_FASTCALL | METH_KEYWORDS, "Returns start + 4 radius (sqrt(2)-1)/3, either of which may be a buffer."},
+	{"Threads", koliba_Threads, METH_NOARGS, "Returns the number of threads used to process pixels."},
+	{"SetThreads", (PyCFunction)koliba_SetThreads, METH_VARARGS | METH_KEYWORDS, "Sets the number of threads used to process pixels."},
+	{"Simd", koliba_Simd, METH_NOARGS, "Returns the instruction set used to process pixels."},
+	{"SetSimd", (PyCFunction)(void(*)(void))koliba_SetSimd, METH_FASTCALL | METH_KEYWORDS, "Sets the instruction set used to process pixels: reference, scalar, sse4.2, avx2, avx512, or None for the best available. The reference calls the library for every pixel, for testing the others against it."},
+	{NULL, NULL, 0, NULL}
+};
+
+// The constants, besides the KAU_ and KQC_ ones, which come from the kau
+// and kqc arrays (and each KQC_ also gives us its angle without the KQC_).
+
+static const struct {
+	const char *name;
+	const double *value;
+} kdc[] = {
+	{"pi", &KOLIBA_Pi},
+	{"invpi", &KOLIBA_1DivPi},
+	{"tau", &KOLIBA_2Pi},
+	{"invtau", &KOLIBA_1Div2Pi},
+	{"rad", &KOLIBA_PiDiv180},
+	{"invrad", &KOLIBA_180DivPi},
+	{"kappa", &KOLIBA_Kappa},
+	{"invkappa", &KOLIBA_1DivKappa},
+	{"compkappa", &KOLIBA_1MinKappa}
+};
+
+static int koliba_AddConst(PyObject *d, const char *name, PyObject *o) {
+	int r;
+
+	if (o == NULL) return -1;
+	r = PyDict_SetItemString(d, name, o);
+	Py_DECREF(o);
+	return r;
+}
+
+static int koliba_AddType(PyObject *m, PyTypeObject **t, PyType_Spec *spec) {
+	if ((*t = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL)) == NULL) return -1;
+	Py_INCREF(*t);
+	if (PyModule_AddObject(m, strchr(spec->name, '.') + 1, (PyObject *)*t) < 0) {
+		Py_DECREF(*t);
+		return -1;
+	}
+	return 0;
+}
+
+static int koliba_Exec(PyObject *m) {
+	kolibaState *st = (kolibaState *)PyModule_GetState(m);
+	PyObject *d, *o;
+	size_t i;
+
+	if (koliba_PoolInit(&st->pool) < 0) return -1;
+	if ((st->queue = koliba_QueueNew()) == NULL) return -1;
+	if ((st->complete = PyCFunction_New(&kolibaComplete, NULL)) == NULL) return -1;
+	if ((koliba_AddType(m, &st->AngleType, &kolibaAngleSpec) < 0)
+	|| (koliba_AddType(m, &st->FlutType, &kolibaFlutSpec) < 0)
+	|| (koliba_AddType(m, &st->SlutType, &kolibaSlutSpec) < 0)
+	|| (koliba_AddType(m, &st->MatrixType, &kolibaMatrixSpec) < 0)
+	|| (koliba_AddType(m, &st->CubeType, &kolibaCubeSpec) < 0)
+	|| (koliba_AddType(m, &st->AngleArrayType, &kolibaAngleArraySpec) < 0))
+		return -1;
+	// Heap types cannot get a vectorcall from their spec before 3.14,
+	// but they will use one if it is there.
+	st->AngleType->tp_vectorcall = kolibaAngleVectorcall;
+
+	if ((o = PyImport_ImportModule("os")) != NULL) {
+		PyObject *reg, *fn, *args, *kw, *r;
+
+		if ((reg = PyObject_GetAttrString(o, "register_at_fork")) != NULL) {
+			fn = PyCFunction_New(&kolibaAfterFork, m);
+			args = PyTuple_New(0);
+			kw = (fn) ? Py_BuildValue("{s:O}", "after_in_child", fn) : NULL;
+			if ((args) && (kw) && ((r = PyObject_Call(reg, args, kw)) != NULL))
+				Py_DECREF(r);
+			Py_XDECREF(kw);
+			Py_XDECREF(args);
+			Py_XDECREF(fn);
+			Py_DECREF(reg);
+		}
+		Py_DECREF(o);
+	}
+	PyErr_Clear();	// No fork() on this system, no problem.
+
+	d = PyModule_GetDict(m);
+	for (i = 0; i < sizeof(kdc)/sizeof(kdc[0]); i++)
+		if (koliba_AddConst(d, kdc[i].name, PyFloat_FromDouble(*kdc[i].value)) < 0) return -1;
+	for (i = 0; i < KAU_COUNT; i++)
+		if (koliba_AddConst(d, kau[i], PyLong_FromLong((long)i)) < 0) return -1;
+	for (i = 0; i < KQC_COUNT; i++)
+		if ((koliba_AddConst(d, kqc[i], PyLong_FromLong((long)i)) < 0)
+		|| (koliba_AddConst(d, &kqc[i][4], PyFloat_FromDouble((double)i*7.5)) < 0))
+			return -1;
+	return 0;
+}
+
+static int koliba_Traverse(PyObject *m, visitproc visit, void *arg) {
+	kolibaState *st = (kolibaState *)PyModule_GetState(m);
+
+	if (st) {
+		Py_VISIT(st->AngleType);
+		Py_VISIT(st->FlutType);
+		Py_VISIT(st->SlutType);
+		Py_VISIT(st->MatrixType);
+		Py_VISIT(st->CubeType);
+		Py_VISIT(st->AngleArrayType);
+		Py_VISIT(st->getloop);
+		Py_VISIT(st->complete);
+	}
+	return 0;
+}
+
+static int koliba_Clear(PyObject *m) {
+	kolibaState *st = (kolibaState *)PyModule_GetState(m);
+
+	if (st) {
+		Py_CLEAR(st->AngleType);
+		Py_CLEAR(st->FlutType);
+		Py_CLEAR(st->SlutType);
+		Py_CLEAR(st->MatrixType);
+		Py_CLEAR(st->CubeType);
+		Py_CLEAR(st->AngleArrayType);
+		Py_CLEAR(st->getloop);
+		Py_CLEAR(st->complete);
+	}
+	return 0;
+}
+
+static void koliba_Free(void *m) {
+	kolibaState *st = (kolibaState *)PyModule_GetState((PyObject *)m);
+
+	if (st == NULL) return;
+	koliba_Clear((PyObject *)m);
+	// The Angles on the freelist already gave their types back.
+	while (st->angleFreeCount > 0)
+		PyObject_Free(st->angleFree[--st->angleFreeCount]);
+	koliba_QueueFree(st->queue);
+	st->queue = NULL;
+	koliba_PoolFree(&st->pool);
+}
+
+static PyModuleDef_Slot kolibaSlots[] = {
+	{Py_mod_exec, koliba_Exec},
+#ifdef	Py_mod_multiple_interpreters
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef	Py_mod_gil
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL}
+};
+
+static struct PyModuleDef kolibamodule = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "koliba",
+	.m_doc = "Python implementation of libkoliba.",
+	.m_size = sizeof(kolibaState),
+	.m_methods = KolibaMethods,
+	.m_slots = kolibaSlots,
+	.m_traverse = koliba_Traverse,
+	.m_clear = koliba_Clear,
+	.m_free = koliba_Free,
+};
+
+PyMODINIT_FUNC
+PyInit_koliba(void)
+{
+	return PyModuleDef_Init(&kolibamodule);
 }
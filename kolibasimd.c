@@ -0,0 +1,739 @@
+/*
+
+	kolibasimd.c
+
+	Copyright 2021 G. Adam Stanislav
+	All rights reserved
+
+	Redistribution and use in source and binary forms,
+	with or without modification, are permitted provided
+	that the following conditions are met:
+
+	1. Redistributions of source code must retain the
+	above copyright notice, this list of conditions
+	and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the
+	above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or
+	other materials provided with the distribution.
+
+	3. Neither the name of the copyright holder nor the
+	names of its contributors may be used to endorse or
+	promote products derived from this software without
+	specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS
+	AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+	WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+	FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+	OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+	PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+	STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+	OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "kolibasimd.h"
+
+// The SIMD kernels for x86 processors. We compile each of them for its own
+// instruction set with the target attribute, so the extension as a whole
+// still runs on any x86 processor, and only pick the ones the processor
+// can actually run. Other compilers and processors just use the scalar
+// kernels from kolibaspan.c.
+//
+// The kernels are written once, as macros, for any width of vector. Each
+// of them processes as many elements at a time as its vector holds doubles
+// (2 for SSE4.2, 4 for AVX2, 8 for AVX-512) or floats (4, 8, or 16), and
+// the last few of a chunk one at a time.
+
+#if	defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#include <math.h>
+
+#define	KLBTARGET(t)	__attribute__((target(t)))
+
+// MADD(a, x, b) is a * x + b, fused or not. E is double or float, C and F
+// the matching chunk and FLUT.
+#define	KLBSIMD(I,TARGET,E,C,F,V,W,SET1,LOAD,STORE,MADD,MUL,SMADD)\
+KLBTARGET(TARGET) static void koliba_##I##1D(C *c, size_t n, const F *f) {\
+	const V kr = SET1(f->m.Black.r), kg = SET1(f->m.Black.g), kb = SET1(f->m.Black.b);\
+	const V rr = SET1(f->m.Red.r), gg = SET1(f->m.Green.g), bb = SET1(f->m.Blue.b);\
+	size_t i;\
+	for (i = 0; i + W <= n; i += W) {\
+		STORE(c->x + i, MADD(rr, LOAD(c->x + i), kr));\
+		STORE(c->y + i, MADD(gg, LOAD(c->y + i), kg));\
+		STORE(c->z + i, MADD(bb, LOAD(c->z + i), kb));\
+	}\
+	for (; i < n; i++) {\
+		c->x[i] = SMADD(f->m.Red.r, c->x[i], f->m.Black.r);\
+		c->y[i] = SMADD(f->m.Green.g, c->y[i], f->m.Black.g);\
+		c->z[i] = SMADD(f->m.Blue.b, c->z[i], f->m.Black.b);\
+	}\
+}\
+\
+KLBTARGET(TARGET) static void koliba_##I##Matrix(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	V k[12], x, y, z;\
+	E sx, sy, sz;\
+	size_t i;\
+	int j;\
+	for (j = 0; j < 12; j++) k[j] = SET1(m[j]);\
+	for (i = 0; i + W <= n; i += W) {\
+		x = LOAD(c->x + i);\
+		y = LOAD(c->y + i);\
+		z = LOAD(c->z + i);\
+		STORE(c->x + i, MADD(k[9], z, MADD(k[6], y, MADD(k[3], x, k[0]))));\
+		STORE(c->y + i, MADD(k[10], z, MADD(k[7], y, MADD(k[4], x, k[1]))));\
+		STORE(c->z + i, MADD(k[11], z, MADD(k[8], y, MADD(k[5], x, k[2]))));\
+	}\
+	for (; i < n; i++) {\
+		sx = c->x[i];\
+		sy = c->y[i];\
+		sz = c->z[i];\
+		c->x[i] = SMADD(m[9], sz, SMADD(m[6], sy, SMADD(m[3], sx, m[0])));\
+		c->y[i] = SMADD(m[10], sz, SMADD(m[7], sy, SMADD(m[4], sx, m[1])));\
+		c->z[i] = SMADD(m[11], sz, SMADD(m[8], sy, SMADD(m[5], sx, m[2])));\
+	}\
+}\
+\
+KLBTARGET(TARGET) static void koliba_##I##3x3(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	V k[12], x, y, z;\
+	E sx, sy, sz;\
+	size_t i;\
+	int j;\
+	for (j = 3; j < 12; j++) k[j] = SET1(m[j]);\
+	for (i = 0; i + W <= n; i += W) {\
+		x = LOAD(c->x + i);\
+		y = LOAD(c->y + i);\
+		z = LOAD(c->z + i);\
+		STORE(c->x + i, MADD(k[9], z, MADD(k[6], y, MUL(k[3], x))));\
+		STORE(c->y + i, MADD(k[10], z, MADD(k[7], y, MUL(k[4], x))));\
+		STORE(c->z + i, MADD(k[11], z, MADD(k[8], y, MUL(k[5], x))));\
+	}\
+	for (; i < n; i++) {\
+		sx = c->x[i];\
+		sy = c->y[i];\
+		sz = c->z[i];\
+		c->x[i] = SMADD(m[9], sz, SMADD(m[6], sy, m[3] * sx));\
+		c->y[i] = SMADD(m[10], sz, SMADD(m[7], sy, m[4] * sx));\
+		c->z[i] = SMADD(m[11], sz, SMADD(m[8], sy, m[5] * sx));\
+	}\
+}\
+\
+KLBTARGET(TARGET) static void koliba_##I##Trilinear(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	V k[24], x, y, z, xy, xz, yz, xyz;\
+	E sx, sy, sz, sxy, sxz, syz, sxyz;\
+	size_t i;\
+	int j;\
+	for (j = 0; j < 24; j++) k[j] = SET1(m[j]);\
+	for (i = 0; i + W <= n; i += W) {\
+		x = LOAD(c->x + i);\
+		y = LOAD(c->y + i);\
+		z = LOAD(c->z + i);\
+		xy = MUL(x, y);\
+		xz = MUL(x, z);\
+		yz = MUL(y, z);\
+		xyz = MUL(xy, z);\
+		for (j = 0; j < 3; j++)\
+			STORE(((j == 0) ? c->x : (j == 1) ? c->y : c->z) + i,\
+				MADD(k[21+j], xyz, MADD(k[18+j], yz, MADD(k[15+j], xz, MADD(k[12+j], xy,\
+				MADD(k[9+j], z, MADD(k[6+j], y, MADD(k[3+j], x, k[j]))))))));\
+	}\
+	for (; i < n; i++) {\
+		sx = c->x[i];\
+		sy = c->y[i];\
+		sz = c->z[i];\
+		sxy = sx * sy;\
+		sxz = sx * sz;\
+		syz = sy * sz;\
+		sxyz = sxy * sz;\
+		for (j = 0; j < 3; j++)\
+			((j == 0) ? c->x : (j == 1) ? c->y : c->z)[i] =\
+				SMADD(m[21+j], sxyz, SMADD(m[18+j], syz, SMADD(m[15+j], sxz, SMADD(m[12+j], sxy,\
+				SMADD(m[9+j], sz, SMADD(m[6+j], sy, SMADD(m[3+j], sx, m[j])))))));\
+	}\
+}
+
+// SSE4.2 has no fused multiply-add, and neither do the scalar kernels, so
+// these give the same results as those.
+#define	KLBSSEMADD(a,x,b)	_mm_add_pd(_mm_mul_pd(a, x), b)
+#define	KLBMADD(a,x,b)		((a) * (x) + (b))
+#define	KLBSSEMADDS(a,x,b)	_mm_add_ps(_mm_mul_ps(a, x), b)
+KLBSIMD(Sse42, "sse4.2", double, kolibaSpanXyz, kolibaSpanFlut, __m128d, 2, _mm_set1_pd, _mm_loadu_pd, _mm_storeu_pd, KLBSSEMADD, _mm_mul_pd, KLBMADD)
+KLBSIMD(Sse42F, "sse4.2", float, kolibaSpanXyz32, kolibaSpanFlut32, __m128, 4, _mm_set1_ps, _mm_loadu_ps, _mm_storeu_ps, KLBSSEMADDS, _mm_mul_ps, KLBMADD)
+
+KLBSIMD(Avx2, "avx2,fma", double, kolibaSpanXyz, kolibaSpanFlut, __m256d, 4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_fmadd_pd, _mm256_mul_pd, fma)
+KLBSIMD(Avx2F, "avx2,fma", float, kolibaSpanXyz32, kolibaSpanFlut32, __m256, 8, _mm256_set1_ps, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_fmadd_ps, _mm256_mul_ps, fmaf)
+
+KLBSIMD(Avx512, "avx512f,avx2,fma", double, kolibaSpanXyz, kolibaSpanFlut, __m512d, 8, _mm512_set1_pd, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_fmadd_pd, _mm512_mul_pd, fma)
+KLBSIMD(Avx512F, "avx512f,avx2,fma", float, kolibaSpanXyz32, kolibaSpanFlut32, __m512, 16, _mm512_set1_ps, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_fmadd_ps, _mm512_mul_ps, fmaf)
+
+// The 8-bit loads gather the doubles from the table, with the indices
+// shifted and masked out of four (or eight) whole pixels at once.
+
+KLBTARGET("avx2") static void koliba_Avx2Load8(kolibaSpanXyz *c, const uint8_t *p, size_t n, const unsigned char *off, const double *table) {
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i sx = _mm_cvtsi32_si128(8 * off[0]), sy = _mm_cvtsi32_si128(8 * off[1]), sz = _mm_cvtsi32_si128(8 * off[2]);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		_mm256_storeu_pd(c->x + i, _mm256_i32gather_pd(table, _mm_and_si128(_mm_srl_epi32(v, sx), mask), 8));
+		_mm256_storeu_pd(c->y + i, _mm256_i32gather_pd(table, _mm_and_si128(_mm_srl_epi32(v, sy), mask), 8));
+		_mm256_storeu_pd(c->z + i, _mm256_i32gather_pd(table, _mm_and_si128(_mm_srl_epi32(v, sz), mask), 8));
+	}
+	for (; i < n; i++, p += 4) {
+		c->x[i] = table[p[off[0]]];
+		c->y[i] = table[p[off[1]]];
+		c->z[i] = table[p[off[2]]];
+	}
+}
+
+KLBTARGET("avx512f,avx2") static void koliba_Avx512Load8(kolibaSpanXyz *c, const uint8_t *p, size_t n, const unsigned char *off, const double *table) {
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m128i sx = _mm_cvtsi32_si128(8 * off[0]), sy = _mm_cvtsi32_si128(8 * off[1]), sz = _mm_cvtsi32_si128(8 * off[2]);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8, p += 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		_mm512_storeu_pd(c->x + i, _mm512_i32gather_pd(_mm256_and_si256(_mm256_srl_epi32(v, sx), mask), table, 8));
+		_mm512_storeu_pd(c->y + i, _mm512_i32gather_pd(_mm256_and_si256(_mm256_srl_epi32(v, sy), mask), table, 8));
+		_mm512_storeu_pd(c->z + i, _mm512_i32gather_pd(_mm256_and_si256(_mm256_srl_epi32(v, sz), mask), table, 8));
+	}
+	for (; i < n; i++, p += 4) {
+		c->x[i] = table[p[off[0]]];
+		c->y[i] = table[p[off[1]]];
+		c->z[i] = table[p[off[2]]];
+	}
+}
+
+// The 32-bit loads read four pixels at a time and transpose them, so each
+// channel of the four ends up in its own vector.
+
+KLBTARGET("avx2") static void koliba_Avx2Load32(kolibaSpanXyz *c, const float *p, size_t n, const unsigned char *off) {
+	__m128 r[4];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		r[0] = _mm_loadu_ps(p);
+		r[1] = _mm_loadu_ps(p + 4);
+		r[2] = _mm_loadu_ps(p + 8);
+		r[3] = _mm_loadu_ps(p + 12);
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_mm256_storeu_pd(c->x + i, _mm256_cvtps_pd(r[off[0]]));
+		_mm256_storeu_pd(c->y + i, _mm256_cvtps_pd(r[off[1]]));
+		_mm256_storeu_pd(c->z + i, _mm256_cvtps_pd(r[off[2]]));
+	}
+	for (; i < n; i++, p += 4) {
+		c->x[i] = p[off[0]];
+		c->y[i] = p[off[1]];
+		c->z[i] = p[off[2]];
+	}
+}
+
+// A plane needs no shifting and masking, just widening.
+
+KLBTARGET("avx2") static void koliba_Avx2LoadPlane8(double *d, const uint8_t *p, size_t n, const double *table) {
+	int32_t v;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		memcpy(&v, p + i, sizeof(v));
+		_mm256_storeu_pd(d + i, _mm256_i32gather_pd(table, _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)), 8));
+	}
+	for (; i < n; i++)
+		d[i] = table[p[i]];
+}
+
+KLBTARGET("avx512f,avx2") static void koliba_Avx512LoadPlane8(double *d, const uint8_t *p, size_t n, const double *table) {
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm512_storeu_pd(d + i, _mm512_i32gather_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + i))), table, 8));
+	for (; i < n; i++)
+		d[i] = table[p[i]];
+}
+
+// The 16-bit loads gather from both tables, with the high and the low byte
+// of each channel shifted and masked out of four whole pixels at once.
+
+KLBTARGET("avx2") static void koliba_Avx2Load16(kolibaSpanXyz *c, const uint16_t *p, size_t n, const unsigned char *off) {
+	const double *hi = (const double *)KOLIBA_HighWordDiv65535, *lo = (const double *)KOLIBA_LowWordDiv65535;
+	const __m256i mask = _mm256_set1_epi64x(0xFF);
+	__m128i sh[3], sl[3];
+	__m256i v;
+	size_t i;
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		sh[j] = _mm_cvtsi32_si128(16 * off[j] + 8);
+		sl[j] = _mm_cvtsi32_si128(16 * off[j]);
+	}
+#define	klbword(j)	_mm256_add_pd(\
+	_mm256_i64gather_pd(hi, _mm256_and_si256(_mm256_srl_epi64(v, sh[j]), mask), 8),\
+	_mm256_i64gather_pd(lo, _mm256_and_si256(_mm256_srl_epi64(v, sl[j]), mask), 8))
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		_mm256_storeu_pd(c->x + i, klbword(0));
+		_mm256_storeu_pd(c->y + i, klbword(1));
+		_mm256_storeu_pd(c->z + i, klbword(2));
+	}
+#undef	klbword
+	for (; i < n; i++, p += 4) {
+		c->x[i] = koliba_WordToDouble(p[off[0]]);
+		c->y[i] = koliba_WordToDouble(p[off[1]]);
+		c->z[i] = koliba_WordToDouble(p[off[2]]);
+	}
+}
+
+// The 16-bit stores round and clamp the channels as koliba_DoubleToWord
+// does (max returns the zero for a NaN), widen them to 64 bits, and shift
+// each into its place in the pixel, next to the alpha of the input. Fusing
+// the multiply and the add would round some halves differently, so they
+// do not target FMA.
+
+KLBTARGET("sse4.2") static void koliba_Sse42Store16(uint16_t *o, const uint16_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *off, double scale) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	const __m128d s = _mm_set1_pd(scale), half = _mm_set1_pd(0.5), zero = _mm_setzero_pd(), top = _mm_set1_pd(65535.0);
+	const __m128i amask = _mm_set1_epi64x((long long)0xFFFF << (16 * a));
+	const __m128i sx = _mm_cvtsi32_si128(16 * off[0]), sy = _mm_cvtsi32_si128(16 * off[1]), sz = _mm_cvtsi32_si128(16 * off[2]);
+	__m128i v;
+	size_t i;
+
+#define	klbword(d)	_mm_cvtepu32_epi64(_mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(d), s), half), zero), top)))
+	for (i = 0; i + 2 <= n; i += 2, p += 8, o += 8) {
+		v = _mm_and_si128(_mm_loadu_si128((const __m128i *)p), amask);
+		v = _mm_or_si128(v, _mm_sll_epi64(klbword(c->x + i), sx));
+		v = _mm_or_si128(v, _mm_sll_epi64(klbword(c->y + i), sy));
+		v = _mm_or_si128(v, _mm_sll_epi64(klbword(c->z + i), sz));
+		_mm_storeu_si128((__m128i *)o, v);
+	}
+#undef	klbword
+	for (; i < n; i++, p += 4, o += 4) {
+		o[a] = p[a];
+		o[off[0]] = koliba_DoubleToWord(c->x[i] * scale);
+		o[off[1]] = koliba_DoubleToWord(c->y[i] * scale);
+		o[off[2]] = koliba_DoubleToWord(c->z[i] * scale);
+	}
+}
+
+KLBTARGET("avx2") static void koliba_Avx2Store16(uint16_t *o, const uint16_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *off, double scale) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	const __m256d s = _mm256_set1_pd(scale), half = _mm256_set1_pd(0.5), zero = _mm256_setzero_pd(), top = _mm256_set1_pd(65535.0);
+	const __m256i amask = _mm256_set1_epi64x((long long)0xFFFF << (16 * a));
+	const __m128i sx = _mm_cvtsi32_si128(16 * off[0]), sy = _mm_cvtsi32_si128(16 * off[1]), sz = _mm_cvtsi32_si128(16 * off[2]);
+	__m256i v;
+	size_t i;
+
+#define	klbword(d)	_mm256_cvtepu32_epi64(_mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(d), s), half), zero), top)))
+	for (i = 0; i + 4 <= n; i += 4, p += 16, o += 16) {
+		v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)p), amask);
+		v = _mm256_or_si256(v, _mm256_sll_epi64(klbword(c->x + i), sx));
+		v = _mm256_or_si256(v, _mm256_sll_epi64(klbword(c->y + i), sy));
+		v = _mm256_or_si256(v, _mm256_sll_epi64(klbword(c->z + i), sz));
+		_mm256_storeu_si256((__m256i *)o, v);
+	}
+#undef	klbword
+	for (; i < n; i++, p += 4, o += 4) {
+		o[a] = p[a];
+		o[off[0]] = koliba_DoubleToWord(c->x[i] * scale);
+		o[off[1]] = koliba_DoubleToWord(c->y[i] * scale);
+		o[off[2]] = koliba_DoubleToWord(c->z[i] * scale);
+	}
+}
+
+// The packed 10-bit pixels need no gathers, their channels are shifted
+// and masked out of four whole pixels at once, and shifted back in. The
+// stores round just as the 16-bit ones do.
+
+KLBTARGET("sse4.2") static void koliba_Sse42Load10(kolibaSpanXyz *c, const uint32_t *p, size_t n, const unsigned char *sh) {
+	const __m128i mask = _mm_set1_epi32(0x3FF);
+	const __m128d k = _mm_set1_pd(1023.0);
+	double *d[3] = {c->x, c->y, c->z};
+	__m128i v, w;
+	size_t i;
+	int j;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		for (j = 0; j < 3; j++) {
+			w = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(sh[j])), mask);
+			_mm_storeu_pd(d[j] + i, _mm_div_pd(_mm_cvtepi32_pd(w), k));
+			_mm_storeu_pd(d[j] + i + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(w, w)), k));
+		}
+	}
+	for (; i < n; i++) {
+		c->x[i] = koliba_TenBitToDouble(p[i] >> sh[0]);
+		c->y[i] = koliba_TenBitToDouble(p[i] >> sh[1]);
+		c->z[i] = koliba_TenBitToDouble(p[i] >> sh[2]);
+	}
+}
+
+KLBTARGET("avx2") static void koliba_Avx2Load10(kolibaSpanXyz *c, const uint32_t *p, size_t n, const unsigned char *sh) {
+	const __m128i mask = _mm_set1_epi32(0x3FF);
+	const __m256d k = _mm256_set1_pd(1023.0);
+	double *d[3] = {c->x, c->y, c->z};
+	__m128i v;
+	size_t i;
+	int j;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		for (j = 0; j < 3; j++)
+			_mm256_storeu_pd(d[j] + i, _mm256_div_pd(_mm256_cvtepi32_pd(_mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(sh[j])), mask)), k));
+	}
+	for (; i < n; i++) {
+		c->x[i] = koliba_TenBitToDouble(p[i] >> sh[0]);
+		c->y[i] = koliba_TenBitToDouble(p[i] >> sh[1]);
+		c->z[i] = koliba_TenBitToDouble(p[i] >> sh[2]);
+	}
+}
+
+KLBTARGET("sse4.2") static void koliba_Sse42Store10(uint32_t *o, const uint32_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *sh, double scale) {
+	const __m128d s = _mm_set1_pd(scale), half = _mm_set1_pd(0.5), zero = _mm_setzero_pd(), top = _mm_set1_pd(1023.0);
+	const __m128i amask = _mm_set1_epi32((int)0xC0000000);
+	const double *d[3] = {c->x, c->y, c->z};
+	__m128i v;
+	size_t i;
+	int j;
+
+#define	klbten(d)	_mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(d), s), half), zero), top))
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), amask);
+		for (j = 0; j < 3; j++)
+			v = _mm_or_si128(v, _mm_sll_epi32(_mm_unpacklo_epi64(klbten(d[j] + i), klbten(d[j] + i + 2)), _mm_cvtsi32_si128(sh[j])));
+		_mm_storeu_si128((__m128i *)(o + i), v);
+	}
+#undef	klbten
+	for (; i < n; i++)
+		o[i] = (p[i] & 0xC0000000)
+			| (koliba_DoubleToTenBit(c->x[i] * scale) << sh[0])
+			| (koliba_DoubleToTenBit(c->y[i] * scale) << sh[1])
+			| (koliba_DoubleToTenBit(c->z[i] * scale) << sh[2]);
+}
+
+KLBTARGET("avx2") static void koliba_Avx2Store10(uint32_t *o, const uint32_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *sh, double scale) {
+	const __m256d s = _mm256_set1_pd(scale), half = _mm256_set1_pd(0.5), zero = _mm256_setzero_pd(), top = _mm256_set1_pd(1023.0);
+	const __m128i amask = _mm_set1_epi32((int)0xC0000000);
+	const double *d[3] = {c->x, c->y, c->z};
+	__m128i v;
+	size_t i;
+	int j;
+
+#define	klbten(d)	_mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(d), s), half), zero), top))
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), amask);
+		for (j = 0; j < 3; j++)
+			v = _mm_or_si128(v, _mm_sll_epi32(klbten(d[j] + i), _mm_cvtsi32_si128(sh[j])));
+		_mm_storeu_si128((__m128i *)(o + i), v);
+	}
+#undef	klbten
+	for (; i < n; i++)
+		o[i] = (p[i] & 0xC0000000)
+			| (koliba_DoubleToTenBit(c->x[i] * scale) << sh[0])
+			| (koliba_DoubleToTenBit(c->y[i] * scale) << sh[1])
+			| (koliba_DoubleToTenBit(c->z[i] * scale) << sh[2]);
+}
+
+// The 24-bit pixels are expanded and packed four at a time with byte
+// shuffles. Each reads (or writes) 16 bytes for the 12 of four pixels, so
+// they stop short of the last two pixels, and leave them (and whatever
+// else is left) to a byte at a time. A pack overwrites the start of the
+// next four pixels, which it writes next anyway.
+
+KLBTARGET("sse4.2") static void koliba_Sse42Expand24(uint8_t *o, const uint8_t *p, size_t n) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	size_t i;
+
+	for (i = 0; i + 6 <= n; i += 4, o += 16, p += 12)
+		_mm_storeu_si128((__m128i *)o, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), shuffle));
+	koliba_SpanExpand24(o, p, n - i);
+}
+
+KLBTARGET("sse4.2") static void koliba_Sse42Pack24(uint8_t *o, const uint8_t *p, size_t n) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	size_t i;
+
+	for (i = 0; i + 6 <= n; i += 4, o += 12, p += 16)
+		_mm_storeu_si128((__m128i *)o, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), shuffle));
+	koliba_SpanPack24(o, p, n - i);
+}
+
+// The single-precision loads and stores transpose four pixels at a time,
+// and need nothing beyond SSE. The stores put the new channels in place of
+// the old ones and transpose the pixels back, alpha and all.
+
+KLBTARGET("sse4.2") static void koliba_Sse42LoadFloat(kolibaSpanXyz32 *c, const float *p, size_t n, const unsigned char *off) {
+	__m128 r[4];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		r[0] = _mm_loadu_ps(p);
+		r[1] = _mm_loadu_ps(p + 4);
+		r[2] = _mm_loadu_ps(p + 8);
+		r[3] = _mm_loadu_ps(p + 12);
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_mm_storeu_ps(c->x + i, r[off[0]]);
+		_mm_storeu_ps(c->y + i, r[off[1]]);
+		_mm_storeu_ps(c->z + i, r[off[2]]);
+	}
+	for (; i < n; i++, p += 4) {
+		c->x[i] = p[off[0]];
+		c->y[i] = p[off[1]];
+		c->z[i] = p[off[2]];
+	}
+}
+
+KLBTARGET("sse4.2") static void koliba_Sse42StoreFloat(float *o, const float *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	__m128 r[4];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16, o += 16) {
+		r[a] = _mm_set_ps(p[12 + a], p[8 + a], p[4 + a], p[a]);
+		r[off[0]] = _mm_loadu_ps(c->x + i);
+		r[off[1]] = _mm_loadu_ps(c->y + i);
+		r[off[2]] = _mm_loadu_ps(c->z + i);
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_mm_storeu_ps(o, r[0]);
+		_mm_storeu_ps(o + 4, r[1]);
+		_mm_storeu_ps(o + 8, r[2]);
+		_mm_storeu_ps(o + 12, r[3]);
+	}
+	for (; i < n; i++, p += 4, o += 4) {
+		o[a] = p[a];
+		o[off[0]] = c->x[i];
+		o[off[1]] = c->y[i];
+		o[off[2]] = c->z[i];
+	}
+}
+
+// The half-float loads and stores are the single-precision ones, with each
+// pixel widened from (or narrowed to) halves on its way in (or out). The
+// alpha channel goes back exactly as it came, bits and all, even if it is
+// a NaN that would not survive the round trip.
+
+KLBTARGET("f16c") static void koliba_F16cLoadHalf(kolibaSpanXyz32 *c, const uint16_t *p, size_t n, const unsigned char *off) {
+	__m128 r[4];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16) {
+		r[0] = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)p));
+		r[1] = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(p + 4)));
+		r[2] = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(p + 8)));
+		r[3] = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(p + 12)));
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_mm_storeu_ps(c->x + i, r[off[0]]);
+		_mm_storeu_ps(c->y + i, r[off[1]]);
+		_mm_storeu_ps(c->z + i, r[off[2]]);
+	}
+	for (; i < n; i++, p += 4) {
+		c->x[i] = koliba_HalfToFloat(p[off[0]]);
+		c->y[i] = koliba_HalfToFloat(p[off[1]]);
+		c->z[i] = koliba_HalfToFloat(p[off[2]]);
+	}
+}
+
+KLBTARGET("f16c") static void koliba_F16cStoreHalf(uint16_t *o, const uint16_t *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	uint16_t alpha[4];
+	__m128 r[4];
+	size_t i;
+	int j;
+
+	for (i = 0; i + 4 <= n; i += 4, p += 16, o += 16) {
+		for (j = 0; j < 4; j++)
+			alpha[j] = p[4 * j + a];
+		r[a] = _mm_setzero_ps();
+		r[off[0]] = _mm_loadu_ps(c->x + i);
+		r[off[1]] = _mm_loadu_ps(c->y + i);
+		r[off[2]] = _mm_loadu_ps(c->z + i);
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		for (j = 0; j < 4; j++) {
+			_mm_storel_epi64((__m128i *)(o + 4 * j), _mm_cvtps_ph(r[j], _MM_FROUND_TO_NEAREST_INT));
+			o[4 * j + a] = alpha[j];
+		}
+	}
+	for (; i < n; i++, p += 4, o += 4) {
+		o[a] = p[a];
+		o[off[0]] = koliba_FloatToHalf(c->x[i]);
+		o[off[1]] = koliba_FloatToHalf(c->y[i]);
+		o[off[2]] = koliba_FloatToHalf(c->z[i]);
+	}
+}
+
+// The fixed-point kernels do the same as koliba_SpanFixed in kolibaspan.c,
+// 8 pixels at a time with SSE4.2 and 16 with AVX2, in 16-bit lanes. P and S
+// are the prefix and the suffix of the intrinsics of the vector size, and
+// BCAST makes a vector of 16-byte shuffle patterns.
+//
+// Each half of two vectors of pixels is shuffled into four groups of four
+// bytes, one group per channel, red, green, blue, and alpha in this order.
+// Interleaving the groups of the two vectors then puts each channel in one
+// half of a vector, which widens to 16 bits. That scrambles the pixels, but
+// the way back unscrambles them again.
+//
+// AVX-512F has no 16-bit integer instructions (they come with AVX-512BW),
+// so the AVX-512 isa uses the AVX2 ones.
+#define	KLBFIXED(I,K,KERNEL,TARGET,P,S,V,W,BCAST)\
+KLBTARGET(TARGET) static void koliba_##I##Fixed##K(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off) {\
+	const short *m = (const short *)f;\
+	const __m128i bits = _mm_cvtsi32_si128(f->bits);\
+	const V zero = P##_setzero_##S();\
+	V k[24], sin, sout, a0, a1, c[4], v[3], xy, xz, yz, xyz;\
+	unsigned char in[16], out[16], ord[4];\
+	unsigned int i, j;\
+	size_t l;\
+	ord[0] = off[0];\
+	ord[1] = off[1];\
+	ord[2] = off[2];\
+	ord[3] = 6 - off[0] - off[1] - off[2];\
+	for (i = 0; i < 4; i++) for (j = 0; j < 4; j++) {\
+		in[4 * i + j] = 4 * j + ord[i];\
+		out[4 * j + ord[i]] = 4 * j + i;\
+	}\
+	sin = BCAST(_mm_loadu_si128((const __m128i *)in));\
+	sout = BCAST(_mm_loadu_si128((const __m128i *)out));\
+	for (i = 0; i < 24; i++)\
+		k[i] = P##_set1_epi16(m[i]);\
+	for (l = 0; l + W <= n; l += W, p += 4 * W, o += 4 * W) {\
+		a0 = P##_shuffle_epi8(P##_loadu_##S((const V *)p), sin);\
+		a1 = P##_shuffle_epi8(P##_loadu_##S((const V *)(p + 2 * W)), sin);\
+		v[0] = P##_unpacklo_epi32(a0, a1);\
+		v[1] = P##_unpackhi_epi32(a0, a1);\
+		c[0] = P##_unpacklo_epi8(v[0], zero);\
+		c[1] = P##_unpackhi_epi8(v[0], zero);\
+		c[2] = P##_unpacklo_epi8(v[1], zero);\
+		c[3] = P##_unpackhi_epi8(v[1], zero);\
+		for (i = 0; i < 3; i++)\
+			c[i] = P##_add_epi16(P##_slli_epi16(c[i], 7), P##_srli_epi16(c[i], 1));\
+		for (i = 0; i < 3; i++) {\
+			if (KERNEL == KOLIBA_KERNEL1D)\
+				v[i] = P##_adds_epi16(k[i], P##_mulhrs_epi16(k[3 + 4 * i], c[i]));\
+			else {\
+				v[i] = P##_adds_epi16(k[i], P##_mulhrs_epi16(k[3 + i], c[0]));\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[6 + i], c[1]));\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[9 + i], c[2]));\
+			}\
+		}\
+		if (KERNEL == KOLIBA_KERNELTRILINEAR) {\
+			xy = P##_mulhrs_epi16(c[0], c[1]);\
+			xz = P##_mulhrs_epi16(c[0], c[2]);\
+			yz = P##_mulhrs_epi16(c[1], c[2]);\
+			xyz = P##_mulhrs_epi16(xy, c[2]);\
+			for (i = 0; i < 3; i++) {\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[12 + i], xy));\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[15 + i], xz));\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[18 + i], yz));\
+				v[i] = P##_adds_epi16(v[i], P##_mulhrs_epi16(k[21 + i], xyz));\
+			}\
+		}\
+		a0 = P##_packus_epi16(P##_sra_epi16(v[0], bits), P##_sra_epi16(v[1], bits));\
+		a1 = P##_packus_epi16(P##_sra_epi16(v[2], bits), c[3]);\
+		v[0] = P##_unpacklo_epi8(a0, a1);\
+		v[1] = P##_unpackhi_epi8(a0, a1);\
+		P##_storeu_##S((V *)o, P##_shuffle_epi8(P##_unpacklo_epi8(v[0], v[1]), sout));\
+		P##_storeu_##S((V *)(o + 2 * W), P##_shuffle_epi8(P##_unpackhi_epi8(v[0], v[1]), sout));\
+	}\
+	koliba_SpanFixed##K(o, p, n - l, f, off);\
+}
+
+#define	KLBSSEBCAST(x)	(x)
+KLBFIXED(Sse42, 1D, KOLIBA_KERNEL1D, "sse4.2", _mm, si128, __m128i, 8, KLBSSEBCAST)
+KLBFIXED(Sse42, Matrix, KOLIBA_KERNELMATRIX, "sse4.2", _mm, si128, __m128i, 8, KLBSSEBCAST)
+KLBFIXED(Sse42, Trilinear, KOLIBA_KERNELTRILINEAR, "sse4.2", _mm, si128, __m128i, 8, KLBSSEBCAST)
+
+KLBFIXED(Avx2, 1D, KOLIBA_KERNEL1D, "avx2", _mm256, si256, __m256i, 16, _mm256_broadcastsi128_si256)
+KLBFIXED(Avx2, Matrix, KOLIBA_KERNELMATRIX, "avx2", _mm256, si256, __m256i, 16, _mm256_broadcastsi128_si256)
+KLBFIXED(Avx2, Trilinear, KOLIBA_KERNELTRILINEAR, "avx2", _mm256, si256, __m256i, 16, _mm256_broadcastsi128_si256)
+
+static const kolibaSpanIsa kolibaSse42Isa = {
+	{koliba_Sse421D, koliba_Sse423x3, koliba_Sse42Matrix, koliba_Sse42Trilinear},
+	koliba_SpanLoad8,
+	koliba_SpanLoad32,
+	{koliba_Sse42F1D, koliba_Sse42F3x3, koliba_Sse42FMatrix, koliba_Sse42FTrilinear},
+	koliba_Sse42LoadFloat,
+	koliba_Sse42StoreFloat,
+	{koliba_Sse42Fixed1D, koliba_Sse42FixedMatrix, koliba_Sse42FixedMatrix, koliba_Sse42FixedTrilinear},
+	koliba_SpanLoad16,
+	koliba_Sse42Store16,
+	koliba_SpanLoadHalf,
+	koliba_SpanStoreHalf,
+	koliba_Sse42Load10,
+	koliba_Sse42Store10,
+	koliba_Sse42Expand24,
+	koliba_Sse42Pack24,
+	koliba_SpanLoadPlane8
+};
+
+static const kolibaSpanIsa kolibaAvx2Isa = {
+	{koliba_Avx21D, koliba_Avx23x3, koliba_Avx2Matrix, koliba_Avx2Trilinear},
+	koliba_Avx2Load8,
+	koliba_Avx2Load32,
+	{koliba_Avx2F1D, koliba_Avx2F3x3, koliba_Avx2FMatrix, koliba_Avx2FTrilinear},
+	koliba_Sse42LoadFloat,
+	koliba_Sse42StoreFloat,
+	{koliba_Avx2Fixed1D, koliba_Avx2FixedMatrix, koliba_Avx2FixedMatrix, koliba_Avx2FixedTrilinear},
+	koliba_Avx2Load16,
+	koliba_Avx2Store16,
+	koliba_F16cLoadHalf,
+	koliba_F16cStoreHalf,
+	koliba_Avx2Load10,
+	koliba_Avx2Store10,
+	koliba_Sse42Expand24,
+	koliba_Sse42Pack24,
+	koliba_Avx2LoadPlane8
+};
+
+static const kolibaSpanIsa kolibaAvx512Isa = {
+	{koliba_Avx5121D, koliba_Avx5123x3, koliba_Avx512Matrix, koliba_Avx512Trilinear},
+	koliba_Avx512Load8,
+	koliba_Avx2Load32,
+	{koliba_Avx512F1D, koliba_Avx512F3x3, koliba_Avx512FMatrix, koliba_Avx512FTrilinear},
+	koliba_Sse42LoadFloat,
+	koliba_Sse42StoreFloat,
+	{koliba_Avx2Fixed1D, koliba_Avx2FixedMatrix, koliba_Avx2FixedMatrix, koliba_Avx2FixedTrilinear},
+	koliba_Avx2Load16,
+	koliba_Avx2Store16,
+	koliba_F16cLoadHalf,
+	koliba_F16cStoreHalf,
+	koliba_Avx2Load10,
+	koliba_Avx2Store10,
+	koliba_Sse42Expand24,
+	koliba_Sse42Pack24,
+	koliba_Avx512LoadPlane8
+};
+
+KLBHID const kolibaSpanIsa * koliba_SimdIsa(KOLIBA_SPANISA isa) {
+	__builtin_cpu_init();
+	switch (isa) {
+		case KOLIBA_SPANSSE42:
+			return (__builtin_cpu_supports("sse4.2")) ? &kolibaSse42Isa : NULL;
+		case KOLIBA_SPANAVX2:
+			return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) ? &kolibaAvx2Isa : NULL;
+		case KOLIBA_SPANAVX512:
+			return (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) ? &kolibaAvx512Isa : NULL;
+		default:
+			return NULL;
+	}
+}
+
+#else
+
+KLBHID const kolibaSpanIsa * koliba_SimdIsa(KOLIBA_SPANISA isa) {
+	return NULL;
+}
+
+#endif
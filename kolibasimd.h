@@ -0,0 +1,229 @@
+/*
+
+	kolibasimd.h
+
+	Copyright 2021 G. Adam Stanislav
+	All rights reserved
+
+	Redistribution and use in source and binary forms,
+	with or without modification, are permitted provided
+	that the following conditions are met:
+
+	1. Redistributions of source code must retain the
+	above copyright notice, this list of conditions
+	and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the
+	above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or
+	other materials provided with the distribution.
+
+	3. Neither the name of the copyright holder nor the
+	names of its contributors may be used to endorse or
+	promote products derived from this software without
+	specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS
+	AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+	WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+	FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+	OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+	PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+	STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+	OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef	_KOLIBASIMD_H_
+#define	_KOLIBASIMD_H_
+
+#include "kolibaspan.h"
+
+// What the span functions share with the processor-specific kernels in
+// kolibasimd.c. Nothing outside of kolibaspan.c and kolibasimd.c should
+// need any of it.
+
+// How many elements we convert to doubles at a time.
+#define	KOLIBA_SPANCHUNK	256
+
+// The kernels work on the channels of a chunk kept in separate arrays, so
+// they can load several elements of the same channel at once.
+typedef struct {
+	double x[KOLIBA_SPANCHUNK];
+	double y[KOLIBA_SPANCHUNK];
+	double z[KOLIBA_SPANCHUNK];
+} kolibaSpanXyz;
+
+// The FLUT with every factor its flags turn off set to zero, so the kernels
+// never need to look at the flags. The reference kernel gets the original.
+typedef struct {
+	KOLIBA_FLUT m;
+	const KOLIBA_FLUT *fLut;
+	KOLIBA_FLAGS flags;
+} kolibaSpanFlut;
+
+// And the same in single precision.
+typedef struct {
+	float x[KOLIBA_SPANCHUNK];
+	float y[KOLIBA_SPANCHUNK];
+	float z[KOLIBA_SPANCHUNK];
+} kolibaSpanXyz32;
+
+typedef struct {
+	KOLIBA_FLUT32 m;
+} kolibaSpanFlut32;
+
+// Which kernel the flags need.
+typedef enum {
+	KOLIBA_KERNEL1D,
+	KOLIBA_KERNEL3X3,
+	KOLIBA_KERNELMATRIX,
+	KOLIBA_KERNELTRILINEAR,
+	KOLIBA_KERNELS
+} kolibaSpanKernelType;
+
+typedef void (*kolibaSpanKernel)(kolibaSpanXyz *, size_t, const kolibaSpanFlut *);
+
+// Read n pixels of four bytes (through a table of 256 doubles) or of four
+// floats into a chunk. The off array holds the offsets of r, g, and b.
+typedef void (*kolibaSpanLoad8)(kolibaSpanXyz *, const uint8_t *, size_t, const unsigned char *, const double *);
+typedef void (*kolibaSpanLoad32)(kolibaSpanXyz *, const float *, size_t, const unsigned char *);
+
+// The 16-bit pixels are read through KOLIBA_HighWordDiv65535 and
+// KOLIBA_LowWordDiv65535, and written back multiplied by the scale (65535,
+// or 1 for a scaled FLUT), rounded, clamped, and with the alpha channel of
+// the input.
+static inline double koliba_WordToDouble(unsigned int w) {
+	return ((const double *)KOLIBA_HighWordDiv65535)[w >> 8] + ((const double *)KOLIBA_LowWordDiv65535)[w & 0xFF];
+}
+
+static inline uint16_t koliba_DoubleToWord(double v) {
+	v += 0.5;
+	return (!(v > 0.0)) ? 0 : (v > 65535.0) ? 65535 : (uint16_t)v;
+}
+
+// Half floats convert to and from floats, and the bits of a float are
+// best had by way of a union.
+typedef union {
+	float f;
+	uint32_t u;
+} kolibaFloatBits;
+
+static inline float koliba_HalfToFloat(KOLIBA_HALF h) {
+	kolibaFloatBits b;
+	const uint32_t e = (h >> 10) & 0x1F, m = h & 0x3FF;
+
+	if (e == 0x1F) b.u = 0x7F800000 | (m << 13) | ((m) ? 0x400000 : 0);
+	else if (e) b.u = ((e + 112) << 23) | (m << 13);
+	else b.f = (float)m * 5.9604644775390625e-8f;	// m * 2^-24
+	b.u |= (uint32_t)(h & 0x8000) << 16;
+	return b.f;
+}
+
+// Anything below 2^-14 (the smallest normal half) is rounded by adding a
+// float whose last bit is worth 2^-24, which lets the processor round it
+// (to nearest even), anything else by adding a rounding bias to its bits.
+static inline KOLIBA_HALF koliba_FloatToHalf(float f) {
+	kolibaFloatBits b, magic;
+	uint32_t s, h;
+
+	b.f = f;
+	s = (b.u >> 16) & 0x8000;
+	b.u &= 0x7FFFFFFF;
+	if (b.u >= 0x47800000)	// 65536 or more, infinite, or NaN
+		h = (b.u > 0x7F800000) ? 0x7E00 | ((b.u >> 13) & 0x3FF) : 0x7C00;
+	else if (b.u < 0x38800000) {
+		magic.u = 0x3F000000;	// 0.5
+		b.f += magic.f;
+		h = b.u - magic.u;
+	}
+	else h = (b.u + 0xC8000FFF + ((b.u >> 13) & 1)) >> 13;
+	return (KOLIBA_HALF)(s | h);
+}
+
+// The 10-bit channels of packed pixels, shifted by the sh array rather
+// than found at an offset, go the same way.
+static inline double koliba_TenBitToDouble(uint32_t v) {
+	return (double)(v & 0x3FF) / 1023.0;
+}
+
+static inline uint32_t koliba_DoubleToTenBit(double v) {
+	v += 0.5;
+	return (!(v > 0.0)) ? 0 : (v > 1023.0) ? 1023 : (uint32_t)v;
+}
+
+typedef void (*kolibaSpanLoad10)(kolibaSpanXyz *, const uint32_t *, size_t, const unsigned char *);
+typedef void (*kolibaSpanStore10)(uint32_t *, const uint32_t *, const kolibaSpanXyz *, size_t, const unsigned char *, double);
+
+// Expand n pixels of three bytes to four (the fourth byte being zero), or
+// pack them back.
+typedef void (*kolibaSpanRepack24)(uint8_t *, const uint8_t *, size_t);
+
+// Read n bytes of one plane (through a table of 256 doubles) into one
+// array of a chunk.
+typedef void (*kolibaSpanLoadPlane8)(double *, const uint8_t *, size_t, const double *);
+
+typedef void (*kolibaSpanLoadHalf)(kolibaSpanXyz32 *, const uint16_t *, size_t, const unsigned char *);
+typedef void (*kolibaSpanStoreHalf)(uint16_t *, const uint16_t *, const kolibaSpanXyz32 *, size_t, const unsigned char *);
+
+typedef void (*kolibaSpanLoad16)(kolibaSpanXyz *, const uint16_t *, size_t, const unsigned char *);
+typedef void (*kolibaSpanStore16)(uint16_t *, const uint16_t *, const kolibaSpanXyz *, size_t, const unsigned char *, double);
+
+// The single-precision kernels read their pixels straight into a float
+// chunk, and write them back along with the alpha channel of the input.
+typedef void (*kolibaSpanKernel32)(kolibaSpanXyz32 *, size_t, const kolibaSpanFlut32 *);
+typedef void (*kolibaSpanLoadFloat)(kolibaSpanXyz32 *, const float *, size_t, const unsigned char *);
+typedef void (*kolibaSpanStoreFloat)(float *, const float *, const kolibaSpanXyz32 *, size_t, const unsigned char *);
+
+// The fixed-point kernels need no chunks, they read the 8-bit pixels,
+// blend them, and write them back (alpha included) in one go.
+typedef void (*kolibaSpanFixed)(uint8_t *, const uint8_t *, size_t, const KOLIBA_FIXEDFLUT *, const unsigned char *);
+
+typedef struct {
+	kolibaSpanKernel kernel[KOLIBA_KERNELS];
+	kolibaSpanLoad8 load8;
+	kolibaSpanLoad32 load32;
+	kolibaSpanKernel32 kernel32[KOLIBA_KERNELS];
+	kolibaSpanLoadFloat loadf;
+	kolibaSpanStoreFloat storef;
+	kolibaSpanFixed fixed[KOLIBA_KERNELS];
+	kolibaSpanLoad16 load16;
+	kolibaSpanStore16 store16;
+	kolibaSpanLoadHalf loadh;
+	kolibaSpanStoreHalf storeh;
+	kolibaSpanLoad10 load10;
+	kolibaSpanStore10 store10;
+	kolibaSpanRepack24 expand24;
+	kolibaSpanRepack24 pack24;
+	kolibaSpanLoadPlane8 loadp8;
+} kolibaSpanIsa;
+
+// The portable ones, from kolibaspan.c.
+KLBHID void koliba_SpanLoad8(kolibaSpanXyz *c, const uint8_t *p, size_t n, const unsigned char *off, const double *table);
+KLBHID void koliba_SpanLoad32(kolibaSpanXyz *c, const float *p, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanLoadFloat(kolibaSpanXyz32 *c, const float *p, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanStoreFloat(float *o, const float *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanLoad16(kolibaSpanXyz *c, const uint16_t *p, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanStore16(uint16_t *o, const uint16_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *off, double scale);
+KLBHID void koliba_SpanLoadHalf(kolibaSpanXyz32 *c, const uint16_t *p, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanStoreHalf(uint16_t *o, const uint16_t *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off);
+KLBHID void koliba_SpanLoad10(kolibaSpanXyz *c, const uint32_t *p, size_t n, const unsigned char *sh);
+KLBHID void koliba_SpanStore10(uint32_t *o, const uint32_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *sh, double scale);
+KLBHID void koliba_SpanExpand24(uint8_t *o, const uint8_t *p, size_t n);
+KLBHID void koliba_SpanPack24(uint8_t *o, const uint8_t *p, size_t n);
+KLBHID void koliba_SpanLoadPlane8(double *d, const uint8_t *p, size_t n, const double *table);
+KLBHID void koliba_SpanFixed1D(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off);
+KLBHID void koliba_SpanFixedMatrix(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off);
+KLBHID void koliba_SpanFixedTrilinear(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off);
+
+// The processor-specific ones, from kolibasimd.c. Returns NULL if the
+// isa is not compiled in or this processor cannot do it.
+KLBHID const kolibaSpanIsa * koliba_SimdIsa(KOLIBA_SPANISA isa);
+
+#endif	// _KOLIBASIMD_H_
@@ -0,0 +1,1918 @@
+/*
+
+	kolibaspan.c
+
+	Copyright 2021 G. Adam Stanislav
+	All rights reserved
+
+	Redistribution and use in source and binary forms,
+	with or without modification, are permitted provided
+	that the following conditions are met:
+
+	1. Redistributions of source code must retain the
+	above copyright notice, this list of conditions
+	and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the
+	above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or
+	other materials provided with the distribution.
+
+	3. Neither the name of the copyright holder nor the
+	names of its contributors may be used to endorse or
+	promote products derived from this software without
+	specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS
+	AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+	WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+	FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+	OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+	PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+	STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+	OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "kolibasimd.h"
+#include <math.h>
+#if	!defined(__STDC_NO_ATOMICS__) && defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#include <stdatomic.h>
+#define	KLBATOMICISA
+#endif
+
+// Most FLUTs only use a few of the 24 factors, and they use them in one of a
+// handful of patterns. So rather than looking at the flags for every pixel,
+// we pick a kernel for the pattern once per span:
+//
+//	KOLIBA_1DFlutFlags (which are also KOLIBA_IdentityFlutFlags)
+//		Each channel only depends on itself, black + red.r * x and so on.
+//
+//	KOLIBA_GrayFlutFlags
+//		A linear transform, a 3x3 matrix.
+//
+//	KOLIBA_MatrixFlutFlags
+//		An affine transform, a 3x4 matrix.
+//
+//	KOLIBA_AllFlutFlags
+//		The whole trilinear blend.
+//
+// Any flags that fall within one of these patterns use its kernel, and
+// anything else uses the trilinear one. That works because we first copy
+// the FLUT with every factor the flags turn off set to zero, so no kernel
+// ever needs to test a flag.
+//
+// We also turn off the flags of the factors that are zero anyway. The
+// library always sets the three black flags, for one, and a FLUT made from
+// a matrix (a channel blend, a chromatic matrix, a Rec. conversion) often
+// comes with all flags set. Either way, the kernel for the factors that are
+// really there gives the same results faster.
+//
+// All the kernels add the terms in the same order, black first, white last,
+// so the SIMD ones only differ from these by fusing the multiply-adds. They
+// are written once for both doubles (kolibaSpanXyz) and floats
+// (kolibaSpanXyz32).
+#define	KLBSCALAR(S,E,C,F)\
+static void koliba_Scalar1D##S(C *c, size_t n, const F *f) {\
+	const E kr = f->m.Black.r, kg = f->m.Black.g, kb = f->m.Black.b;\
+	const E rr = f->m.Red.r, gg = f->m.Green.g, bb = f->m.Blue.b;\
+	size_t i;\
+	for (i = 0; i < n; i++) {\
+		c->x[i] = kr + rr * c->x[i];\
+		c->y[i] = kg + gg * c->y[i];\
+		c->z[i] = kb + bb * c->z[i];\
+	}\
+}\
+\
+static void koliba_ScalarMatrix##S(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	E x, y, z;\
+	size_t i;\
+	for (i = 0; i < n; i++) {\
+		x = c->x[i];\
+		y = c->y[i];\
+		z = c->z[i];\
+		c->x[i] = m[0] + m[3] * x + m[6] * y + m[9] * z;\
+		c->y[i] = m[1] + m[4] * x + m[7] * y + m[10] * z;\
+		c->z[i] = m[2] + m[5] * x + m[8] * y + m[11] * z;\
+	}\
+}\
+\
+static void koliba_Scalar3x3##S(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	E x, y, z;\
+	size_t i;\
+	for (i = 0; i < n; i++) {\
+		x = c->x[i];\
+		y = c->y[i];\
+		z = c->z[i];\
+		c->x[i] = m[3] * x + m[6] * y + m[9] * z;\
+		c->y[i] = m[4] * x + m[7] * y + m[10] * z;\
+		c->z[i] = m[5] * x + m[8] * y + m[11] * z;\
+	}\
+}\
+\
+static void koliba_ScalarTrilinear##S(C *c, size_t n, const F *f) {\
+	const E *m = (const E *)&f->m;\
+	E x, y, z, xy, xz, yz, xyz;\
+	size_t i;\
+	for (i = 0; i < n; i++) {\
+		x = c->x[i];\
+		y = c->y[i];\
+		z = c->z[i];\
+		xy = x * y;\
+		xz = x * z;\
+		yz = y * z;\
+		xyz = xy * z;\
+		c->x[i] = m[0] + m[3] * x + m[6] * y + m[9] * z + m[12] * xy + m[15] * xz + m[18] * yz + m[21] * xyz;\
+		c->y[i] = m[1] + m[4] * x + m[7] * y + m[10] * z + m[13] * xy + m[16] * xz + m[19] * yz + m[22] * xyz;\
+		c->z[i] = m[2] + m[5] * x + m[8] * y + m[11] * z + m[14] * xy + m[17] * xz + m[20] * yz + m[23] * xyz;\
+	}\
+}
+
+KLBSCALAR(, double, kolibaSpanXyz, kolibaSpanFlut)
+KLBSCALAR(32, float, kolibaSpanXyz32, kolibaSpanFlut32)
+
+// The reference "kernel" just calls the library, whatever the flags.
+static void koliba_Reference(kolibaSpanXyz *c, size_t n, const kolibaSpanFlut *f) {
+	KOLIBA_XYZ xyz;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		xyz.x = c->x[i];
+		xyz.y = c->y[i];
+		xyz.z = c->z[i];
+		KOLIBA_ApplyXyz(&xyz, &xyz, f->fLut, f->flags);
+		c->x[i] = xyz.x;
+		c->y[i] = xyz.y;
+		c->z[i] = xyz.z;
+	}
+}
+
+// In single precision, the reference calls the library with the float
+// factors widened to doubles. They are already masked, so all flags do.
+static void koliba_Reference32(kolibaSpanXyz32 *c, size_t n, const kolibaSpanFlut32 *f) {
+	KOLIBA_FLUT fLut;
+	KOLIBA_XYZ xyz;
+	const float *s = (const float *)&f->m;
+	double *d = (double *)&fLut;
+	size_t i;
+
+	for (i = 0; i < 24; i++)
+		d[i] = s[i];
+	for (i = 0; i < n; i++) {
+		xyz.x = c->x[i];
+		xyz.y = c->y[i];
+		xyz.z = c->z[i];
+		KOLIBA_ApplyXyz(&xyz, &xyz, &fLut, KOLIBA_AllFlutFlags);
+		c->x[i] = (float)xyz.x;
+		c->y[i] = (float)xyz.y;
+		c->z[i] = (float)xyz.z;
+	}
+}
+
+KLBHID void koliba_SpanLoad8(kolibaSpanXyz *c, const uint8_t *p, size_t n, const unsigned char *off, const double *table) {
+	size_t i;
+
+	for (i = 0; i < n; i++, p += 4) {
+		c->x[i] = table[p[off[0]]];
+		c->y[i] = table[p[off[1]]];
+		c->z[i] = table[p[off[2]]];
+	}
+}
+
+KLBHID void koliba_SpanLoad32(kolibaSpanXyz *c, const float *p, size_t n, const unsigned char *off) {
+	size_t i;
+
+	for (i = 0; i < n; i++, p += 4) {
+		c->x[i] = p[off[0]];
+		c->y[i] = p[off[1]];
+		c->z[i] = p[off[2]];
+	}
+}
+
+KLBHID void koliba_SpanLoadFloat(kolibaSpanXyz32 *c, const float *p, size_t n, const unsigned char *off) {
+	size_t i;
+
+	for (i = 0; i < n; i++, p += 4) {
+		c->x[i] = p[off[0]];
+		c->y[i] = p[off[1]];
+		c->z[i] = p[off[2]];
+	}
+}
+
+// The alpha channel is whichever of the four the other three are not.
+KLBHID void koliba_SpanStoreFloat(float *o, const float *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 4, p += 4) {
+		o[a] = p[a];
+		o[off[0]] = c->x[i];
+		o[off[1]] = c->y[i];
+		o[off[2]] = c->z[i];
+	}
+}
+
+KLBHID void koliba_SpanLoad16(kolibaSpanXyz *c, const uint16_t *p, size_t n, const unsigned char *off) {
+	size_t i;
+
+	for (i = 0; i < n; i++, p += 4) {
+		c->x[i] = koliba_WordToDouble(p[off[0]]);
+		c->y[i] = koliba_WordToDouble(p[off[1]]);
+		c->z[i] = koliba_WordToDouble(p[off[2]]);
+	}
+}
+
+KLBHID void koliba_SpanStore16(uint16_t *o, const uint16_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *off, double scale) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 4, p += 4) {
+		o[a] = p[a];
+		o[off[0]] = koliba_DoubleToWord(c->x[i] * scale);
+		o[off[1]] = koliba_DoubleToWord(c->y[i] * scale);
+		o[off[2]] = koliba_DoubleToWord(c->z[i] * scale);
+	}
+}
+
+KLBHID void koliba_SpanLoadHalf(kolibaSpanXyz32 *c, const uint16_t *p, size_t n, const unsigned char *off) {
+	size_t i;
+
+	for (i = 0; i < n; i++, p += 4) {
+		c->x[i] = koliba_HalfToFloat(p[off[0]]);
+		c->y[i] = koliba_HalfToFloat(p[off[1]]);
+		c->z[i] = koliba_HalfToFloat(p[off[2]]);
+	}
+}
+
+KLBHID void koliba_SpanStoreHalf(uint16_t *o, const uint16_t *p, const kolibaSpanXyz32 *c, size_t n, const unsigned char *off) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 4, p += 4) {
+		o[a] = p[a];
+		o[off[0]] = koliba_FloatToHalf(c->x[i]);
+		o[off[1]] = koliba_FloatToHalf(c->y[i]);
+		o[off[2]] = koliba_FloatToHalf(c->z[i]);
+	}
+}
+
+KLBHID void koliba_SpanLoad10(kolibaSpanXyz *c, const uint32_t *p, size_t n, const unsigned char *sh) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		c->x[i] = koliba_TenBitToDouble(p[i] >> sh[0]);
+		c->y[i] = koliba_TenBitToDouble(p[i] >> sh[1]);
+		c->z[i] = koliba_TenBitToDouble(p[i] >> sh[2]);
+	}
+}
+
+KLBHID void koliba_SpanStore10(uint32_t *o, const uint32_t *p, const kolibaSpanXyz *c, size_t n, const unsigned char *sh, double scale) {
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		o[i] = (p[i] & 0xC0000000)
+			| (koliba_DoubleToTenBit(c->x[i] * scale) << sh[0])
+			| (koliba_DoubleToTenBit(c->y[i] * scale) << sh[1])
+			| (koliba_DoubleToTenBit(c->z[i] * scale) << sh[2]);
+}
+
+KLBHID void koliba_SpanExpand24(uint8_t *o, const uint8_t *p, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 4, p += 3) {
+		o[0] = p[0];
+		o[1] = p[1];
+		o[2] = p[2];
+		o[3] = 0;
+	}
+}
+
+KLBHID void koliba_SpanPack24(uint8_t *o, const uint8_t *p, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 3, p += 4) {
+		o[0] = p[0];
+		o[1] = p[1];
+		o[2] = p[2];
+	}
+}
+
+KLBHID void koliba_SpanLoadPlane8(double *d, const uint8_t *p, size_t n, const double *table) {
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		d[i] = table[p[i]];
+}
+
+// The fixed-point blend, done exactly as the SIMD kernels do it, so they
+// can leave the last few pixels of a span to us and still match. A channel
+// byte c becomes c * 32768 / 255 (give or take 1), and the 16-bit products
+// round to nearest just as pmulhrsw does. The SIMD kernels add with
+// saturation, but KOLIBA_ConvertScaledFlutToFixedFlut picks the bits so no
+// sum ever saturates, and plain adds give the same.
+
+static inline int koliba_FixedMul(int a, int b) {
+	return (a * b + 0x4000) >> 15;
+}
+
+static inline void koliba_SpanFixed(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off, kolibaSpanKernelType kernel) {
+	const unsigned int a = 6 - off[0] - off[1] - off[2];
+	const short *m = (const short *)f;
+	int x[3], xy = 0, xz = 0, yz = 0, xyz = 0, v[3];
+	unsigned int c;
+	size_t i;
+
+	for (i = 0; i < n; i++, o += 4, p += 4) {
+		for (c = 0; c < 3; c++)
+			x[c] = (p[off[c]] << 7) + (p[off[c]] >> 1);
+		if (kernel == KOLIBA_KERNELTRILINEAR) {
+			xy = koliba_FixedMul(x[0], x[1]);
+			xz = koliba_FixedMul(x[0], x[2]);
+			yz = koliba_FixedMul(x[1], x[2]);
+			xyz = koliba_FixedMul(xy, x[2]);
+		}
+		for (c = 0; c < 3; c++) {
+			if (kernel == KOLIBA_KERNEL1D)
+				v[c] = m[c] + koliba_FixedMul(m[3 + 4 * c], x[c]);
+			else {
+				v[c] = m[c] + koliba_FixedMul(m[3 + c], x[0]);
+				v[c] += koliba_FixedMul(m[6 + c], x[1]);
+				v[c] += koliba_FixedMul(m[9 + c], x[2]);
+			}
+			if (kernel == KOLIBA_KERNELTRILINEAR) {
+				v[c] += koliba_FixedMul(m[12 + c], xy);
+				v[c] += koliba_FixedMul(m[15 + c], xz);
+				v[c] += koliba_FixedMul(m[18 + c], yz);
+				v[c] += koliba_FixedMul(m[21 + c], xyz);
+			}
+			v[c] >>= f->bits;
+		}
+		o[a] = p[a];
+		for (c = 0; c < 3; c++)
+			o[off[c]] = (v[c] < 0) ? 0 : (v[c] > 255) ? 255 : v[c];
+	}
+}
+
+KLBHID void koliba_SpanFixed1D(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off) {
+	koliba_SpanFixed(o, p, n, f, off, KOLIBA_KERNEL1D);
+}
+
+KLBHID void koliba_SpanFixedMatrix(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off) {
+	koliba_SpanFixed(o, p, n, f, off, KOLIBA_KERNELMATRIX);
+}
+
+KLBHID void koliba_SpanFixedTrilinear(uint8_t *o, const uint8_t *p, size_t n, const KOLIBA_FIXEDFLUT *f, const unsigned char *off) {
+	koliba_SpanFixed(o, p, n, f, off, KOLIBA_KERNELTRILINEAR);
+}
+
+static const kolibaSpanIsa kolibaReferenceIsa = {
+	{koliba_Reference, koliba_Reference, koliba_Reference, koliba_Reference},
+	koliba_SpanLoad8,
+	koliba_SpanLoad32,
+	{koliba_Reference32, koliba_Reference32, koliba_Reference32, koliba_Reference32},
+	koliba_SpanLoadFloat,
+	koliba_SpanStoreFloat,
+	{koliba_SpanFixed1D, koliba_SpanFixedMatrix, koliba_SpanFixedMatrix, koliba_SpanFixedTrilinear},
+	koliba_SpanLoad16,
+	koliba_SpanStore16,
+	koliba_SpanLoadHalf,
+	koliba_SpanStoreHalf,
+	koliba_SpanLoad10,
+	koliba_SpanStore10,
+	koliba_SpanExpand24,
+	koliba_SpanPack24,
+	koliba_SpanLoadPlane8
+};
+
+static const kolibaSpanIsa kolibaScalarIsa = {
+	{koliba_Scalar1D, koliba_Scalar3x3, koliba_ScalarMatrix, koliba_ScalarTrilinear},
+	koliba_SpanLoad8,
+	koliba_SpanLoad32,
+	{koliba_Scalar1D32, koliba_Scalar3x332, koliba_ScalarMatrix32, koliba_ScalarTrilinear32},
+	koliba_SpanLoadFloat,
+	koliba_SpanStoreFloat,
+	{koliba_SpanFixed1D, koliba_SpanFixedMatrix, koliba_SpanFixedMatrix, koliba_SpanFixedTrilinear},
+	koliba_SpanLoad16,
+	koliba_SpanStore16,
+	koliba_SpanLoadHalf,
+	koliba_SpanStoreHalf,
+	koliba_SpanLoad10,
+	koliba_SpanStore10,
+	koliba_SpanExpand24,
+	koliba_SpanPack24,
+	koliba_SpanLoadPlane8
+};
+
+KLBHID const char * const KOLIBA_SpanIsaNames[KOLIBA_SPANISAS] = {
+	"reference",
+	"scalar",
+	"sse4.2",
+	"avx2",
+	"avx512"
+};
+
+// KOLIBA_SPANISAS means we have not decided yet. Any thread that finds it
+// so decides the same, but only the first one gets to store it, so it cannot
+// overwrite a KOLIBA_SetSpanIsa() made in the meantime. The setting belongs
+// to the process, not to any one interpreter, just like the processor does.
+#ifdef	KLBATOMICISA
+static _Atomic int koliba_spanIsa = KOLIBA_SPANISAS;
+#else
+static volatile int koliba_spanIsa = KOLIBA_SPANISAS;
+#endif
+
+static const kolibaSpanIsa * koliba_Isa(KOLIBA_SPANISA isa) {
+	switch (isa) {
+		case KOLIBA_SPANREFERENCE: return &kolibaReferenceIsa;
+		case KOLIBA_SPANSCALAR: return &kolibaScalarIsa;
+		default: return koliba_SimdIsa(isa);
+	}
+}
+
+KLBHID bool KOLIBA_SpanIsaAvailable(KOLIBA_SPANISA isa) {
+	return ((unsigned int)isa < KOLIBA_SPANISAS) && (koliba_Isa(isa) != NULL);
+}
+
+KLBHID KOLIBA_SPANISA KOLIBA_BestSpanIsa(void) {
+	KOLIBA_SPANISA isa;
+
+	for (isa = KOLIBA_SPANAVX512; isa > KOLIBA_SPANSCALAR; isa--)
+		if (koliba_SimdIsa(isa)) break;
+	return isa;
+}
+
+KLBHID KOLIBA_SPANISA KOLIBA_GetSpanIsa(void) {
+#ifdef	KLBATOMICISA
+	int isa = atomic_load_explicit(&koliba_spanIsa, memory_order_relaxed);
+
+	if (isa == KOLIBA_SPANISAS) {
+		int best = (int)KOLIBA_BestSpanIsa();
+
+		// On failure isa becomes whatever got there first.
+		if (atomic_compare_exchange_strong_explicit(&koliba_spanIsa, &isa, best, memory_order_relaxed, memory_order_relaxed))
+			isa = best;
+	}
+	return (KOLIBA_SPANISA)isa;
+#else
+	int isa = koliba_spanIsa;
+
+	if (isa == KOLIBA_SPANISAS) koliba_spanIsa = isa = (int)KOLIBA_BestSpanIsa();
+	return (KOLIBA_SPANISA)isa;
+#endif
+}
+
+KLBHID bool KOLIBA_SetSpanIsa(KOLIBA_SPANISA isa) {
+	if (!KOLIBA_SpanIsaAvailable(isa)) return false;
+#ifdef	KLBATOMICISA
+	atomic_store_explicit(&koliba_spanIsa, (int)isa, memory_order_relaxed);
+#else
+	koliba_spanIsa = (int)isa;
+#endif
+	return true;
+}
+
+// Which kernel do the flags need?
+static kolibaSpanKernelType koliba_SpanKernelType(KOLIBA_FLAGS flags) {
+	if ((flags & ~KOLIBA_1DFlutFlags) == 0) return KOLIBA_KERNEL1D;
+	if ((flags & ~KOLIBA_GrayFlutFlags) == 0) return KOLIBA_KERNEL3X3;
+	if ((flags & ~KOLIBA_MatrixFlutFlags) == 0) return KOLIBA_KERNELMATRIX;
+	return KOLIBA_KERNELTRILINEAR;
+}
+
+// Mask the FLUT and pick the kernel for its flags. Bit i of the flags
+// belongs to the i-th double of the FLUT.
+static kolibaSpanKernel koliba_SpanKernel(kolibaSpanFlut *f, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const kolibaSpanIsa **isa) {
+	const double *s = (const double *)fLut;
+	double *d = (double *)&f->m;
+	unsigned int i;
+
+	f->fLut = fLut;
+	f->flags = flags;
+	for (i = 0; i < 24; i++)
+		if ((d[i] = (flags & (1 << i)) ? s[i] : 0.0) == 0.0) flags &= ~(1 << i);
+	*isa = koliba_Isa(KOLIBA_GetSpanIsa());
+	return (*isa)->kernel[koliba_SpanKernelType(flags)];
+}
+
+static kolibaSpanKernel32 koliba_SpanKernel32(kolibaSpanFlut32 *f, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags, const kolibaSpanIsa **isa) {
+	const float *s = (const float *)fLut;
+	float *d = (float *)&f->m;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++)
+		if ((d[i] = (flags & (1 << i)) ? s[i] : 0.0f) == 0.0f) flags &= ~(1 << i);
+	*isa = koliba_Isa(KOLIBA_GetSpanIsa());
+	return (*isa)->kernel32[koliba_SpanKernelType(flags)];
+}
+
+KLBHID KOLIBA_FLUT32 * KOLIBA_ConvertFlutToFlut32(KOLIBA_FLUT32 *f32, const KOLIBA_FLUT *fLut) {
+	const double *s = (const double *)fLut;
+	float *d = (float *)f32;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++)
+		d[i] = (float)s[i];
+	return f32;
+}
+
+KLBHID double KOLIBA_Flut32ErrorBound(const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	const double *s = (const double *)fLut;
+	double sum = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++)
+		if (flags & (1 << i)) sum += fabs(s[i]);
+	return 13.0 * sum / 16777216.0;
+}
+
+// The largest sum of the absolute values of the used factors of any one
+// channel, and how many fractional bits that leaves us. Each of the eight
+// factors can round up by half, and each of the seven products by another
+// half, so we keep 8 to spare.
+static double koliba_FixedSum(const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	const double *s = (const double *)fLut;
+	double sum, max = 0.0;
+	unsigned int c, i;
+
+	for (c = 0; c < 3; c++) {
+		for (sum = 0.0, i = c; i < 24; i += 3)
+			if (flags & (1 << i)) sum += fabs(s[i]);
+		if (sum > max) max = sum;
+	}
+	return max;
+}
+
+static unsigned int koliba_FixedBits(double sum) {
+	unsigned int bits;
+
+	for (bits = 12; bits > 0; bits--)
+		if (sum * (1 << bits) + (1 << (bits - 1)) + 8.0 <= 32767.0) break;
+	return bits;
+}
+
+KLBHID double KOLIBA_FixedFlutErrorBound(const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	double sum = koliba_FixedSum(fLut, flags);
+	unsigned int bits = koliba_FixedBits(sum);
+
+	if (bits == 0) return HUGE_VAL;
+	return 4.0 * sum / 32768.0 + 7.5 / (1 << bits);
+}
+
+KLBHID KOLIBA_FIXEDFLUT * KOLIBA_ConvertScaledFlutToFixedFlut(KOLIBA_FIXEDFLUT *ff, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	const double *s = (const double *)fLut;
+	short *d = (short *)ff;
+	unsigned int bits, i;
+
+	if (!(KOLIBA_FixedFlutErrorBound(fLut, flags) < 1.0)) return NULL;
+	bits = koliba_FixedBits(koliba_FixedSum(fLut, flags));
+	for (i = 0; i < 24; i++)
+		d[i] = (flags & (1 << i)) ? (short)lround(s[i] * (1 << bits)) : 0;
+	for (i = 0; i < 3; i++)
+		d[i] += 1 << (bits - 1);
+	ff->bits = bits;
+	return ff;
+}
+
+// A 1D FLUT applied to a gray pixel of each byte gives us all three tables
+// at once.
+KLBHID KOLIBA_BYTETABLES * KOLIBA_ConvertScaledFlutToByteTables(KOLIBA_BYTETABLES *t, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {
+	const double *s = (const double *)fLut;
+	KOLIBA_FLAGS used = flags;
+	KOLIBA_RGBA8PIXEL px;
+	KOLIBA_XYZ xyz;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++)
+		if (s[i] == 0.0) used &= ~(1 << i);
+	if (koliba_SpanKernelType(used) != KOLIBA_KERNEL1D) return NULL;
+	for (i = 0; i < 256; i++) {
+		px.r = px.g = px.b = i;
+		KOLIBA_ScaledXyzToRgba8Pixel(&px, KOLIBA_ApplyXyz(&xyz, KOLIBA_Rgba8PixelToXyz(&xyz, &px, iconv), fLut, flags), oconv);
+		t->r[i] = px.r;
+		t->g[i] = px.g;
+		t->b[i] = px.b;
+	}
+	return t;
+}
+
+KLBHID KOLIBA_FLUTKIND KOLIBA_FlutKind(const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	const double *s = (const double *)fLut;
+	const double *id = (const double *)&KOLIBA_IdentityFlut;
+	bool identity = true, constant = true;
+	double d;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++) {
+		d = (flags & (1 << i)) ? s[i] : 0.0;
+		if (d != id[i]) identity = false;
+		if ((d != 0.0) && !(KOLIBA_BlackFlutFlags & (1 << i))) constant = false;
+	}
+	return (identity) ? KOLIBA_FLUTIDENTITY : (constant) ? KOLIBA_FLUTCONSTANT : KOLIBA_FLUTGENERAL;
+}
+
+// Everything converts its elements to doubles a chunk at a time, runs the
+// kernel on the chunk in place, and converts it back.
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyXyzArray(KOLIBA_XYZ * xyzout, const KOLIBA_XYZ * xyzin, size_t n, const KOLIBA_FLUT * const fLut, KOLIBA_FLAGS flags) {
+	kolibaSpanFlut f;
+	kolibaSpanXyz c;
+	KOLIBA_XYZ xyz;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel;
+	KOLIBA_XYZ *o = xyzout;
+	size_t k, i;
+
+	switch (KOLIBA_FlutKind(fLut, flags)) {
+		case KOLIBA_FLUTIDENTITY:
+			if (xyzout != xyzin) memmove(xyzout, xyzin, n * sizeof(KOLIBA_XYZ));
+			return xyzout;
+		case KOLIBA_FLUTCONSTANT:
+			xyz.x = xyz.y = xyz.z = 0.0;
+			KOLIBA_ApplyXyz(&xyz, &xyz, fLut, flags);
+			for (i = 0; i < n; i++)
+				o[i] = xyz;
+			return xyzout;
+		default:
+			break;
+	}
+	kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+	for (; n > 0; n -= k, xyzin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		for (i = 0; i < k; i++) {
+			c.x[i] = xyzin[i].x;
+			c.y[i] = xyzin[i].y;
+			c.z[i] = xyzin[i].z;
+		}
+		kernel(&c, k, &f);
+		for (i = 0; i < k; i++) {
+			o[i].x = c.x[i];
+			o[i].y = c.y[i];
+			o[i].z = c.z[i];
+		}
+	}
+	return xyzout;
+}
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyMatrixArray(KOLIBA_XYZ * xyzout, const KOLIBA_XYZ * xyzin, size_t n, const KOLIBA_MATRIX * const mat) {
+	KOLIBA_FLUT fLut;
+
+	KOLIBA_ConvertMatrixToFlut(&fLut, mat);
+	return KOLIBA_ApplyXyzArray(xyzout, xyzin, n, &fLut, (KOLIBA_MatrixIs3x3(mat)) ? KOLIBA_GrayFlutFlags : KOLIBA_MatrixFlutFlags);
+}
+
+KLBHID KOLIBA_PIXEL * KOLIBA_ApplyPixelArray(KOLIBA_PIXEL *pxout, const KOLIBA_PIXEL *pxin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBAPIXELTOXYZ transformin, KOLIBAXYZTOPIXEL transformout) {
+	kolibaSpanFlut f;
+	kolibaSpanXyz c;
+	KOLIBA_XYZ xyz;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+	KOLIBA_PIXEL *o = pxout;
+	size_t k, i;
+
+	for (; n > 0; n -= k, pxin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		for (i = 0; i < k; i++) {
+			if (transformin) transformin(&xyz, pxin + i);
+			else {
+				xyz.x = pxin[i].red;
+				xyz.y = pxin[i].green;
+				xyz.z = pxin[i].blue;
+			}
+			c.x[i] = xyz.x;
+			c.y[i] = xyz.y;
+			c.z[i] = xyz.z;
+		}
+		kernel(&c, k, &f);
+		for (i = 0; i < k; i++) {
+			xyz.x = c.x[i];
+			xyz.y = c.y[i];
+			xyz.z = c.z[i];
+			if (transformout) transformout(o + i, &xyz);
+			else {
+				o[i].red = (float)xyz.x;
+				o[i].green = (float)xyz.y;
+				o[i].blue = (float)xyz.z;
+			}
+		}
+	}
+	return pxout;
+}
+
+// The 8-bit pixels are read through a table of 256 doubles, then handed to
+// the library to convert back to bytes, so they round and clamp exactly as
+// they do one pixel at a time.
+
+#define	KLBSPAN8(N,T,S)\
+KLBHID T * KOLIBA_##S##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {\
+	static const unsigned char off[3] = {offsetof(T, r), offsetof(T, g), offsetof(T, b)};\
+	kolibaSpanFlut f;\
+	kolibaSpanXyz c;\
+	KOLIBA_XYZ xyz;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);\
+	const double *ic = (iconv) ? iconv : KOLIBA_ByteDiv255;\
+	T *o = pixelout;\
+	size_t k, i;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->load8(&c, (const uint8_t *)pixelin, k, off, ic);\
+		kernel(&c, k, &f);\
+		for (i = 0; i < k; i++) {\
+			xyz.x = c.x[i];\
+			xyz.y = c.y[i];\
+			xyz.z = c.z[i];\
+			KOLIBA_##S##XyzTo##N##Pixel(o + i, &xyz, oconv)->a = pixelin[i].a;\
+		}\
+	}\
+	return pixelout;\
+}
+
+KLBSPAN8(Rgba8, KOLIBA_RGBA8PIXEL,)
+KLBSPAN8(Bgra8, KOLIBA_BGRA8PIXEL,)
+KLBSPAN8(Argb8, KOLIBA_ARGB8PIXEL,)
+KLBSPAN8(Abgr8, KOLIBA_ABGR8PIXEL,)
+KLBSPAN8(Rgba8, KOLIBA_RGBA8PIXEL, Scaled)
+KLBSPAN8(Bgra8, KOLIBA_BGRA8PIXEL, Scaled)
+KLBSPAN8(Argb8, KOLIBA_ARGB8PIXEL, Scaled)
+KLBSPAN8(Abgr8, KOLIBA_ABGR8PIXEL, Scaled)
+
+// Without any conversion routines, the 32-bit pixels are just widened to
+// doubles and narrowed back, which we do right here.
+
+#define	KLBSPAN32(N,T)\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(float), offsetof(T, g) / sizeof(float), offsetof(T, b) / sizeof(float)};\
+	kolibaSpanFlut f;\
+	kolibaSpanXyz c;\
+	KOLIBA_XYZ xyz;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);\
+	T *o = pixelout;\
+	size_t k, i;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		if (iconv) for (i = 0; i < k; i++) {\
+			KOLIBA_##N##PixelToXyz(&xyz, pixelin + i, iconv);\
+			c.x[i] = xyz.x;\
+			c.y[i] = xyz.y;\
+			c.z[i] = xyz.z;\
+		}\
+		else isa->load32(&c, (const float *)pixelin, k, off);\
+		kernel(&c, k, &f);\
+		for (i = 0; i < k; i++) {\
+			if (oconv) {\
+				xyz.x = c.x[i];\
+				xyz.y = c.y[i];\
+				xyz.z = c.z[i];\
+				KOLIBA_XyzTo##N##Pixel(o + i, &xyz, oconv);\
+			}\
+			else {\
+				o[i].r = (float)c.x[i];\
+				o[i].g = (float)c.y[i];\
+				o[i].b = (float)c.z[i];\
+			}\
+			o[i].a = pixelin[i].a;\
+		}\
+	}\
+	return pixelout;\
+}
+
+KLBSPAN32(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPAN32(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPAN32(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPAN32(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// The single-precision spans never leave floats.
+
+#define	KLBSPAN32S(N,T)\
+KLBHID T * KOLIBA_##N##PixelArray32(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(float), offsetof(T, g) / sizeof(float), offsetof(T, b) / sizeof(float)};\
+	kolibaSpanFlut32 f;\
+	kolibaSpanXyz32 c;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel32 kernel = koliba_SpanKernel32(&f, fLut, flags, &isa);\
+	T *o = pixelout;\
+	size_t k;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->loadf(&c, (const float *)pixelin, k, off);\
+		kernel(&c, k, &f);\
+		isa->storef((float *)o, (const float *)pixelin, &c, k, off);\
+	}\
+	return pixelout;\
+}
+
+KLBSPAN32S(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPAN32S(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPAN32S(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPAN32S(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// The fixed-point spans need no chunks, the kernels do it all.
+
+static kolibaSpanKernelType koliba_FixedKernelType(const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags) {
+	const short *m = (const short *)ff;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++)
+		if (m[i] == 0) flags &= ~(1 << i);
+	return koliba_SpanKernelType(flags);
+}
+
+#define	KLBSPANFIXED(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayFixed(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags) {\
+	static const unsigned char off[3] = {offsetof(T, r), offsetof(T, g), offsetof(T, b)};\
+	koliba_Isa(KOLIBA_GetSpanIsa())->fixed[koliba_FixedKernelType(ff, flags)]((uint8_t *)pixelout, (const uint8_t *)pixelin, n, ff, off);\
+	return pixelout;\
+}
+
+KLBSPANFIXED(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANFIXED(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANFIXED(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANFIXED(Abgr8, KOLIBA_ABGR8PIXEL)
+
+// The table lookups are not worth vectorizing, the processor does them
+// about as fast as it can move the pixels anyway.
+
+#define	KLBSPANTABLES(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayTables(T *pixelout, const T *pixelin, size_t n, const KOLIBA_BYTETABLES *t) {\
+	T *o = pixelout;\
+	for (; n > 0; n--, pixelin++, o++) {\
+		o->r = t->r[pixelin->r];\
+		o->g = t->g[pixelin->g];\
+		o->b = t->b[pixelin->b];\
+		o->a = pixelin->a;\
+	}\
+	return pixelout;\
+}
+
+KLBSPANTABLES(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANTABLES(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANTABLES(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANTABLES(Abgr8, KOLIBA_ABGR8PIXEL)
+
+// Find the cell of a lattice a pixel falls in, and how far into the cell
+// it is along each axis.
+static inline const KOLIBA_RGB * koliba_LatticeCell(const KOLIBA_LATTICE *l, double f[3], double x, double y, double z) {
+	const double in[3] = {x, y, z};
+	size_t o = 0;
+	unsigned int a, i;
+	double t;
+
+	for (a = 0; a < 3; a++) {
+		t = in[a] * l->dim[a];
+		i = (t >= l->dim[a]) ? l->dim[a] - 1 : (t > 0.0) ? (unsigned int)t : 0;
+		f[a] = t - i;
+		o += i * l->stride[a];
+	}
+	return l->cube + o;
+}
+
+#define	klblerp(a,b,t)	((a) + (t) * ((b) - (a)))
+
+static void koliba_LatticeTrilinear(kolibaSpanXyz *c, size_t n, const KOLIBA_LATTICE *l) {
+	const size_t sr = l->stride[0], sg = l->stride[1], sb = l->stride[2];
+	const KOLIBA_RGB *v;
+	double f[3];
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		v = koliba_LatticeCell(l, f, c->x[i], c->y[i], c->z[i]);
+#define	klbtri(ch)	klblerp(\
+	klblerp(klblerp(v[0].ch, v[sr].ch, f[0]), klblerp(v[sg].ch, v[sr+sg].ch, f[0]), f[1]),\
+	klblerp(klblerp(v[sb].ch, v[sr+sb].ch, f[0]), klblerp(v[sg+sb].ch, v[sr+sg+sb].ch, f[0]), f[1]),\
+	f[2])
+		c->x[i] = klbtri(r);
+		c->y[i] = klbtri(g);
+		c->z[i] = klbtri(b);
+#undef	klbtri
+	}
+}
+
+// Walking from black to white along the axes in the order of their
+// fractions, largest first, visits the 4 vertices of the tetrahedron. We
+// look the order up by the three comparisons of the fractions, since with
+// real pictures branching on them mispredicts a lot. (Two of the eight
+// combinations cannot happen with numbers, any order will do for NaNs.)
+static const unsigned char koliba_TetraOrder[8][3] = {
+	{2, 1, 0},	// f[2] > f[1] > f[0]
+	{2, 0, 1},	// f[2] > f[0] >= f[1]
+	{1, 2, 0},	// f[1] >= f[2] > f[0]
+	{0, 1, 2},
+	{0, 1, 2},
+	{0, 2, 1},	// f[0] >= f[2] > f[1]
+	{1, 0, 2},	// f[1] > f[0] >= f[2]
+	{0, 1, 2}	// f[0] >= f[1] >= f[2]
+};
+
+static void koliba_LatticeTetrahedral(kolibaSpanXyz *c, size_t n, const KOLIBA_LATTICE *l) {
+	const size_t s3 = l->stride[0] + l->stride[1] + l->stride[2];
+	const KOLIBA_RGB *v0, *v1, *v2, *v3;
+	const unsigned char *o;
+	double f[3], fa, fb, fc;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		v0 = koliba_LatticeCell(l, f, c->x[i], c->y[i], c->z[i]);
+		o = koliba_TetraOrder[(f[0] >= f[1]) | ((f[1] >= f[2]) << 1) | ((f[0] >= f[2]) << 2)];
+		fa = f[o[0]];
+		fb = f[o[1]];
+		fc = f[o[2]];
+		v1 = v0 + l->stride[o[0]];
+		v2 = v1 + l->stride[o[1]];
+		v3 = v0 + s3;
+		c->x[i] = v0->r + fa * (v1->r - v0->r) + fb * (v2->r - v1->r) + fc * (v3->r - v2->r);
+		c->y[i] = v0->g + fa * (v1->g - v0->g) + fb * (v2->g - v1->g) + fc * (v3->g - v2->g);
+		c->z[i] = v0->b + fa * (v1->b - v0->b) + fb * (v2->b - v1->b) + fc * (v3->b - v2->b);
+	}
+}
+
+#undef	klblerp
+
+typedef void (*kolibaLatticeKernel)(kolibaSpanXyz *, size_t, const KOLIBA_LATTICE *);
+
+static const kolibaLatticeKernel koliba_LatticeKernels[KLI_COUNT] = {
+	koliba_LatticeTrilinear,
+	koliba_LatticeTetrahedral
+};
+
+KLBHID KOLIBA_LATTICE * KOLIBA_ConvertCubeToLattice(KOLIBA_LATTICE *lattice, const KOLIBA_RGB *cube, const unsigned int dim[3], KOLIBA_INTERPOLATION mode) {
+	unsigned int a;
+
+	if ((unsigned int)mode >= KLI_COUNT) return NULL;
+	for (a = 0; a < 3; a++)
+		if ((dim[a] < 1) || (dim[a] > 256)) return NULL;
+	lattice->cube = cube;
+	lattice->mode = mode;
+	for (a = 0; a < 3; a++)
+		lattice->dim[a] = dim[a];
+	lattice->stride[0] = 1;
+	lattice->stride[1] = dim[0] + 1;
+	lattice->stride[2] = (size_t)(dim[0] + 1) * (dim[1] + 1);
+	return lattice;
+}
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyLatticeArray(KOLIBA_XYZ * xyzout, const KOLIBA_XYZ * xyzin, size_t n, const KOLIBA_LATTICE * const lattice) {
+	kolibaSpanXyz c;
+	kolibaLatticeKernel kernel = koliba_LatticeKernels[lattice->mode];
+	KOLIBA_XYZ *o = xyzout;
+	size_t k, i;
+
+	for (; n > 0; n -= k, xyzin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		for (i = 0; i < k; i++) {
+			c.x[i] = xyzin[i].x;
+			c.y[i] = xyzin[i].y;
+			c.z[i] = xyzin[i].z;
+		}
+		kernel(&c, k, lattice);
+		for (i = 0; i < k; i++) {
+			o[i].x = c.x[i];
+			o[i].y = c.y[i];
+			o[i].z = c.z[i];
+		}
+	}
+	return xyzout;
+}
+
+// The lattice spans load and store the pixels as the FLUT spans do, only
+// the lookups in between are not vectorized. They are bound by the memory
+// anyway.
+
+#define	KLBSPANLATTICE8(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv) {\
+	static const unsigned char off[3] = {offsetof(T, r), offsetof(T, g), offsetof(T, b)};\
+	kolibaSpanXyz c;\
+	KOLIBA_XYZ xyz;\
+	const kolibaSpanIsa *isa = koliba_Isa(KOLIBA_GetSpanIsa());\
+	kolibaLatticeKernel kernel = koliba_LatticeKernels[lattice->mode];\
+	const double *ic = (iconv) ? iconv : KOLIBA_ByteDiv255;\
+	T *o = pixelout;\
+	size_t k, i;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->load8(&c, (const uint8_t *)pixelin, k, off, ic);\
+		kernel(&c, k, lattice);\
+		for (i = 0; i < k; i++) {\
+			xyz.x = c.x[i];\
+			xyz.y = c.y[i];\
+			xyz.z = c.z[i];\
+			KOLIBA_XyzTo##N##Pixel(o + i, &xyz, oconv)->a = pixelin[i].a;\
+		}\
+	}\
+	return pixelout;\
+}
+
+#define	KLBSPANLATTICE32(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(float), offsetof(T, g) / sizeof(float), offsetof(T, b) / sizeof(float)};\
+	kolibaSpanXyz c;\
+	const kolibaSpanIsa *isa = koliba_Isa(KOLIBA_GetSpanIsa());\
+	kolibaLatticeKernel kernel = koliba_LatticeKernels[lattice->mode];\
+	T *o = pixelout;\
+	size_t k, i;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->load32(&c, (const float *)pixelin, k, off);\
+		kernel(&c, k, lattice);\
+		for (i = 0; i < k; i++) {\
+			o[i].r = (float)c.x[i];\
+			o[i].g = (float)c.y[i];\
+			o[i].b = (float)c.z[i];\
+			o[i].a = pixelin[i].a;\
+		}\
+	}\
+	return pixelout;\
+}
+
+KLBSPANLATTICE8(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANLATTICE8(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANLATTICE8(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANLATTICE8(Abgr8, KOLIBA_ABGR8PIXEL)
+KLBSPANLATTICE32(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPANLATTICE32(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPANLATTICE32(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPANLATTICE32(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// The 16-bit pixels. Everything goes through the same conversions as the
+// spans do, so a span gives the same as its pixels one at a time (as long
+// as the kernels agree).
+
+KLBHID KOLIBA_XYZ * KOLIBA_Rgba16PixelToXyz(KOLIBA_XYZ *xyz, const KOLIBA_RGBA16PIXEL * const px, KOLIBA_DBLCONV iconv) {
+	xyz->x = koliba_WordToDouble(px->r);
+	xyz->y = koliba_WordToDouble(px->g);
+	xyz->z = koliba_WordToDouble(px->b);
+	if (iconv) {
+		xyz->x = iconv(xyz->x);
+		xyz->y = iconv(xyz->y);
+		xyz->z = iconv(xyz->z);
+	}
+	return xyz;
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_XyzToRgba16Pixel(KOLIBA_RGBA16PIXEL *px, const KOLIBA_XYZ * const xyz, KOLIBA_DBLCONV oconv) {
+	if (oconv) {
+		px->r = koliba_DoubleToWord(oconv(xyz->x) * 65535.0);
+		px->g = koliba_DoubleToWord(oconv(xyz->y) * 65535.0);
+		px->b = koliba_DoubleToWord(oconv(xyz->z) * 65535.0);
+	}
+	else {
+		px->r = koliba_DoubleToWord(xyz->x * 65535.0);
+		px->g = koliba_DoubleToWord(xyz->y * 65535.0);
+		px->b = koliba_DoubleToWord(xyz->z * 65535.0);
+	}
+	return px;
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledXyzToRgba16Pixel(KOLIBA_RGBA16PIXEL *px, const KOLIBA_XYZ * const xyz) {
+	px->r = koliba_DoubleToWord(xyz->x);
+	px->g = koliba_DoubleToWord(xyz->y);
+	px->b = koliba_DoubleToWord(xyz->z);
+	return px;
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_ApplyXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), fLut, flags), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_ScaledXyzToRgba16Pixel(pixelout, KOLIBA_ApplyXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), fLut, flags));
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_PolyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_PolyXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), ffLut, n), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledPolyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, KOLIBA_DBLCONV iconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_ScaledXyzToRgba16Pixel(pixelout, KOLIBA_PolyXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), ffLut, n));
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ExternalRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, unsigned int m, KOLIBA_EXTERNAL ext, void *params, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_ExternalXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), ffLut, n, m, ext, params), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_FlyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, KOLIBA_FLUT *fLut, KOLIBA_FLAGS *flags, const unsigned int dim[3], KOLIBA_MAKEVERTEX fn, const void *params, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_FlyXyz(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), fLut, flags, dim, fn, params), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_LumiduxRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const KOLIBA_LDX *lumidux, const KOLIBA_RGB *rec, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz, zyx;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_LumiduxXyz(&zyx, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), fLut, flags, lumidux, rec), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_IndexedRgba16Pixel(KOLIBA_INDEXEDXYZ idfn, KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL * const pixelin, const double * const base, const unsigned int * const flags, const unsigned int dim[3], const void * const flindex, const void * const findex, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, idfn(&xyz, KOLIBA_Rgba16PixelToXyz(&xyz, pixelin, iconv), base, flags, dim, flindex, findex), oconv);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelLumidux(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *foreground, const KOLIBA_RGBA16PIXEL *background, const KOLIBA_LDX *lumidux, const KOLIBA_RGB *rec, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	KOLIBA_XYZ xyz, fore, back;
+	return KOLIBA_XyzToRgba16Pixel(pixelout, KOLIBA_ApplyLumidux(&xyz, KOLIBA_Rgba16PixelToXyz(&fore, foreground, iconv), KOLIBA_Rgba16PixelToXyz(&back, background, iconv), lumidux, rec), oconv);
+}
+
+// The spans take the vectorized loads and stores unless there is a
+// conversion routine to call for each channel.
+
+static void koliba_Load16(const kolibaSpanIsa *isa, kolibaSpanXyz *c, const KOLIBA_RGBA16PIXEL *p, size_t n, KOLIBA_DBLCONV iconv) {
+	static const unsigned char off[3] = {0, 1, 2};
+	KOLIBA_XYZ xyz;
+	size_t i;
+
+	if (iconv == NULL) isa->load16(c, (const uint16_t *)p, n, off);
+	else for (i = 0; i < n; i++) {
+		KOLIBA_Rgba16PixelToXyz(&xyz, p + i, iconv);
+		c->x[i] = xyz.x;
+		c->y[i] = xyz.y;
+		c->z[i] = xyz.z;
+	}
+}
+
+static void koliba_Store16(const kolibaSpanIsa *isa, KOLIBA_RGBA16PIXEL *o, const KOLIBA_RGBA16PIXEL *p, const kolibaSpanXyz *c, size_t n, KOLIBA_DBLCONV oconv, double scale) {
+	static const unsigned char off[3] = {0, 1, 2};
+	KOLIBA_XYZ xyz;
+	size_t i;
+
+	if (oconv == NULL) isa->store16((uint16_t *)o, (const uint16_t *)p, c, n, off, scale);
+	else for (i = 0; i < n; i++) {
+		xyz.x = c->x[i];
+		xyz.y = c->y[i];
+		xyz.z = c->z[i];
+		KOLIBA_XyzToRgba16Pixel(o + i, &xyz, oconv)->a = p[i].a;
+	}
+}
+
+static KOLIBA_RGBA16PIXEL * koliba_Rgba16PixelArray(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv, double scale) {
+	kolibaSpanFlut f;
+	kolibaSpanXyz c;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+	KOLIBA_RGBA16PIXEL *o = pixelout;
+	size_t k;
+
+	for (; n > 0; n -= k, pixelin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		koliba_Load16(isa, &c, pixelin, k, iconv);
+		kernel(&c, k, &f);
+		koliba_Store16(isa, o, pixelin, &c, k, oconv, scale);
+	}
+	return pixelout;
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelArray(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	return koliba_Rgba16PixelArray(pixelout, pixelin, n, fLut, flags, iconv, oconv, 65535.0);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledRgba16PixelArray(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv) {
+	return koliba_Rgba16PixelArray(pixelout, pixelin, n, fLut, flags, iconv, NULL, 1.0);
+}
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelArrayLattice(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	kolibaSpanXyz c;
+	const kolibaSpanIsa *isa = koliba_Isa(KOLIBA_GetSpanIsa());
+	kolibaLatticeKernel kernel = koliba_LatticeKernels[lattice->mode];
+	KOLIBA_RGBA16PIXEL *o = pixelout;
+	size_t k;
+
+	for (; n > 0; n -= k, pixelin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		koliba_Load16(isa, &c, pixelin, k, iconv);
+		kernel(&c, k, lattice);
+		koliba_Store16(isa, o, pixelin, &c, k, oconv, 65535.0);
+	}
+	return pixelout;
+}
+
+// The half-float pixels. In double precision, the chunk of floats is only
+// a stop on the way from halves to doubles and back.
+
+KLBHID float KOLIBA_HalfToFloat(KOLIBA_HALF h) {
+	return koliba_HalfToFloat(h);
+}
+
+KLBHID KOLIBA_HALF KOLIBA_FloatToHalf(float f) {
+	return koliba_FloatToHalf(f);
+}
+
+static void koliba_SpanWiden(kolibaSpanXyz *c, const kolibaSpanXyz32 *h, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		c->x[i] = h->x[i];
+		c->y[i] = h->y[i];
+		c->z[i] = h->z[i];
+	}
+}
+
+static void koliba_SpanNarrow(kolibaSpanXyz32 *h, const kolibaSpanXyz *c, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		h->x[i] = (float)c->x[i];
+		h->y[i] = (float)c->y[i];
+		h->z[i] = (float)c->z[i];
+	}
+}
+
+#define	KLBSPAN16F(N,T)\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, KOLIBA_DBLCONV iconv) {\
+	xyz->x = koliba_HalfToFloat(px->r);\
+	xyz->y = koliba_HalfToFloat(px->g);\
+	xyz->z = koliba_HalfToFloat(px->b);\
+	if (iconv) {\
+		xyz->x = iconv(xyz->x);\
+		xyz->y = iconv(xyz->y);\
+		xyz->z = iconv(xyz->z);\
+	}\
+	return xyz;\
+}\
+\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, KOLIBA_DBLCONV oconv) {\
+	if (oconv) {\
+		px->r = koliba_FloatToHalf((float)oconv(xyz->x));\
+		px->g = koliba_FloatToHalf((float)oconv(xyz->y));\
+		px->b = koliba_FloatToHalf((float)oconv(xyz->z));\
+	}\
+	else {\
+		px->r = koliba_FloatToHalf((float)xyz->x);\
+		px->g = koliba_FloatToHalf((float)xyz->y);\
+		px->b = koliba_FloatToHalf((float)xyz->z);\
+	}\
+	return px;\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(KOLIBA_HALF), offsetof(T, g) / sizeof(KOLIBA_HALF), offsetof(T, b) / sizeof(KOLIBA_HALF)};\
+	kolibaSpanFlut f;\
+	kolibaSpanXyz c;\
+	kolibaSpanXyz32 h;\
+	KOLIBA_XYZ xyz;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);\
+	T *o = pixelout;\
+	size_t k, i;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		if (iconv) for (i = 0; i < k; i++) {\
+			KOLIBA_##N##PixelToXyz(&xyz, pixelin + i, iconv);\
+			c.x[i] = xyz.x;\
+			c.y[i] = xyz.y;\
+			c.z[i] = xyz.z;\
+		}\
+		else {\
+			isa->loadh(&h, (const uint16_t *)pixelin, k, off);\
+			koliba_SpanWiden(&c, &h, k);\
+		}\
+		kernel(&c, k, &f);\
+		if (oconv) for (i = 0; i < k; i++) {\
+			xyz.x = c.x[i];\
+			xyz.y = c.y[i];\
+			xyz.z = c.z[i];\
+			KOLIBA_XyzTo##N##Pixel(o + i, &xyz, oconv)->a = pixelin[i].a;\
+		}\
+		else {\
+			koliba_SpanNarrow(&h, &c, k);\
+			isa->storeh((uint16_t *)o, (const uint16_t *)pixelin, &h, k, off);\
+		}\
+	}\
+	return pixelout;\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArray32(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(KOLIBA_HALF), offsetof(T, g) / sizeof(KOLIBA_HALF), offsetof(T, b) / sizeof(KOLIBA_HALF)};\
+	kolibaSpanFlut32 f;\
+	kolibaSpanXyz32 c;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel32 kernel = koliba_SpanKernel32(&f, fLut, flags, &isa);\
+	T *o = pixelout;\
+	size_t k;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->loadh(&c, (const uint16_t *)pixelin, k, off);\
+		kernel(&c, k, &f);\
+		isa->storeh((uint16_t *)o, (const uint16_t *)pixelin, &c, k, off);\
+	}\
+	return pixelout;\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice) {\
+	static const unsigned char off[3] = {offsetof(T, r) / sizeof(KOLIBA_HALF), offsetof(T, g) / sizeof(KOLIBA_HALF), offsetof(T, b) / sizeof(KOLIBA_HALF)};\
+	kolibaSpanXyz c;\
+	kolibaSpanXyz32 h;\
+	const kolibaSpanIsa *isa = koliba_Isa(KOLIBA_GetSpanIsa());\
+	kolibaLatticeKernel kernel = koliba_LatticeKernels[lattice->mode];\
+	T *o = pixelout;\
+	size_t k;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->loadh(&h, (const uint16_t *)pixelin, k, off);\
+		koliba_SpanWiden(&c, &h, k);\
+		kernel(&c, k, lattice);\
+		koliba_SpanNarrow(&h, &c, k);\
+		isa->storeh((uint16_t *)o, (const uint16_t *)pixelin, &h, k, off);\
+	}\
+	return pixelout;\
+}
+
+KLBSPAN16F(Rgba16f, KOLIBA_RGBA16FPIXEL)
+KLBSPAN16F(Bgra16f, KOLIBA_BGRA16FPIXEL)
+KLBSPAN16F(Argb16f, KOLIBA_ARGB16FPIXEL)
+KLBSPAN16F(Abgr16f, KOLIBA_ABGR16FPIXEL)
+
+// The packed 10-bit pixels. Both kinds differ only in where their channels
+// are, so they share everything but the shifts.
+
+static KOLIBA_XYZ * koliba_TenBitToXyz(KOLIBA_XYZ *xyz, uint32_t v, const unsigned char *sh, KOLIBA_DBLCONV iconv) {
+	xyz->x = koliba_TenBitToDouble(v >> sh[0]);
+	xyz->y = koliba_TenBitToDouble(v >> sh[1]);
+	xyz->z = koliba_TenBitToDouble(v >> sh[2]);
+	if (iconv) {
+		xyz->x = iconv(xyz->x);
+		xyz->y = iconv(xyz->y);
+		xyz->z = iconv(xyz->z);
+	}
+	return xyz;
+}
+
+static uint32_t koliba_XyzToTenBit(uint32_t v, const KOLIBA_XYZ *xyz, const unsigned char *sh, KOLIBA_DBLCONV oconv, double scale) {
+	double x = xyz->x, y = xyz->y, z = xyz->z;
+
+	if (oconv) {
+		x = oconv(x);
+		y = oconv(y);
+		z = oconv(z);
+	}
+	return (v & 0xC0000000)
+		| (koliba_DoubleToTenBit(x * scale) << sh[0])
+		| (koliba_DoubleToTenBit(y * scale) << sh[1])
+		| (koliba_DoubleToTenBit(z * scale) << sh[2]);
+}
+
+static void koliba_Span10(const uint32_t *pixelin, uint32_t *o, size_t n, const unsigned char *sh, kolibaSpanKernel kernel, const kolibaSpanFlut *f, const KOLIBA_LATTICE *lattice, const kolibaSpanIsa *isa, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv, double scale) {
+	kolibaSpanXyz c;
+	KOLIBA_XYZ xyz;
+	size_t k, i;
+
+	for (; n > 0; n -= k, pixelin += k, o += k) {
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;
+		if (iconv) for (i = 0; i < k; i++) {
+			koliba_TenBitToXyz(&xyz, pixelin[i], sh, iconv);
+			c.x[i] = xyz.x;
+			c.y[i] = xyz.y;
+			c.z[i] = xyz.z;
+		}
+		else isa->load10(&c, pixelin, k, sh);
+		if (lattice) koliba_LatticeKernels[lattice->mode](&c, k, lattice);
+		else kernel(&c, k, f);
+		if (oconv) for (i = 0; i < k; i++) {
+			xyz.x = c.x[i];
+			xyz.y = c.y[i];
+			xyz.z = c.z[i];
+			o[i] = koliba_XyzToTenBit(pixelin[i], &xyz, sh, oconv, scale);
+		}
+		else isa->store10(o, pixelin, &c, k, sh, scale);
+	}
+}
+
+#define	KLBSPAN10(N,T,R,G,B)\
+static const unsigned char koliba_##N##Shifts[3] = {R, G, B};\
+\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, KOLIBA_DBLCONV iconv) {\
+	return koliba_TenBitToXyz(xyz, px->px, koliba_##N##Shifts, iconv);\
+}\
+\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, KOLIBA_DBLCONV oconv) {\
+	px->px = koliba_XyzToTenBit(px->px, xyz, koliba_##N##Shifts, oconv, 1023.0);\
+	return px;\
+}\
+\
+KLBHID T * KOLIBA_ScaledXyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz) {\
+	px->px = koliba_XyzToTenBit(px->px, xyz, koliba_##N##Shifts, NULL, 1.0);\
+	return px;\
+}\
+\
+KLBHID T * KOLIBA_##N##Pixel(T *pixelout, const T *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {\
+	KOLIBA_XYZ xyz;\
+	return KOLIBA_XyzTo##N##Pixel(pixelout, KOLIBA_ApplyXyz(&xyz, KOLIBA_##N##PixelToXyz(&xyz, pixelin, iconv), fLut, flags), oconv);\
+}\
+\
+KLBHID T * KOLIBA_Scaled##N##Pixel(T *pixelout, const T *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv) {\
+	KOLIBA_XYZ xyz;\
+	return KOLIBA_ScaledXyzTo##N##Pixel(pixelout, KOLIBA_ApplyXyz(&xyz, KOLIBA_##N##PixelToXyz(&xyz, pixelin, iconv), fLut, flags));\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {\
+	kolibaSpanFlut f;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);\
+	koliba_Span10((const uint32_t *)pixelin, (uint32_t *)pixelout, n, koliba_##N##Shifts, kernel, &f, NULL, isa, iconv, oconv, 1023.0);\
+	return pixelout;\
+}\
+\
+KLBHID T * KOLIBA_Scaled##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv) {\
+	kolibaSpanFlut f;\
+	const kolibaSpanIsa *isa;\
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);\
+	koliba_Span10((const uint32_t *)pixelin, (uint32_t *)pixelout, n, koliba_##N##Shifts, kernel, &f, NULL, isa, iconv, NULL, 1.0);\
+	return pixelout;\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {\
+	koliba_Span10((const uint32_t *)pixelin, (uint32_t *)pixelout, n, koliba_##N##Shifts, NULL, NULL, lattice, koliba_Isa(KOLIBA_GetSpanIsa()), iconv, oconv, 1023.0);\
+	return pixelout;\
+}
+
+KLBSPAN10(Rgb10a2, KOLIBA_RGB10A2PIXEL, 0, 10, 20)
+KLBSPAN10(Bgr10a2, KOLIBA_BGR10A2PIXEL, 20, 10, 0)
+
+// The 24-bit pixels, by way of the 32-bit ones of type W with the same
+// order of channels. CALL is the span of those to apply to the expanded chunk
+// q of k pixels.
+
+#define	klbspan24(T,W,CALL)\
+	KOLIBA_##W##PIXEL q[KOLIBA_SPANCHUNK];\
+	const kolibaSpanIsa *isa = koliba_Isa(KOLIBA_GetSpanIsa());\
+	T *o = pixelout;\
+	size_t k;\
+	for (; n > 0; n -= k, pixelin += k, o += k) {\
+		k = (n < KOLIBA_SPANCHUNK) ? n : KOLIBA_SPANCHUNK;\
+		isa->expand24((uint8_t *)q, (const uint8_t *)pixelin, k);\
+		CALL;\
+		isa->pack24((uint8_t *)o, (const uint8_t *)q, k);\
+	}\
+	return pixelout
+
+#define	KLBSPAN24(N,T,W,V)\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, const double * const iconv) {\
+	KOLIBA_##W##PIXEL q;\
+	q.r = px->r;\
+	q.g = px->g;\
+	q.b = px->b;\
+	return KOLIBA_##V##PixelToXyz(xyz, &q, iconv);\
+}\
+\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, const unsigned char * const oconv) {\
+	KOLIBA_##W##PIXEL q;\
+	KOLIBA_XyzTo##V##Pixel(&q, xyz, oconv);\
+	px->r = q.r;\
+	px->g = q.g;\
+	px->b = q.b;\
+	return px;\
+}\
+\
+KLBHID T * KOLIBA_ScaledXyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, const unsigned char * const oconv) {\
+	KOLIBA_##W##PIXEL q;\
+	KOLIBA_ScaledXyzTo##V##Pixel(&q, xyz, oconv);\
+	px->r = q.r;\
+	px->g = q.g;\
+	px->b = q.b;\
+	return px;\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {\
+	klbspan24(T, W, KOLIBA_##V##PixelArray(q, q, k, fLut, flags, iconv, oconv));\
+}\
+\
+KLBHID T * KOLIBA_Scaled##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {\
+	klbspan24(T, W, KOLIBA_Scaled##V##PixelArray(q, q, k, fLut, flags, iconv, oconv));\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArrayFixed(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags) {\
+	klbspan24(T, W, KOLIBA_##V##PixelArrayFixed(q, q, k, ff, flags));\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv) {\
+	klbspan24(T, W, KOLIBA_##V##PixelArrayLattice(q, q, k, lattice, iconv, oconv));\
+}\
+\
+KLBHID T * KOLIBA_##N##PixelArrayTables(T *pixelout, const T *pixelin, size_t n, const KOLIBA_BYTETABLES *t) {\
+	T *o = pixelout;\
+	for (; n > 0; n--, pixelin++, o++) {\
+		o->r = t->r[pixelin->r];\
+		o->g = t->g[pixelin->g];\
+		o->b = t->b[pixelin->b];\
+	}\
+	return pixelout;\
+}
+
+KLBSPAN24(Rgb24, KOLIBA_RGB24PIXEL, RGBA8, Rgba8)
+KLBSPAN24(Bgr24, KOLIBA_BGR24PIXEL, BGRA8, Bgra8)
+
+#undef	klbspan24
+
+// Planar frames. Each row of each plane is cut into chunks like a span of
+// pixels, and each chunk loaded one plane (one array of the chunk) at a
+// time, which the compiler can vectorize on its own. Either kernel and f,
+// or lattice, say what to apply.
+
+#define	klbplane(P,a,y)	((char *)(P)->plane[a] + (ptrdiff_t)(y) * (P)->stride[a])
+
+static void koliba_Planar8(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, kolibaSpanKernel kernel, const kolibaSpanFlut *f, const KOLIBA_LATTICE *lattice, const kolibaSpanIsa *isa, const double *iconv, const unsigned char *oconv, bool scaled) {
+	kolibaSpanXyz c;
+	double * const ch[3] = {c.x, c.y, c.z};
+	KOLIBA_RGBA8PIXEL q[KOLIBA_SPANCHUNK];
+	KOLIBA_XYZ xyz;
+	const double *ic = (iconv) ? iconv : KOLIBA_ByteDiv255;
+	uint8_t *r, *g, *b;
+	size_t y, j, k, i;
+	unsigned int a;
+
+	for (y = 0; y < height; y++) {
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			for (a = 0; a < 3; a++)
+				isa->loadp8(ch[a], (const uint8_t *)klbplane(in, a, y) + j, k, ic);
+			if (lattice) koliba_LatticeKernels[lattice->mode](&c, k, lattice);
+			else kernel(&c, k, f);
+			// The library rounds and clamps, as it does for the pixels,
+			// and we split its pixels into the planes afterwards.
+			for (i = 0; i < k; i++) {
+				xyz.x = c.x[i];
+				xyz.y = c.y[i];
+				xyz.z = c.z[i];
+				if (scaled) KOLIBA_ScaledXyzToRgba8Pixel(q + i, &xyz, oconv);
+				else KOLIBA_XyzToRgba8Pixel(q + i, &xyz, oconv);
+			}
+			r = (uint8_t *)klbplane(out, 0, y) + j;
+			g = (uint8_t *)klbplane(out, 1, y) + j;
+			b = (uint8_t *)klbplane(out, 2, y) + j;
+			for (i = 0; i < k; i++) {
+				r[i] = q[i].r;
+				g[i] = q[i].g;
+				b[i] = q[i].b;
+			}
+		}
+	}
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {
+	kolibaSpanFlut f;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+
+	koliba_Planar8(out, in, width, height, kernel, &f, NULL, isa, iconv, oconv, false);
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_ScaledPlanar8Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv) {
+	kolibaSpanFlut f;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+
+	koliba_Planar8(out, in, width, height, kernel, &f, NULL, isa, iconv, oconv, true);
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv) {
+	koliba_Planar8(out, in, width, height, NULL, NULL, lattice, koliba_Isa(KOLIBA_GetSpanIsa()), iconv, oconv, false);
+	return out;
+}
+
+// The fixed-point kernels only know pixels, so a chunk of the planes is
+// put together into pixels on the stack, and taken apart again.
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayFixed(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags) {
+	static const unsigned char off[3] = {offsetof(KOLIBA_RGBA8PIXEL, r), offsetof(KOLIBA_RGBA8PIXEL, g), offsetof(KOLIBA_RGBA8PIXEL, b)};
+	KOLIBA_RGBA8PIXEL q[KOLIBA_SPANCHUNK];
+	kolibaSpanFixed fixed = koliba_Isa(KOLIBA_GetSpanIsa())->fixed[koliba_FixedKernelType(ff, flags)];
+	const uint8_t *pr, *pg, *pb;
+	uint8_t *r, *g, *b;
+	size_t y, j, k, i;
+
+	for (y = 0; y < height; y++) {
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			pr = (const uint8_t *)klbplane(in, 0, y) + j;
+			pg = (const uint8_t *)klbplane(in, 1, y) + j;
+			pb = (const uint8_t *)klbplane(in, 2, y) + j;
+			for (i = 0; i < k; i++) {
+				q[i].r = pr[i];
+				q[i].g = pg[i];
+				q[i].b = pb[i];
+				q[i].a = 0;
+			}
+			fixed((uint8_t *)q, (const uint8_t *)q, k, ff, off);
+			r = (uint8_t *)klbplane(out, 0, y) + j;
+			g = (uint8_t *)klbplane(out, 1, y) + j;
+			b = (uint8_t *)klbplane(out, 2, y) + j;
+			for (i = 0; i < k; i++) {
+				r[i] = q[i].r;
+				g[i] = q[i].g;
+				b[i] = q[i].b;
+			}
+		}
+	}
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayTables(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_BYTETABLES *t) {
+	const unsigned char * const tab[3] = {t->r, t->g, t->b};
+	const uint8_t *p;
+	uint8_t *o;
+	size_t y, i;
+	unsigned int a;
+
+	for (y = 0; y < height; y++)
+		for (a = 0; a < 3; a++)
+			for (p = (const uint8_t *)klbplane(in, a, y), o = (uint8_t *)klbplane(out, a, y), i = 0; i < width; i++)
+				o[i] = tab[a][p[i]];
+	return out;
+}
+
+// The words and the floats take an optional conversion routine for each
+// element, which keeps the loops from being vectorized, so we only use
+// those loops when there is one.
+
+static void koliba_Planar16(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, kolibaSpanKernel kernel, const kolibaSpanFlut *f, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv, double scale) {
+	kolibaSpanXyz c;
+	double * const ch[3] = {c.x, c.y, c.z};
+	const uint16_t *p;
+	uint16_t *o;
+	size_t y, j, k, i;
+	unsigned int a;
+
+	for (y = 0; y < height; y++) {
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			for (a = 0; a < 3; a++) {
+				p = (const uint16_t *)klbplane(in, a, y) + j;
+				if (iconv) for (i = 0; i < k; i++)
+					ch[a][i] = iconv(koliba_WordToDouble(p[i]));
+				else for (i = 0; i < k; i++)
+					ch[a][i] = koliba_WordToDouble(p[i]);
+			}
+			if (lattice) koliba_LatticeKernels[lattice->mode](&c, k, lattice);
+			else kernel(&c, k, f);
+			for (a = 0; a < 3; a++) {
+				o = (uint16_t *)klbplane(out, a, y) + j;
+				if (oconv) for (i = 0; i < k; i++)
+					o[i] = koliba_DoubleToWord(oconv(ch[a][i]) * scale);
+				else for (i = 0; i < k; i++)
+					o[i] = koliba_DoubleToWord(ch[a][i] * scale);
+			}
+		}
+	}
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar16Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	kolibaSpanFlut f;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+
+	koliba_Planar16(out, in, width, height, kernel, &f, NULL, iconv, oconv, 65535.0);
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_ScaledPlanar16Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv) {
+	kolibaSpanFlut f;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+
+	koliba_Planar16(out, in, width, height, kernel, &f, NULL, iconv, NULL, 1.0);
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar16ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	koliba_Planar16(out, in, width, height, NULL, NULL, lattice, iconv, oconv, 65535.0);
+	return out;
+}
+
+static void koliba_Planar32(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, kolibaSpanKernel kernel, const kolibaSpanFlut *f, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	kolibaSpanXyz c;
+	double * const ch[3] = {c.x, c.y, c.z};
+	const float *p;
+	float *o;
+	size_t y, j, k, i;
+	unsigned int a;
+
+	for (y = 0; y < height; y++) {
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			for (a = 0; a < 3; a++) {
+				p = (const float *)klbplane(in, a, y) + j;
+				if (iconv) for (i = 0; i < k; i++)
+					ch[a][i] = iconv(p[i]);
+				else for (i = 0; i < k; i++)
+					ch[a][i] = p[i];
+			}
+			if (lattice) koliba_LatticeKernels[lattice->mode](&c, k, lattice);
+			else kernel(&c, k, f);
+			for (a = 0; a < 3; a++) {
+				o = (float *)klbplane(out, a, y) + j;
+				if (oconv) for (i = 0; i < k; i++)
+					o[i] = (float)oconv(ch[a][i]);
+				else for (i = 0; i < k; i++)
+					o[i] = (float)ch[a][i];
+			}
+		}
+	}
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv) {
+	kolibaSpanFlut f;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+
+	koliba_Planar32(out, in, width, height, kernel, &f, NULL, iconv, oconv);
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice) {
+	koliba_Planar32(out, in, width, height, NULL, NULL, lattice, NULL, NULL);
+	return out;
+}
+
+// In single precision, a chunk is just a copy of the rows.
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32Array32(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags) {
+	kolibaSpanFlut32 f;
+	kolibaSpanXyz32 c;
+	float * const ch[3] = {c.x, c.y, c.z};
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel32 kernel = koliba_SpanKernel32(&f, fLut, flags, &isa);
+	size_t y, j, k;
+	unsigned int a;
+
+	for (y = 0; y < height; y++) {
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			for (a = 0; a < 3; a++)
+				memcpy(ch[a], (const float *)klbplane(in, a, y) + j, k * sizeof(float));
+			kernel(&c, k, &f);
+			for (a = 0; a < 3; a++)
+				memcpy((float *)klbplane(out, a, y) + j, ch[a], k * sizeof(float));
+		}
+	}
+	return out;
+}
+
+// YCbCr frames. For the video range, 8-bit luma goes from 16 to 235 and
+// chroma from 16 to 240 around 128, and more bits just scale that up.
+KLBHID KOLIBA_YCCFORMAT * KOLIBA_YccFormat(KOLIBA_YCCFORMAT *fmt, const KOLIBA_RGB *rec, bool full) {
+	KOLIBA_MATRIX m, s;
+	const double half = (double)(1U << (fmt->bits - 1));
+	const double max = 2.0 * half - 1.0;
+	const double ys = (full) ? max : 219.0 * half / 128.0;
+	const double yo = (full) ? 0.0 : half / 8.0;
+	const double cs = (full) ? max : 224.0 * half / 128.0;
+
+	if (rec == NULL) rec = &KOLIBA_Rec709;
+	memset(&s, 0, sizeof(KOLIBA_MATRIX));
+	s.Red.r = ys;
+	s.Red.o = yo;
+	s.Green.g = cs;
+	s.Green.o = half;
+	s.Blue.b = cs;
+	s.Blue.o = half;
+	KOLIBA_MultiplyMatrices(&fmt->out, KOLIBA_RgbToYcc(&m, rec), &s);
+	memset(&s, 0, sizeof(KOLIBA_MATRIX));
+	s.Red.r = 1.0 / ys;
+	s.Red.o = -yo / ys;
+	s.Green.g = 1.0 / cs;
+	s.Green.o = -half / cs;
+	s.Blue.b = 1.0 / cs;
+	s.Blue.o = -half / cs;
+	KOLIBA_MultiplyMatrices(&fmt->in, &s, KOLIBA_YccToRgb(&m, rec));
+	return fmt;
+}
+
+static inline uint16_t koliba_YccSample(double v, double max) {
+	v += 0.5;
+	return (!(v > 0.0)) ? 0 : (v > max) ? (uint16_t)max : (uint16_t)v;
+}
+
+// The rows of the frame go in groups of 1 << vsub, which share their
+// chroma rows, and each group in chunks of columns. Every row of a chunk
+// is taken from the samples to RGB (ki), graded (kernel or lattice), and
+// taken back (ko), its luma stored, and its chroma added up, to be
+// stored once all the rows of the group are done. With no kernel and no
+// lattice, ki does it all at once, and there is no ko.
+static void koliba_YccPlanar(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_YCCFORMAT *fmt, kolibaSpanKernel ki, const kolibaSpanFlut *fi, kolibaSpanKernel kernel, const kolibaSpanFlut *f, const KOLIBA_LATTICE *lattice, kolibaSpanKernel ko, const kolibaSpanFlut *fo) {
+	kolibaSpanXyz c;
+	double cb[KOLIBA_SPANCHUNK], cr[KOLIBA_SPANCHUNK];
+	const double max = (double)((1U << fmt->bits) - 1);
+	const size_t hs = fmt->hsub, vs = fmt->vsub, step = fmt->step;
+	const unsigned int sh = fmt->shift;
+	size_t y, r, rows, j, k, kc, i, n, cy;
+
+	for (y = 0; y < height; y += rows) {
+		cy = y >> vs;
+		rows = ((size_t)1 << vs < height - y) ? (size_t)1 << vs : height - y;
+		for (j = 0; j < width; j += k) {
+			k = (width - j < KOLIBA_SPANCHUNK) ? width - j : KOLIBA_SPANCHUNK;
+			kc = (k + ((size_t)1 << hs) - 1) >> hs;
+			for (i = 0; i < kc; i++)
+				cb[i] = cr[i] = 0.0;
+			for (r = 0; r < rows; r++) {
+				if (fmt->size == 1) {
+					const uint8_t *p = (const uint8_t *)klbplane(in, 0, y + r) + j;
+					const uint8_t *u = (const uint8_t *)klbplane(in, 1, cy) + (j >> hs) * step;
+					const uint8_t *v = (const uint8_t *)klbplane(in, 2, cy) + (j >> hs) * step;
+					for (i = 0; i < k; i++) {
+						c.x[i] = p[i];
+						c.y[i] = u[(i >> hs) * step];
+						c.z[i] = v[(i >> hs) * step];
+					}
+				}
+				else {
+					const uint16_t *p = (const uint16_t *)klbplane(in, 0, y + r) + j;
+					const uint16_t *u = (const uint16_t *)klbplane(in, 1, cy) + (j >> hs) * step;
+					const uint16_t *v = (const uint16_t *)klbplane(in, 2, cy) + (j >> hs) * step;
+					for (i = 0; i < k; i++) {
+						c.x[i] = p[i] >> sh;
+						c.y[i] = u[(i >> hs) * step] >> sh;
+						c.z[i] = v[(i >> hs) * step] >> sh;
+					}
+				}
+				ki(&c, k, fi);
+				if (lattice) koliba_LatticeKernels[lattice->mode](&c, k, lattice);
+				else if (kernel) kernel(&c, k, f);
+				if (ko) ko(&c, k, fo);
+				if (fmt->size == 1) {
+					uint8_t *o = (uint8_t *)klbplane(out, 0, y + r) + j;
+					for (i = 0; i < k; i++)
+						o[i] = (uint8_t)koliba_YccSample(c.x[i], max);
+				}
+				else {
+					uint16_t *o = (uint16_t *)klbplane(out, 0, y + r) + j;
+					for (i = 0; i < k; i++)
+						o[i] = (uint16_t)(koliba_YccSample(c.x[i], max) << sh);
+				}
+				for (i = 0; i < k; i++) {
+					cb[i >> hs] += c.y[i];
+					cr[i >> hs] += c.z[i];
+				}
+			}
+			for (i = 0; i < kc; i++) {
+				// The last column of chroma may cover fewer columns
+				// of luma than the others.
+				n = (((i + 1) << hs) <= k) ? (size_t)1 << hs : k - (i << hs);
+				cb[i] /= (double)(n * rows);
+				cr[i] /= (double)(n * rows);
+			}
+			if (fmt->size == 1) {
+				uint8_t *u = (uint8_t *)klbplane(out, 1, cy) + (j >> hs) * step;
+				uint8_t *v = (uint8_t *)klbplane(out, 2, cy) + (j >> hs) * step;
+				for (i = 0; i < kc; i++) {
+					u[i * step] = (uint8_t)koliba_YccSample(cb[i], max);
+					v[i * step] = (uint8_t)koliba_YccSample(cr[i], max);
+				}
+			}
+			else {
+				uint16_t *u = (uint16_t *)klbplane(out, 1, cy) + (j >> hs) * step;
+				uint16_t *v = (uint16_t *)klbplane(out, 2, cy) + (j >> hs) * step;
+				for (i = 0; i < kc; i++) {
+					u[i * step] = (uint16_t)(koliba_YccSample(cb[i], max) << sh);
+					v[i * step] = (uint16_t)(koliba_YccSample(cr[i], max) << sh);
+				}
+			}
+		}
+	}
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_YccPlanarArray(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_YCCFORMAT *fmt, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags) {
+	kolibaSpanFlut fi, f, fo;
+	KOLIBA_FLUT li, lo;
+	KOLIBA_MATRIX m, t;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel kernel = koliba_SpanKernel(&f, fLut, flags, &isa);
+	kolibaSpanKernel ki, ko;
+
+	// Anything short of trilinear is a matrix, which we fold into ours.
+	// The reference kernels all look alike, and are never folded.
+	if (kernel != isa->kernel[KOLIBA_KERNELTRILINEAR]) {
+		KOLIBA_MultiplyMatrices(&t, &fmt->in, KOLIBA_ConvertFlutToMatrix(&m, &f.m));
+		KOLIBA_MultiplyMatrices(&m, &t, &fmt->out);
+		ki = koliba_SpanKernel(&fi, KOLIBA_ConvertMatrixToFlut(&li, &m), KOLIBA_MatrixFlutFlags, &isa);
+		koliba_YccPlanar(out, in, width, height, fmt, ki, &fi, NULL, NULL, NULL, NULL, NULL);
+	}
+	else {
+		ki = koliba_SpanKernel(&fi, KOLIBA_ConvertMatrixToFlut(&li, &fmt->in), KOLIBA_MatrixFlutFlags, &isa);
+		ko = koliba_SpanKernel(&fo, KOLIBA_ConvertMatrixToFlut(&lo, &fmt->out), KOLIBA_MatrixFlutFlags, &isa);
+		koliba_YccPlanar(out, in, width, height, fmt, ki, &fi, kernel, &f, NULL, ko, &fo);
+	}
+	return out;
+}
+
+KLBHID KOLIBA_PLANES * KOLIBA_YccPlanarArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_YCCFORMAT *fmt, const KOLIBA_LATTICE *lattice) {
+	kolibaSpanFlut fi, fo;
+	KOLIBA_FLUT li, lo;
+	const kolibaSpanIsa *isa;
+	kolibaSpanKernel ki = koliba_SpanKernel(&fi, KOLIBA_ConvertMatrixToFlut(&li, &fmt->in), KOLIBA_MatrixFlutFlags, &isa);
+	kolibaSpanKernel ko = koliba_SpanKernel(&fo, KOLIBA_ConvertMatrixToFlut(&lo, &fmt->out), KOLIBA_MatrixFlutFlags, &isa);
+
+	koliba_YccPlanar(out, in, width, height, fmt, ki, &fi, NULL, NULL, lattice, ko, &fo);
+	return out;
+}
+
+#undef	klbplane
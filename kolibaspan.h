@@ -0,0 +1,626 @@
+/*
+
+	kolibaspan.h
+
+	Copyright 2021 G. Adam Stanislav
+	All rights reserved
+
+	Redistribution and use in source and binary forms,
+	with or without modification, are permitted provided
+	that the following conditions are met:
+
+	1. Redistributions of source code must retain the
+	above copyright notice, this list of conditions
+	and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the
+	above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or
+	other materials provided with the distribution.
+
+	3. Neither the name of the copyright holder nor the
+	names of its contributors may be used to endorse or
+	promote products derived from this software without
+	specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS
+	AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+	WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+	FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+	OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+	PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+	STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+	OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef	_KOLIBASPAN_H_
+#define	_KOLIBASPAN_H_
+
+#include "koliba.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// KOLIBA_ApplyXyz is the heart of the library, and it gets called for every
+// single pixel of every frame. Each of those calls re-reads the FLUT and
+// tests all of its 24 flags again, although neither changes from one pixel
+// to the next.
+//
+// The span functions apply one FLUT to n contiguous elements instead. They
+// look at the FLAGS just once, before the loop, and otherwise produce the
+// same results as calling the single-element function n times (give or take
+// the last bit of a double, and as long as the input is finite). The output
+// may be the same as the input (but must not partially overlap it).
+//
+// Unlike the single-pixel inlines, the span functions for the RGBA pixel
+// types DO copy the alpha channel from the input to the output, since that
+// is what is usually wanted when processing a whole frame, and doing it in
+// the same loop is cheaper than doing it afterwards.
+//
+// They all return the output pointer.
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyXyzArray(
+	KOLIBA_XYZ * xyzout,			// The pointer to the first output XYZ/RGB vector
+	const KOLIBA_XYZ * xyzin,		// The pointer to the first input XYZ/RGB vector
+	size_t n,						// How many vectors there are
+	const KOLIBA_FLUT * const fLut,	// The FLUT to apply to them
+	KOLIBA_FLAGS flags				// The flags that decide which FLUT vertices to apply
+);
+
+// The KOLIBA_PIXEL transforms may be NULL, just as with KOLIBA_ApplyPixel.
+
+KLBHID KOLIBA_PIXEL * KOLIBA_ApplyPixelArray(
+	KOLIBA_PIXEL *pxout,
+	const KOLIBA_PIXEL *pxin,
+	size_t n,
+	const KOLIBA_FLUT *fLut,
+	KOLIBA_FLAGS flags,
+	KOLIBAPIXELTOXYZ transformin,
+	KOLIBAXYZTOPIXEL transformout
+);
+
+// A 3x4 matrix is a FLUT with nothing but the matrix flags, so this is
+// KOLIBA_ApplyXyzArray of its FLUT, which uses the matrix kernels (or the
+// 3x3 ones, if KOLIBA_MatrixIs3x3).
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyMatrixArray(
+	KOLIBA_XYZ * xyzout,
+	const KOLIBA_XYZ * xyzin,
+	size_t n,
+	const KOLIBA_MATRIX * const mat
+);
+
+// Some FLUTs need no arithmetic at all. Once its flags have had their say,
+// a FLUT that is the identity gives back whatever it gets, and one with
+// nothing but its black vertex (or with nothing at all) gives everything
+// the same color. Whoever processes whole frames can copy or fill those
+// instead, as KOLIBA_ApplyXyzArray does.
+
+typedef enum {
+	KOLIBA_FLUTGENERAL,
+	KOLIBA_FLUTIDENTITY,
+	KOLIBA_FLUTCONSTANT
+} KOLIBA_FLUTKIND;
+
+KLBHID KOLIBA_FLUTKIND KOLIBA_FlutKind(const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags);
+
+// The span variants of the 8-bit pixel inlines. As with those, iconv and
+// oconv may be NULL, and the Scaled variants expect a FLUT scaled by 255.
+
+#define	KLBSPAN8(N,T)\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);\
+KLBHID T * KOLIBA_Scaled##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);
+
+KLBSPAN8(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPAN8(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPAN8(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPAN8(Abgr8, KOLIBA_ABGR8PIXEL)
+
+// And of the 32-bit ones.
+
+#define	KLBSPAN32(N,T)\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+
+KLBSPAN32(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPAN32(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPAN32(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPAN32(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// Most video editors work with 32-bit float pixels, which the functions
+// above widen to doubles and narrow back. With a FLUT of floats, we can
+// stay with floats all the way, and process twice as many of them at once.
+//
+// The single-precision result can differ from the double-precision one.
+// For pixels within [0, 1], it differs by no more than what
+// KOLIBA_Flut32ErrorBound returns for the double FLUT and its flags:
+//
+//		13 * 2^-24 * (the sum of the absolute values of the used factors)
+//
+// Each term of the trilinear blend rounds at most four times (the factor,
+// up to two for the product of the channels, and the multiplication), the
+// seven additions add seven more, narrowing the double result to a float
+// rounds once, and the thirteenth is to spare. For an identity FLUT that
+// is about 2.3e-6, or about 1/1700 of an 8-bit step.
+
+typedef struct _KOLIBA_VERTEX32 {
+	float	r;
+	float	g;
+	float	b;
+} KOLIBA_VERTEX32;
+
+typedef struct	_KOLIBA_FLUT32 {
+	KOLIBA_VERTEX32	Black;
+	KOLIBA_VERTEX32	Red;
+	KOLIBA_VERTEX32	Green;
+	KOLIBA_VERTEX32	Blue;
+	KOLIBA_VERTEX32	Yellow;
+	KOLIBA_VERTEX32	Magenta;
+	KOLIBA_VERTEX32	Cyan;
+	KOLIBA_VERTEX32	White;
+} KOLIBA_FLUT32;
+
+KLBHID KOLIBA_FLUT32 * KOLIBA_ConvertFlutToFlut32(
+	KOLIBA_FLUT32 *f32,
+	const KOLIBA_FLUT *fLut
+);
+
+KLBHID double KOLIBA_Flut32ErrorBound(
+	const KOLIBA_FLUT *fLut,
+	KOLIBA_FLAGS flags
+);
+
+#define	KLBSPAN32S(N,T)\
+KLBHID T * KOLIBA_##N##PixelArray32(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags);
+
+KLBSPAN32S(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPAN32S(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPAN32S(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPAN32S(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// The 8-bit pixels can skip floating point altogether. A fixed-point FLUT
+// holds the factors of a FLUT scaled by 255 (as for the Scaled functions)
+// as 16-bit integers with bits fractional bits, and the channels go into
+// 16-bit integers with 15 fractional bits, so the whole blend takes 16-bit
+// integer multiplies (rounded to nearest) and saturating adds. The Black
+// vertex also holds the half we need to round the result, which is then
+// clamped to a byte, just as the library does it.
+//
+// Each channel is off from its true value by at most 1/32768, and each
+// product of two or three of them by at most 2.5/32768 or 4/32768. Each
+// factor is off by half of its last bit, and so is each multiplication. So
+// the result is never off by more than
+//
+//		4 * S / 32768 + 7.5 / 2^bits
+//
+// where S is the largest sum of the absolute values of the used (scaled)
+// factors of any one channel, and bits the most that still lets every sum
+// fit in 16 bits. KOLIBA_FixedFlutErrorBound returns that. As long as it is
+// below 1, the result is within 1 of what the double-precision functions
+// return, and KOLIBA_ConvertScaledFlutToFixedFlut refuses (returns NULL) if
+// it is not. For an identity FLUT the bound is about 0.1, and it reaches 1
+// once the factors of a channel add up to about 6.
+//
+// There are no iconv and oconv tables here, since they work with doubles.
+
+typedef struct _KOLIBA_FIXEDVERTEX {
+	short	r;
+	short	g;
+	short	b;
+} KOLIBA_FIXEDVERTEX;
+
+typedef struct	_KOLIBA_FIXEDFLUT {
+	KOLIBA_FIXEDVERTEX	Black;
+	KOLIBA_FIXEDVERTEX	Red;
+	KOLIBA_FIXEDVERTEX	Green;
+	KOLIBA_FIXEDVERTEX	Blue;
+	KOLIBA_FIXEDVERTEX	Yellow;
+	KOLIBA_FIXEDVERTEX	Magenta;
+	KOLIBA_FIXEDVERTEX	Cyan;
+	KOLIBA_FIXEDVERTEX	White;
+	short				bits;
+} KOLIBA_FIXEDFLUT;
+
+KLBHID double KOLIBA_FixedFlutErrorBound(
+	const KOLIBA_FLUT *fLut,	// Scaled by 255
+	KOLIBA_FLAGS flags
+);
+
+KLBHID KOLIBA_FIXEDFLUT * KOLIBA_ConvertScaledFlutToFixedFlut(
+	KOLIBA_FIXEDFLUT *ff,
+	const KOLIBA_FLUT *fLut,	// Scaled by 255
+	KOLIBA_FLAGS flags
+);
+
+#define	KLBSPANFIXED(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayFixed(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags);
+
+KLBSPANFIXED(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANFIXED(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANFIXED(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANFIXED(Abgr8, KOLIBA_ABGR8PIXEL)
+
+// When the flags leave nothing but Black and the Red.r, Green.g, Blue.b
+// diagonal (KOLIBA_1DFlutFlags), each output channel of a FLUT depends on
+// its own input channel alone, so the FLUT of an 8-bit pixel is just three
+// tables of 256 bytes, and applying it three lookups.
+//
+// KOLIBA_ConvertScaledFlutToByteTables fills the tables by having the
+// library convert each byte (through iconv and oconv, either of which
+// may be NULL), so the lookups give exactly what KOLIBA_ScaledRgba8Pixel
+// and the others give. It returns NULL (and fills nothing) if the flags
+// are not 1D, not counting the flags of any factors which are zero.
+//
+// The 32-bit pixels need no tables, KOLIBA_ApplyXyzArray and the others
+// evaluate a 1D FLUT with one multiply-add per channel anyway.
+
+typedef struct _KOLIBA_BYTETABLES {
+	unsigned char	r[256];
+	unsigned char	g[256];
+	unsigned char	b[256];
+} KOLIBA_BYTETABLES;
+
+KLBHID KOLIBA_BYTETABLES * KOLIBA_ConvertScaledFlutToByteTables(
+	KOLIBA_BYTETABLES *t,
+	const KOLIBA_FLUT *fLut,	// Scaled by 255
+	KOLIBA_FLAGS flags,
+	const double *iconv,
+	const unsigned char *oconv
+);
+
+#define	KLBSPANTABLES(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayTables(T *pixelout, const T *pixelin, size_t n, const KOLIBA_BYTETABLES *t);
+
+KLBSPANTABLES(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANTABLES(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANTABLES(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANTABLES(Abgr8, KOLIBA_ABGR8PIXEL)
+
+// Large LUTs, the (m+1)(n+1)(o+1) vertices made by KOLIBA_MakeCube (red
+// changing fastest, blue slowest), need not go through the per-cell FLUTs
+// of KOLIBA_ConvertCubeToFluts and KOLIBA_NonindexedXyz. We can look the
+// vertices up in the lattice itself, and interpolate among them either
+// tri-linearly, which reads all 8 vertices of a cell, or tetrahedrally.
+//
+// Tetrahedral interpolation splits each cell into six tetrahedra which
+// share the diagonal from the cell's black to its white vertex, picks the
+// one a pixel falls in by sorting its three fractions, and only reads the
+// 4 vertices of that tetrahedron. The result is continuous and exact for
+// the vertices, like the tri-linear one, and with the 33 or 65 vertices
+// per axis of common .cube files, it moves half as much memory per pixel.
+//
+// Inputs outside [0, 1] are extrapolated from the cell at the edge, as the
+// library does with its large LUTs.
+//
+// KOLIBA_ConvertCubeToLattice returns NULL if any dimension is not within
+// [1, 256]. The lattice only points at the cube, which must outlive it.
+
+typedef enum {
+	KLI_trilinear,
+	KLI_tetrahedral,
+	KLI_COUNT
+} KOLIBA_INTERPOLATION;
+
+typedef struct _KOLIBA_LATTICE {
+	const KOLIBA_RGB *cube;
+	unsigned int dim[3];		// m, n, o as given to KOLIBA_MakeCube
+	size_t stride[3];			// vertices from one red, green, blue step to the next
+	KOLIBA_INTERPOLATION mode;
+} KOLIBA_LATTICE;
+
+KLBHID KOLIBA_LATTICE * KOLIBA_ConvertCubeToLattice(
+	KOLIBA_LATTICE *lattice,
+	const KOLIBA_RGB *cube,
+	const unsigned int dim[3],
+	KOLIBA_INTERPOLATION mode
+);
+
+KLBHID KOLIBA_XYZ * KOLIBA_ApplyLatticeArray(
+	KOLIBA_XYZ * xyzout,
+	const KOLIBA_XYZ * xyzin,
+	size_t n,
+	const KOLIBA_LATTICE * const lattice
+);
+
+// The cube holds unscaled values, so the 8-bit ones take iconv and oconv
+// just like KOLIBA_Rgba8PixelArray (and may be NULL just the same).
+
+#define	KLBSPANLATTICE8(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv);
+
+#define	KLBSPANLATTICE32(N,T)\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice);
+
+KLBSPANLATTICE8(Rgba8, KOLIBA_RGBA8PIXEL)
+KLBSPANLATTICE8(Bgra8, KOLIBA_BGRA8PIXEL)
+KLBSPANLATTICE8(Argb8, KOLIBA_ARGB8PIXEL)
+KLBSPANLATTICE8(Abgr8, KOLIBA_ABGR8PIXEL)
+KLBSPANLATTICE32(Rgba32, KOLIBA_RGBA32PIXEL)
+KLBSPANLATTICE32(Bgra32, KOLIBA_BGRA32PIXEL)
+KLBSPANLATTICE32(Argb32, KOLIBA_ARGB32PIXEL)
+KLBSPANLATTICE32(Abgr32, KOLIBA_ABGR32PIXEL)
+
+// The library declares KOLIBA_RGBA16PIXEL, for 16-bit PNG and TIFF
+// bitmaps, and the KOLIBA_HighWordDiv65535 and KOLIBA_LowWordDiv65535
+// tables to convert its channels to doubles, but nothing that uses them.
+// These are the functions it would have, named and working like those of
+// the 32-bit pixels, so iconv and oconv are KOLIBA_DBLCONV and may be NULL.
+// Like the 8-bit ones, they also come in Scaled variants, which expect a
+// FLUT (or the last FFLUT of a chain) scaled by 65535, and take no oconv.
+//
+// Rgba16PixelToXyz looks the high and the low byte of each channel up in
+// the two tables and adds the results. The XyzTo functions round to the
+// nearest integer and clamp to [0, 65535]. As with the library, none of
+// the single-pixel functions touch the alpha channel of the output, but
+// the span ones copy it, as all spans do.
+
+KLBHID KOLIBA_XYZ * KOLIBA_Rgba16PixelToXyz(
+	KOLIBA_XYZ * xyz,
+	const KOLIBA_RGBA16PIXEL * const px,
+	KOLIBA_DBLCONV iconv
+);
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_XyzToRgba16Pixel(
+	KOLIBA_RGBA16PIXEL * px,
+	const KOLIBA_XYZ * const xyz,
+	KOLIBA_DBLCONV oconv
+);
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledXyzToRgba16Pixel(
+	KOLIBA_RGBA16PIXEL * px,
+	const KOLIBA_XYZ * const xyz
+);
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_PolyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledPolyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, KOLIBA_DBLCONV iconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ExternalRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FFLUT *ffLut, unsigned int n, unsigned int m, KOLIBA_EXTERNAL ext, void *params, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_FlyRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, KOLIBA_FLUT *fLut, KOLIBA_FLAGS *flags, const unsigned int dim[3], KOLIBA_MAKEVERTEX fn, const void *params, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_LumiduxRgba16Pixel(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const KOLIBA_LDX *lumidux, const KOLIBA_RGB *rec, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_IndexedRgba16Pixel(KOLIBA_INDEXEDXYZ idfn, KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL * const pixelin, const double * const base, const unsigned int * const flags, const unsigned int dim[3], const void * const flindex, const void * const findex, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelLumidux(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *foreground, const KOLIBA_RGBA16PIXEL *background, const KOLIBA_LDX *lumidux, const KOLIBA_RGB *rec, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+
+// The spans of the plain and the Scaled ones, and of a lattice (which holds
+// unscaled values). Only the conversions go to SIMD kernels of their own,
+// the FLUTs and the lattices use the same ones as all other pixels.
+
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelArray(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_ScaledRgba16PixelArray(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv);
+KLBHID KOLIBA_RGBA16PIXEL * KOLIBA_Rgba16PixelArrayLattice(KOLIBA_RGBA16PIXEL *pixelout, const KOLIBA_RGBA16PIXEL *pixelin, size_t n, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+
+// Half floats (IEEE 754 binary16, the "e" format of Python buffers) keep
+// the range of a float pixel in the memory of a 16-bit one, so many video
+// editors use them for their intermediates. The library knows nothing of
+// them, so the pixels are ours, in the same four orders as the library's
+// 32-bit ones, with each channel holding the bits of a half.
+//
+// KOLIBA_FloatToHalf rounds to nearest even, and keeps infinities and NaNs,
+// just as the F16C instructions do, and the span functions use those where
+// the processor has them. Doubles go to halves by way of floats.
+
+typedef uint16_t KOLIBA_HALF;
+
+typedef	struct _KOLIBA_RGBA16FPIXEL {
+	KOLIBA_HALF	r, g, b, a;
+} KOLIBA_RGBA16FPIXEL;
+typedef struct _KOLIBA_BGRA16FPIXEL {
+	KOLIBA_HALF	b, g, r, a;
+} KOLIBA_BGRA16FPIXEL;
+typedef struct _KOLIBA_ARGB16FPIXEL {
+	KOLIBA_HALF	a, r, g, b;
+} KOLIBA_ARGB16FPIXEL;
+typedef struct	_KOLIBA_ABGR16FPIXEL {
+	KOLIBA_HALF	a, g, b, r;
+} KOLIBA_ABGR16FPIXEL;
+
+KLBHID float KOLIBA_HalfToFloat(KOLIBA_HALF h);
+KLBHID KOLIBA_HALF KOLIBA_FloatToHalf(float f);
+
+// The conversions, and the spans in double precision (with iconv and oconv
+// as with the 32-bit pixels), in single precision, and of a lattice.
+
+#define	KLBSPAN16F(N,T)\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, KOLIBA_DBLCONV iconv);\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, KOLIBA_DBLCONV oconv);\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);\
+KLBHID T * KOLIBA_##N##PixelArray32(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags);\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice);
+
+KLBSPAN16F(Rgba16f, KOLIBA_RGBA16FPIXEL)
+KLBSPAN16F(Bgra16f, KOLIBA_BGRA16FPIXEL)
+KLBSPAN16F(Argb16f, KOLIBA_ARGB16FPIXEL)
+KLBSPAN16F(Abgr16f, KOLIBA_ABGR16FPIXEL)
+
+// Video often carries 10 bits per channel, three of them packed with a
+// 2-bit alpha into 32 bits, red in the lowest bits (as in R10G10B10A2) or
+// blue (as in A2R10G10B10, which Windows and many capture cards use). The
+// library has no such pixels either.
+//
+// They work just like the 16-bit pixels above, only the channels are
+// divided by 1023 rather than 65535, and the Scaled functions expect a
+// FLUT scaled by 1023. The single-pixel functions leave the two alpha bits
+// of the output alone.
+
+typedef struct _KOLIBA_RGB10A2PIXEL {
+	uint32_t px;	// red in bits 0-9, green 10-19, blue 20-29, alpha 30-31
+} KOLIBA_RGB10A2PIXEL;
+
+typedef struct _KOLIBA_BGR10A2PIXEL {
+	uint32_t px;	// blue in bits 0-9, green 10-19, red 20-29, alpha 30-31
+} KOLIBA_BGR10A2PIXEL;
+
+#define	KLBSPAN10(N,T)\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, KOLIBA_DBLCONV iconv);\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, KOLIBA_DBLCONV oconv);\
+KLBHID T * KOLIBA_ScaledXyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz);\
+KLBHID T * KOLIBA_##N##Pixel(T *pixelout, const T *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);\
+KLBHID T * KOLIBA_Scaled##N##Pixel(T *pixelout, const T *pixelin, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv);\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);\
+KLBHID T * KOLIBA_Scaled##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv);\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+
+KLBSPAN10(Rgb10a2, KOLIBA_RGB10A2PIXEL)
+KLBSPAN10(Bgr10a2, KOLIBA_BGR10A2PIXEL)
+
+// Camera stills and many video pipes have no alpha channel at all, just
+// three bytes per pixel. These work exactly like the 8-bit pixels with an
+// alpha channel (and give exactly the same results), including iconv and
+// oconv, the Scaled, fixed-point, and table variants, and the lattices.
+//
+// The spans expand a chunk of pixels to four bytes each on the stack, run
+// the Rgba8 (or Bgra8) span on it, and pack it back, so the pixels in
+// memory are only read and written once, three bytes each.
+
+typedef struct _KOLIBA_RGB24PIXEL {
+	uint8_t r, g, b;
+} KOLIBA_RGB24PIXEL;
+
+typedef struct _KOLIBA_BGR24PIXEL {
+	uint8_t b, g, r;
+} KOLIBA_BGR24PIXEL;
+
+#define	KLBSPAN24(N,T)\
+KLBHID KOLIBA_XYZ * KOLIBA_##N##PixelToXyz(KOLIBA_XYZ *xyz, const T * const px, const double * const iconv);\
+KLBHID T * KOLIBA_XyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, const unsigned char * const oconv);\
+KLBHID T * KOLIBA_ScaledXyzTo##N##Pixel(T *px, const KOLIBA_XYZ * const xyz, const unsigned char * const oconv);\
+KLBHID T * KOLIBA_##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);\
+KLBHID T * KOLIBA_Scaled##N##PixelArray(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);\
+KLBHID T * KOLIBA_##N##PixelArrayFixed(T *pixelout, const T *pixelin, size_t n, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags);\
+KLBHID T * KOLIBA_##N##PixelArrayTables(T *pixelout, const T *pixelin, size_t n, const KOLIBA_BYTETABLES *t);\
+KLBHID T * KOLIBA_##N##PixelArrayLattice(T *pixelout, const T *pixelin, size_t n, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv);
+
+KLBSPAN24(Rgb24, KOLIBA_RGB24PIXEL)
+KLBSPAN24(Bgr24, KOLIBA_BGR24PIXEL)
+
+// Many decoders hand out frames as three separate planes of red, green,
+// and blue (FFmpeg calls them GBRP) rather than as interleaved pixels.
+// Each of the planes has its own first row and its own number of bytes
+// from one row to the next, which a KOLIBA_PLANES holds. The elements of
+// a row are contiguous. The output may be the input, plane for plane.
+//
+// The kernels keep the channels of a chunk in separate arrays anyway, so
+// a row of a plane goes into its array (and back) without any shuffling,
+// which makes the planes the fastest way through them. There is no alpha
+// to copy.
+//
+// The planes come in bytes, converted just like the 8-bit pixels (and
+// giving exactly the same results), in 16-bit words, converted like the
+// RGBA16 pixels, and in floats, like the RGBA32 pixels. They all have
+// lattice variants, the bytes also fixed-point and table variants, and the
+// floats single-precision ones. They return out.
+
+typedef struct _KOLIBA_PLANES {
+	void *plane[3];		// the first rows of red, green, and blue
+	ptrdiff_t stride[3];	// bytes from one row of each to the next
+} KOLIBA_PLANES;
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);
+KLBHID KOLIBA_PLANES * KOLIBA_ScaledPlanar8Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, const double *iconv, const unsigned char *oconv);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayFixed(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FIXEDFLUT *ff, KOLIBA_FLAGS flags);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayTables(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_BYTETABLES *t);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar8ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice, const double *iconv, const unsigned char *oconv);
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar16Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_PLANES * KOLIBA_ScaledPlanar16Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar16ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32Array(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, KOLIBA_DBLCONV iconv, KOLIBA_DBLCONV oconv);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32Array32(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_FLUT32 *fLut, KOLIBA_FLAGS flags);
+KLBHID KOLIBA_PLANES * KOLIBA_Planar32ArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_LATTICE *lattice);
+
+// Most video is not RGB at all but YCbCr, with the chroma at half the
+// resolution of the luma (FFmpeg's yuv420p, nv12, p010, and the like).
+// We grade such frames directly, in a single pass over the planes, rather
+// than having them converted to RGB planes, graded, and converted back.
+//
+// The planes of a KOLIBA_PLANES are then Y, Cb, and Cr. The chroma planes
+// have a sample for every 1 << hsub columns and 1 << vsub rows of the
+// luma (rounded up), step samples apart in a row, so Cb and Cr
+// interleaved in one plane (nv12) are two planes a sample apart, with a
+// step of 2. The samples are bytes or 16-bit words, the bits of a word
+// shifted up by shift (6 for p010).
+//
+// Each chroma sample is used for all the pixels it covers, and the new
+// one is the average of what those pixels turn into, so an identity FLUT
+// gives us the frame back as it was. The in matrix turns the samples
+// into RGB, and the out matrix RGB into the samples. KOLIBA_YccFormat
+// makes them from the luma weights of a Rec (NULL for Rec. 709), in the
+// full range of the samples or the video range (16-235 and 16-240 for 8
+// bits). A FLUT that is just a matrix is folded into them, so its frames
+// only take one matrix per pixel.
+
+typedef struct _KOLIBA_YCCFORMAT {
+	KOLIBA_MATRIX in;	// from the samples to RGB
+	KOLIBA_MATRIX out;	// from RGB to the samples
+	unsigned char bits;	// of a sample, 8 to 16
+	unsigned char size;	// bytes per sample, 1 or 2
+	unsigned char shift;	// of the bits in a word
+	unsigned char hsub;	// log2 of the columns per chroma sample
+	unsigned char vsub;	// log2 of the rows per chroma sample
+	unsigned char step;	// samples from one chroma sample to the next
+} KOLIBA_YCCFORMAT;
+
+// Sets the matrices of a format whose other fields are set.
+KLBHID KOLIBA_YCCFORMAT * KOLIBA_YccFormat(KOLIBA_YCCFORMAT *fmt, const KOLIBA_RGB *rec, bool full);
+
+// The width and the height are those of the luma. They return out.
+KLBHID KOLIBA_PLANES * KOLIBA_YccPlanarArray(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_YCCFORMAT *fmt, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags);
+KLBHID KOLIBA_PLANES * KOLIBA_YccPlanarArrayLattice(KOLIBA_PLANES *out, const KOLIBA_PLANES *in, size_t width, size_t height, const KOLIBA_YCCFORMAT *fmt, const KOLIBA_LATTICE *lattice);
+
+#undef	KLBSPAN8
+#undef	KLBSPAN32
+#undef	KLBSPAN32S
+#undef	KLBSPANFIXED
+#undef	KLBSPANTABLES
+#undef	KLBSPANLATTICE8
+#undef	KLBSPANLATTICE32
+#undef	KLBSPAN16F
+#undef	KLBSPAN10
+#undef	KLBSPAN24
+
+// On x86 processors, the span functions use SSE4.2, AVX2 (with FMA and F16C), or
+// AVX-512 instructions, whichever is the best the processor has. We can
+// also choose which to use ourselves, which is mostly useful for testing.
+//
+// KOLIBA_SPANREFERENCE does not use any of our kernels but calls
+// KOLIBA_ApplyXyz for every element, so its results are bit for bit those
+// of the library. The others can then be compared against it. The scalar
+// and SSE4.2 kernels produce identical results (unless the compiler is told
+// to fuse their multiplies and adds), while AVX2 and AVX-512 use fused
+// multiply-adds, which round once where the others round twice.
+
+typedef enum {
+	KOLIBA_SPANREFERENCE,
+	KOLIBA_SPANSCALAR,
+	KOLIBA_SPANSSE42,
+	KOLIBA_SPANAVX2,
+	KOLIBA_SPANAVX512,
+	KOLIBA_SPANISAS
+} KOLIBA_SPANISA;
+
+KLBHID extern const char * const KOLIBA_SpanIsaNames[KOLIBA_SPANISAS];
+
+// Is the instruction set compiled in and supported by this processor?
+KLBHID bool KOLIBA_SpanIsaAvailable(KOLIBA_SPANISA isa);
+
+// The instruction set we use, and the one we would use by default.
+KLBHID KOLIBA_SPANISA KOLIBA_GetSpanIsa(void);
+KLBHID KOLIBA_SPANISA KOLIBA_BestSpanIsa(void);
+
+// Returns false (and changes nothing) if the isa is not available.
+KLBHID bool KOLIBA_SetSpanIsa(KOLIBA_SPANISA isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// _KOLIBASPAN_H_
@@ -1,6 +1,6 @@
 from setuptools import *
 
-module1 = Extension('koliba', libraries=['koliba'], sources=['kolibamodule.c'])
+module1 = Extension('koliba', libraries=['koliba'], sources=['kolibamodule.c', 'kolibaspan.c', 'kolibasimd.c'], depends=['koliba.h', 'kolibaspan.h', 'kolibasimd.h'])
 
 setup (name = 'koliba',
 version = '0.0.1',
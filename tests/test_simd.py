@@ -0,0 +1,154 @@
+# Check every instruction set this processor can use against the reference,
+# which calls the library for every pixel. The scalar and SSE4.2 kernels, and
+# the byte tables of 1D FLUTs, must match it bit for bit. FMA (AVX2 and
+# AVX-512) may round differently, and so may the single and fixed precisions,
+# within the bounds the LUTs report.
+
+import random
+import struct
+import unittest
+
+import koliba
+
+PIXELS = 1000	# not a multiple of any vector, so the tails get tested too
+
+# How to read each format: the struct code of its channels, and the number
+# of steps from 0 to 1 (None for floats).
+FORMATS = {
+	"rgba8": ("B", 255), "bgra8": ("B", 255), "argb8": ("B", 255), "abgr8": ("B", 255),
+	"rgb24": ("B", 255), "bgr24": ("B", 255),
+	"rgba16": ("H", 65535),
+	"rgb10a2": ("I", 1023), "bgr10a2": ("I", 1023),
+	"rgba16f": ("e", None), "bgra16f": ("e", None), "argb16f": ("e", None), "abgr16f": ("e", None),
+	"rgba32": ("f", None), "bgra32": ("f", None), "argb32": ("f", None), "abgr32": ("f", None),
+}
+
+
+def isas():
+	old = koliba.Simd()
+	found = []
+	for isa in ("scalar", "sse4.2", "avx2", "avx512"):
+		try:
+			koliba.SetSimd(isa)
+		except ValueError:
+			continue
+		found.append(isa)
+	koliba.SetSimd(old)
+	return found
+
+
+def frame(fmt, rng):
+	code, steps = FORMATS[fmt]
+	if code == "B":
+		return rng.randbytes(PIXELS * (3 if fmt.endswith("24") else 4))
+	if code in "HI":
+		return rng.randbytes(PIXELS * (8 if code == "H" else 4))
+	return struct.pack("<%d%s" % (PIXELS * 4, code), *(rng.random() for _ in range(PIXELS * 4)))
+
+
+def channels(fmt, data):
+	code, steps = FORMATS[fmt]
+	v = struct.unpack("<%d%s" % (len(data) // struct.calcsize(code), code), data)
+	if code == "I":
+		return [(p >> s) & (3 if s == 30 else 1023) for p in v for s in (0, 10, 20, 30)]
+	return v
+
+
+# How far rounding the last bit of a double either way may move a channel:
+# over to its neighbouring step, or by the precision of the channel.
+def slack(fmt):
+	code, steps = FORMATS[fmt]
+	if steps:
+		return 1
+	if code == "e":
+		return 1e-3
+	return 1e-6
+
+
+def luts():
+	slut = koliba.Slut()
+	slut.red = (0.9, 0.1, 0.05)
+	slut.yellow = (1.0, 0.85, 0.1)
+	slut.blue = (0.05, 0.1, 0.8)
+	slut.white = (0.95, 0.97, 1.0)
+	flut = koliba.Flut()
+	f = list(flut.flut)
+	f[0:3] = (0.02, 0.01, 0.03)		# black
+	f[3:6] = (0.9, 0.0, 0.0)		# red
+	f[6:9] = (0.0, 0.8, 0.0)		# green
+	f[9:12] = (0.0, 0.0, 0.95)		# blue
+	flut.flut = f
+	return {
+		"trilinear": slut,
+		"matrix": koliba.Matrix([0.8, 0.1, 0.05, 0.02, 0.05, 0.9, 0.05, 0.0, 0.1, 0.05, 0.85, 0.01]),
+		"1d": flut,
+	}
+
+
+class TestSimd(unittest.TestCase):
+	def setUp(self):
+		self.simd = koliba.Simd()
+		self.threads = koliba.Threads()
+		koliba.SetThreads(1)
+		self.isas = isas()
+
+	def tearDown(self):
+		koliba.SetSimd(self.simd)
+		koliba.SetThreads(self.threads)
+
+	def compare(self, what, fmt, got, want, tolerance):
+		steps = FORMATS[fmt][1]
+		for k, (a, b) in enumerate(zip(channels(fmt, got), channels(fmt, want))):
+			if steps is None:
+				ok = abs(a - b) <= tolerance * max(1.0, abs(b))
+			else:
+				ok = abs(a - b) <= tolerance
+			if not ok:
+				self.fail("%s: channel %d is %r, the reference has %r" % (what, k, a, b))
+
+	def test_isas(self):
+		rng = random.Random(5)
+		for name, lut in luts().items():
+			for fmt in FORMATS:
+				src = frame(fmt, rng)
+				koliba.SetSimd("reference")
+				want = bytes(lut.apply(src, format=fmt))
+				steps = FORMATS[fmt][1]
+				tables = (name == "1d") and (steps == 255)
+				for isa in self.isas:
+					koliba.SetSimd(isa)
+					what = "%s %s %s" % (name, fmt, isa)
+					got = bytes(lut.apply(src, format=fmt))
+					if (isa in ("scalar", "sse4.2")) or tables:
+						self.assertEqual(got, want, what)
+					else:
+						self.compare(what, fmt, got, want, slack(fmt))
+					for precision in ("single", "fixed"):
+						try:
+							got = bytes(lut.apply(src, format=fmt, precision=precision))
+						except ValueError:
+							continue	# not for this format
+						what = "%s %s %s %s" % (name, fmt, isa, precision)
+						if precision == "fixed":
+							self.compare(what, fmt, got, want, 1)
+						else:
+							self.compare(what, fmt, got, want, lut.single_error + slack(fmt))
+
+	def test_cube(self):
+		rng = random.Random(7)
+		cube = koliba.Cube(luts()["trilinear"], 17)
+		for interpolation in ("trilinear", "tetrahedral"):
+			cube.interpolation = interpolation
+			for fmt in ("rgba8", "rgba16", "rgb10a2", "rgba16f", "rgba32"):
+				src = frame(fmt, rng)
+				koliba.SetSimd("reference")
+				want = bytes(cube.apply(src, format=fmt))
+				for isa in self.isas:
+					koliba.SetSimd(isa)
+					what = "cube %s %s %s" % (interpolation, fmt, isa)
+					got = bytes(cube.apply(src, format=fmt))
+					self.compare(what, fmt, got, want, slack(fmt))
+
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,105 @@
+# Hammer the shared objects of koliba from many threads at once. Without
+# the GIL (or with it, but with the worker pool running apply() outside of
+# it), any missing lock shows up here as a crash, a torn value, or an
+# exception other than the ones we expect.
+
+import math
+import random
+import threading
+import unittest
+
+import koliba
+
+THREADS = 32
+ROUNDS = 200
+PIXELS = 4096
+
+
+def run(workers):
+	barrier = threading.Barrier(len(workers))
+	errors = []
+
+	def body(fn, seed):
+		rng = random.Random(seed)
+		barrier.wait()
+		try:
+			for _ in range(ROUNDS):
+				fn(rng)
+		except BaseException as e:
+			errors.append(e)
+
+	threads = [threading.Thread(target=body, args=(fn, i)) for i, fn in enumerate(workers)]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	if errors:
+		raise errors[0]
+
+
+class TestThreads(unittest.TestCase):
+	def setUp(self):
+		self.threads = koliba.Threads()
+		koliba.SetThreads(4)
+
+	def tearDown(self):
+		koliba.SetThreads(self.threads)
+
+	def test_apply_and_vertices(self):
+		flut = koliba.Flut()
+		slut = koliba.Slut()
+		src = bytes(random.Random(0).randrange(256) for _ in range(PIXELS * 4))
+		vertices = ("black", "blue", "green", "cyan", "red", "magenta", "yellow", "white")
+
+		def apply_flut(rng):
+			dst = flut.apply(src, format="rgba8")
+			self.assertEqual(len(dst), len(src))
+
+		def apply_slut(rng):
+			dst = bytearray(len(src))
+			slut.apply(src, dst, format=rng.choice(("rgba8", "bgra8")), precision=rng.choice(("double", "fixed")))
+
+		def set_vertex(rng):
+			v = rng.choice(vertices)
+			c = (rng.random(), rng.random(), rng.random())
+			setattr(slut, v, c)
+			r = getattr(slut, v)
+			self.assertEqual(len(r), 3)
+			flut.flut = slut.flut.flut
+
+		run([(apply_flut, apply_slut, set_vertex)[i % 3] for i in range(THREADS)])
+
+	def test_angle_array(self):
+		arr = koliba.AngleArray([0.0] * 64)
+
+		def resize(rng):
+			try:
+				arr.degrees = [rng.uniform(-360.0, 360.0) for _ in range(rng.randrange(1, 256))]
+			except BufferError:
+				pass	# Someone is reading the angles, that is allowed.
+
+		def trig(rng):
+			# Another thread may resize the array between the two calls, so
+			# each result can only be checked on its own.
+			for r in (arr.sin(), arr.cos()):
+				self.assertTrue(1 <= len(r) <= 255)
+				for x in r:
+					self.assertTrue(-1.0 <= x <= 1.0)
+
+		run([(resize, trig)[i % 2] for i in range(THREADS)])
+
+	def test_angle_setters(self):
+		angle = koliba.Angle()
+
+		def setter(rng):
+			d = rng.uniform(-720.0, 720.0)
+			attr = rng.choice(("degrees", "radians", "turns", "pis"))
+			setattr(angle, attr, {"degrees": d, "radians": math.radians(d), "turns": d / 360.0, "pis": d / 180.0}[attr])
+			s, c = angle.sin(), angle.cos()
+			self.assertAlmostEqual(s * s + c * c, 1.0, places=9)
+
+		run([setter] * THREADS)
+
+
+if __name__ == "__main__":
+	unittest.main()